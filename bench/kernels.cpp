@@ -0,0 +1,395 @@
+// Micro-benchmarks of the innermost kernels of the renderer.
+//
+// Each benchmark runs its kernel over a small ring of precomputed inputs, so
+// that the compiler can't hoist the work out of the loop, and prints the
+// average time per call. The best of several repetitions is reported to filter
+// out noise from other processes. Benchmarks of code that makes or traces rays
+// also report rays per second.
+//
+// Run as oxatrace-bench --json, the results are printed as one JSON object
+// once all are done, for tracking them across versions:
+//
+//   {"precision": "double", "results": [
+//     {"name": "...", "ns_per_op": 12.5, "rays_per_second": 80000000},
+//     ...
+//   ]}
+//
+// rays_per_second is null for benchmarks that don't deal in rays.
+
+#include "camera.hpp"
+#include "color.hpp"
+#include "image.hpp"
+#include "isa.hpp"
+#include "math.hpp"
+#include "renderer.hpp"
+#include "sampler.hpp"
+#include "scene.hpp"
+#include "scenes.hpp"
+#include "solids.hpp"
+#include "tiles.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace oxatrace;
+
+namespace {
+  constexpr std::size_t RING = 1024;   // Number of distinct inputs.
+  constexpr std::size_t ITERATIONS = 1 << 20;
+  constexpr unsigned    REPETITIONS = 7;
+
+  // Keeps results alive so that the benchmarked code isn't optimised out.
+  volatile real sink;
+
+  struct result {
+    std::string name;
+    double      ns;    // Per operation.
+    std::size_t rays;  // Made or traced per operation; 0 if none.
+  };
+
+  std::vector<result> results;
+  bool                json = false;  // Print results only once all are done.
+
+  // Run f over the ring iterations times, and record the time it took per
+  // call. Each call deals in rays rays, if any. Calls that take long are run
+  // fewer times than the default.
+  template <typename F>
+  void
+  run(std::string const& name, F f, std::size_t rays = 0,
+      std::size_t iterations = ITERATIONS) {
+    using clock = std::chrono::steady_clock;
+
+    double ns = std::numeric_limits<double>::max();
+    for (unsigned r = 0; r < REPETITIONS; ++r) {
+      real accum{};
+      clock::time_point const start = clock::now();
+      for (std::size_t i = 0; i < iterations; ++i)
+        accum += f(i % RING);
+      clock::time_point const end = clock::now();
+      sink = accum;
+
+      ns = std::min(
+        ns, std::chrono::duration<double, std::nano>(end - start).count()
+      );
+    }
+
+    results.push_back({name, ns / iterations, rays});
+    if (json)
+      return;
+
+    std::cout << std::setw(44) << std::left << name << std::right
+              << std::fixed << std::setprecision(2)
+              << std::setw(12) << ns / iterations << " ns/op";
+    if (rays > 0)
+      std::cout << std::setprecision(1) << std::setw(10)
+                << rays * 1e3 / (ns / iterations) << " Mrays/s";
+    std::cout << '\n';
+  }
+
+  // name as a JSON string. Names are ASCII, so only quotes and backslashes
+  // need escaping.
+  std::string
+  json_string(std::string const& name) {
+    std::string result = "\"";
+    for (char c : name) {
+      if (c == '"' || c == '\\')
+        result += '\\';
+      result += c;
+    }
+    return result + '"';
+  }
+
+  void
+  print_json(std::ostream& out) {
+    out << "{\"precision\": \""
+        << (sizeof(real) == sizeof(float) ? "single" : "double")
+        << "\", \"results\": [\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+      result const& r = results[i];
+      std::ostringstream rate;
+      if (r.rays > 0)
+        rate << std::fixed << std::setprecision(0) << r.rays * 1e9 / r.ns;
+      else
+        rate << "null";
+      out << "  {\"name\": " << json_string(r.name)
+          << ", \"ns_per_op\": " << std::fixed << std::setprecision(3) << r.ns
+          << ", \"rays_per_second\": " << rate.str() << '}'
+          << (i + 1 < results.size() ? "," : "") << '\n';
+    }
+    out << "]}\n";
+  }
+
+  // A scene of n unit spheres scattered around the origin, so that rays
+  // aimed at the origin pass by most of them.
+  std::unique_ptr<simple_scene>
+  make_spheres(std::size_t n, random_eng& prng) {
+    std::uniform_real_distribution<real> distrib{-1.0, 1.0};
+    auto const sphere_shape = std::make_shared<sphere>();
+    material const mat{{0.5, 0.5, 0.5}, 0.5, 0.5, 20, 0.0};
+
+    scene_definition def;
+    for (std::size_t i = 0; i < n; ++i) {
+      auto s = std::make_unique<solid>(sphere_shape, mat);
+      s->scale(0.5).translate(
+        vector3{distrib(prng), distrib(prng), distrib(prng)} * 4
+      );
+      def.add_solid(std::move(s));
+    }
+    return simple_scene::make(std::move(def));
+  }
+}
+
+int
+main(int argc, char** argv) {
+  if (argc > 2 || (argc == 2 && std::strcmp(argv[1], "--json") != 0)) {
+    std::cerr << "Usage: oxatrace-bench [--json]\n";
+    return EXIT_FAILURE;
+  }
+  json = argc == 2;
+
+  // Size of the blocks of pixels or rays the batched kernels run over.
+  constexpr std::size_t BLOCK = 16;
+
+  random_eng prng{42};
+  std::uniform_real_distribution<real> distrib{-1.0, 1.0};
+
+  std::vector<vector3> points;
+  std::vector<unit3>   directions;
+  std::vector<hdr_color> colors;
+  for (std::size_t i = 0; i < RING; ++i) {
+    points.push_back(vector3{distrib(prng), distrib(prng), distrib(prng)} * 10);
+    directions.push_back(vector3{distrib(prng), distrib(prng), distrib(prng)});
+    colors.push_back({distrib(prng) + 1, distrib(prng) + 1, distrib(prng) + 1});
+  }
+
+  std::vector<ray> rays;
+  for (std::size_t i = 0; i < RING; ++i)
+    rays.push_back({points[i], -points[i]});
+
+  affine3 tr{affine3::Identity()};
+  tr.prescale(3.0).prerotate(angle_axis{0.3, vector3::UnitX()})
+    .pretranslate(vector3{1.0, 2.0, -15.0});
+
+  sphere const sph;
+  plane const pln;
+  solid sol{std::make_shared<sphere>(),
+            material{{0.5, 0.5, 0.5}, 0.5, 0.5, 20, 0.0}};
+  sol.transform(tr);
+
+  // The rays of sphere::intersect as seen by the solid, so that it hits the
+  // same points and the difference is the cost of the transform.
+  std::vector<ray> world_rays;
+  for (ray const& r : rays)
+    world_rays.push_back(transform(r, tr));
+
+  camera cam{4.0 / 3.0, PI / 2};
+  cam.translate(vector3{1.0, 2.0, -15.0}).rotate(angle_axis{0.3,
+                                                            vector3::UnitX()});
+  std::vector<real> film_u, film_v;
+  std::uniform_real_distribution<real> unit{0.0, 1.0};
+  for (std::size_t i = 0; i < RING + BLOCK; ++i) {
+    film_u.push_back(unit(prng));
+    film_v.push_back(unit(prng));
+  }
+  ray_batch camera_rays;
+
+  run("color add/mul", [&] (std::size_t i) {
+    hdr_color c = colors[i];
+    c += colors[(i + 1) % RING] * real(0.5);
+    c *= colors[(i + 2) % RING];
+    return c[0];
+  });
+  run("transform(ray, affine3)", [&] (std::size_t i) {
+    return transform(rays[i], tr).direction().x();
+  });
+  run("camera::make_ray", [&] (std::size_t i) {
+    return cam.make_ray(film_u[i], film_v[i]).direction().x();
+  }, 1);
+  run("point_at", [&] (std::size_t i) {
+    return point_at(rays[i], real(0.5)).x();
+  });
+  run("reflect", [&] (std::size_t i) {
+    return reflect(directions[i], directions[(i + 1) % RING]).get().x();
+  });
+  run("cos_angle", [&] (std::size_t i) {
+    return cos_angle(points[i], directions[(i + 1) % RING]);
+  });
+  run("sphere::intersect", [&] (std::size_t i) {
+    shape::intersection_list const l = sph.intersect(rays[i]);
+    return l.empty() ? real(0) : l.front();
+  }, 1);
+  run("plane::intersect", [&] (std::size_t i) {
+    shape::intersection_list const l = pln.intersect(rays[i]);
+    return l.empty() ? real(0) : l.front();
+  }, 1);
+  run("solid::intersect", [&] (std::size_t i) {
+    shape::intersection_list const l = sol.intersect(world_rays[i]);
+    return l.empty() ? real(0) : l.front();
+  }, 1);
+  for (std::size_t n : {1, 4, 16, 64}) {
+    std::unique_ptr<simple_scene> const sc = make_spheres(n, prng);
+    run("simple_scene::intersect_solid, " + std::to_string(n) + " solids",
+        [&] (std::size_t i) {
+          auto const hit = sc->intersect_solid(rays[i]);
+          return hit ? hit->position().x() : real(0);
+        }, 1, ITERATIONS / n);
+  }
+
+  for (math_mode mode : {math_mode::exact, math_mode::fast})
+    run(std::string{"cos_lobe_perturb"}
+          + (mode == math_mode::fast ? " [fast]" : ""),
+        [&] (std::size_t i) {
+          return cos_lobe_perturb(directions[i], 20,
+                                  {film_u[i], film_v[i]}, mode).get().x();
+        });
+
+  for (char const* name : {"sobol", "random"}) {
+    std::unique_ptr<sampler> const s = make_sampler(name, 42);
+    s->start_pixel(0);
+    run(std::string{"sampler::next_2d ["} + name + "]",
+        [&] (std::size_t i) {
+          // Samples of a few bounces each, as the renderer takes them.
+          if (i % 4 == 0)
+            s->start_sample();
+          return s->next_2d().x();
+        });
+    run(std::string{"sampler::film_2d ["} + name + "]",
+        [&] (std::size_t i) {
+          return s->film_2d(i, i % 16).x();
+        });
+  }
+
+  // The dispatched kernels, once for every ISA this CPU supports. Tone-mapping
+  // kernels are run over blocks of BLOCK pixels.
+  std::vector<hdr_color> pixels(colors);
+  pixels.insert(pixels.end(), colors.begin(), colors.begin() + BLOCK);
+  real* const lanes = &pixels[0][0];
+  std::vector<ldr_color> quantized(BLOCK);
+
+  // Whole images for the tone-mapping functions.
+  constexpr std::size_t IMAGE_SIDE = 256;
+  constexpr std::size_t IMAGE_ITERATIONS = 16;
+  hdr_image image{IMAGE_SIDE, IMAGE_SIDE};
+  for (std::size_t i = 0; i < image.size(); ++i)
+    image.data()[i] = colors[i % RING];
+  ldr_image developed{IMAGE_SIDE, IMAGE_SIDE};
+  std::string const image_suffix =
+    ", " + std::to_string(IMAGE_SIDE) + "x" + std::to_string(IMAGE_SIDE);
+
+  // A tile of the default scene, seen as oxatrace sees it by default.
+  constexpr std::size_t TILE_SIDE = 16;
+  std::unique_ptr<scene> const two_balls =
+    simple_scene::make(make_scene_definition("two_balls"));
+  camera scene_cam{4.0 / 3.0, PI / 2};
+  scene_cam.rotate(angle_axis{-PI / 18, vector3::UnitX()})
+    .rotate(angle_axis{PI / 15, vector3::UnitY()})
+    .translate({0.0, 4.0, 0.0});
+  shading_policy policy = default_shading_policy();
+  policy.supersampling = 1;
+  hdr_image frame{640, 480};
+  tile const scene_tile{312, 272, TILE_SIDE, TILE_SIDE};
+  std::unique_ptr<sampler> const scene_sampler = make_sampler("sobol", 0);
+
+  for (isa set : {isa::sse42, isa::avx2, isa::avx512}) {
+    if (!isa_supported(set)) continue;
+    select_kernels(set);
+    kernel_table const& k = kernels();
+    std::string const suffix = " [" + isa_name(set) + "]";
+
+    run("intersect_sphere" + suffix, [&] (std::size_t i) {
+      real t[2];
+      return k.intersect_sphere(rays[i].origin4().data(),
+                                rays[i].direction4().data(), EPSILON, t)
+        ? t[0] : real(0);
+    }, 1);
+    run("phong" + suffix, [&] (std::size_t i) {
+      real cos_alpha{}, highlight{};
+      k.phong(directions[i].get().data(), points[(i + 1) % RING].data(), 20,
+              false, &cos_alpha, &highlight);
+      return cos_alpha + highlight;
+    });
+    run("camera::make_rays, 16 rays" + suffix, [&] (std::size_t i) {
+      cam.make_rays(BLOCK, &film_u[i], &film_v[i], camera_rays);
+      return camera_rays.data()[0];
+    }, BLOCK);
+    run("expose, 16 px" + suffix, [&] (std::size_t i) {
+      k.expose(lanes + i * hdr_color::LANES, BLOCK, 1.0);
+      return lanes[i * hdr_color::LANES];
+    });
+    run("reinhard, 16 px" + suffix, [&] (std::size_t i) {
+      k.reinhard(lanes + i * hdr_color::LANES, BLOCK, 1.5);
+      return lanes[i * hdr_color::LANES];
+    });
+    run("gamma, 16 px" + suffix, [&] (std::size_t i) {
+      k.gamma(lanes + i * hdr_color::LANES, BLOCK, 1 / 2.2);
+      return lanes[i * hdr_color::LANES];
+    });
+    run("log_luminance_sum, 16 px" + suffix, [&] (std::size_t i) {
+      return real(k.log_luminance_sum(lanes + i * hdr_color::LANES, BLOCK,
+                                      0.001));
+    });
+    run("quantize, 16 px" + suffix, [&] (std::size_t i) {
+      k.quantize(lanes + i * hdr_color::LANES, BLOCK, &quantized[0][0]);
+      return real(quantized[0][0]);
+    });
+    run("develop, 16 px" + suffix, [&] (std::size_t i) {
+      k.develop(lanes + i * hdr_color::LANES, BLOCK, tone_operator::reinhard,
+                1.5, 1 / 2.2, &quantized[0][0]);
+      return real(quantized[0][0]);
+    });
+
+    develop_table const table =
+      make_develop_table({tone_operator::reinhard, 1.5, 1 / 2.2});
+    tone_lookup const lookup{table.curve.op, table.curve.param,
+                             table.curve.exponent, table.low.data(),
+                             table.high.data(), table.buckets.data(),
+                             table.shift};
+    run("develop_table, 16 px" + suffix, [&] (std::size_t i) {
+      k.develop_table(lanes + i * hdr_color::LANES, BLOCK, lookup,
+                      &quantized[0][0]);
+      return real(quantized[0][0]);
+    });
+
+    run("expose" + image_suffix + suffix, [&] (std::size_t) {
+      return expose(image, 1.0).data()[0][0];
+    }, 0, IMAGE_ITERATIONS);
+    run("apply_reinhard" + image_suffix + suffix, [&] (std::size_t) {
+      return apply_reinhard(image).data()[0][0];
+    }, 0, IMAGE_ITERATIONS);
+    run("correct_gamma" + image_suffix + suffix, [&] (std::size_t) {
+      return correct_gamma(image).data()[0][0];
+    }, 0, IMAGE_ITERATIONS);
+    run("ldr_from_hdr" + image_suffix + suffix, [&] (std::size_t) {
+      return real(ldr_from_hdr(image).data()[0][0]);
+    }, 0, IMAGE_ITERATIONS);
+    run("develop_pixels" + image_suffix + suffix, [&] (std::size_t) {
+      develop_pixels(image, 0, image.size(), table.curve, developed);
+      return real(developed.data()[0][0]);
+    }, 0, IMAGE_ITERATIONS);
+    run("develop_pixels, table" + image_suffix + suffix, [&] (std::size_t) {
+      develop_pixels(image, 0, image.size(), table, developed);
+      return real(developed.data()[0][0]);
+    }, 0, IMAGE_ITERATIONS);
+
+    // One camera ray per pixel; reflected and shadow rays aren't counted.
+    run("sample_tile, 16x16 px" + suffix, [&] (std::size_t) {
+      sample_tile(*two_balls, scene_cam, scene_tile, policy, *scene_sampler, 0,
+                  frame);
+      return frame.pixel_at(scene_tile.x, scene_tile.y)[0];
+    }, TILE_SIDE * TILE_SIDE, 64);
+  }
+
+  if (json)
+    print_json(std::cout);
+}
@@ -1,4 +1,5 @@
 #include "camera.hpp"
+#include "isa.hpp"
 
 #include <cmath>
 #include <stdexcept>
@@ -12,44 +13,107 @@ using namespace oxatrace;
 // shooting a ray originating on the film and going through the origin of the
 // camera space.
 
-camera::camera(double aspect_ratio, double field_of_view)
-  : camera_to_world_{Eigen::Affine3d::Identity()}
+camera::camera(real aspect_ratio, real field_of_view)
+  : camera_to_world_{affine3::Identity()}
 {
   assert(field_of_view > 0.0 && field_of_view < PI);
 
-  double const y_fov = field_of_view / aspect_ratio;
+  real const y_fov = field_of_view / aspect_ratio;
 
   film_max_x_ = std::sin(field_of_view / 2);
   film_max_y_ = std::sin(y_fov / 2);
+  update_film();
+}
+
+camera
+camera::cube_face() {
+  // The film sits at distance 1 from the pinhole, so its half-side must be 1
+  // for a right angle.
+  camera result{1, PI / 2};
+  result.film_max_x_ = 1;
+  result.film_max_y_ = 1;
+  result.update_film();
+  return result;
+}
+
+void
+ray_batch::resize(std::size_t size) {
+  coords_.resize(6 * size);
+  size_ = size;
+}
+
+ray
+ray_batch::operator [] (std::size_t i) const {
+  assert(i < size_);
+  real const* c = coords_.data() + i;
+  return {oxatrace::ray::padded{},
+          {c[0], c[size_], c[2 * size_], 0},
+          {c[3 * size_], c[4 * size_], c[5 * size_], 0}};
 }
 
 ray
-camera::make_ray(double u, double v) const {
+camera::make_ray(real u, real v) const {
   assert(u >= 0.0 && v >= 0.0 && u < 1.0 && v < 1.0);
 
-  // We'll first scale u, v into the range [-1, +1] so that extreme values of
-  // u, v give extreme values of our film. Then we'll account for the fact that
-  // our film is located behind the pinhole, so without any transformation we'd
-  // be getting flipped result. However, the horizontal component doesn't
-  // need any flipping as bitmaps and maths have different opinions on the
-  // meaning of the y axis.
+  // Evaluated in the same order as the film_rays kernel, so that both give
+  // the same rays.
+  vector3 const film = film_corner_ + u * film_u_ + v * film_v_;
+  return {position_ + film, -film};
+}
 
-  vector3 origin{
-    film_max_x_ * -2 * (u - 0.5),
-    film_max_y_ * +2 * (v - 0.5),
-    1.0
+void
+camera::make_rays(std::size_t count, real const* u, real const* v,
+                  ray_batch& rays) const {
+  real const basis[12] = {
+    position_.x(),    position_.y(),    position_.z(),
+    film_corner_.x(), film_corner_.y(), film_corner_.z(),
+    film_u_.x(),      film_u_.y(),      film_u_.z(),
+    film_v_.x(),      film_v_.y(),      film_v_.z()
   };
-  return transform({origin, -origin}, camera_to_world_);
+
+  rays.resize(count);
+  kernels().film_rays(basis, u, v, count, rays.data());
+}
+
+real
+camera::pixel_spread(std::size_t frame_height) const {
+  assert(frame_height > 0);
+  vector3 const centre = film_corner_ + film_u_ / 2 + film_v_ / 2;
+  return film_v_.norm() / real(frame_height) / centre.norm();
 }
 
 camera&
 camera::translate(vector3 const& tr) {
   camera_to_world_.pretranslate(tr);
+  update_film();
   return *this;
 }
 
 camera&
-camera::rotate(Eigen::AngleAxisd const& rot) {
+camera::rotate(angle_axis const& rot) {
   camera_to_world_.prerotate(rot);
+  update_film();
   return *this;
 }
+
+void
+camera::update_film() {
+  // We'll first scale u, v into the range [-1, +1] so that extreme values of
+  // u, v give extreme values of our film. Then we'll account for the fact that
+  // our film is located behind the pinhole, so without any transformation we'd
+  // be getting flipped result. However, the horizontal component doesn't
+  // need any flipping as bitmaps and maths have different opinions on the
+  // meaning of the y axis.
+  //
+  // In camera space, the film point is thus
+  //
+  //   (film_max_x * -2 * (u - 1/2), film_max_y * 2 * (v - 1/2), 1),
+  //
+  // which the linear part of camera_to_world takes to the world-space vector
+  // below, and its translation to the position of the pinhole.
+  auto const linear = camera_to_world_.linear();
+  film_u_ = linear.col(0) * (film_max_x_ * -2);
+  film_v_ = linear.col(1) * (film_max_y_ * +2);
+  film_corner_ = linear.col(2) - film_u_ / 2 - film_v_ / 2;
+  position_ = camera_to_world_.translation();
+}
@@ -5,8 +5,33 @@
 
 #include <Eigen/Geometry>
 
+#include <cstddef>
+#include <vector>
+
 namespace oxatrace {
 
+// A number of rays, stored as a structure of arrays: one array for each
+// coordinate of the origins and of the directions. This is the form in which
+// camera::make_rays generates them.
+class ray_batch {
+public:
+  std::size_t size() const noexcept { return size_; }
+
+  // Make room for size rays. The contents are unspecified afterwards.
+  void resize(std::size_t size);
+
+  // The coordinates, in the order origin x, y, z, direction x, y, z; each
+  // array holds size() of them.
+  real* data() noexcept             { return coords_.data(); }
+  real const* data() const noexcept { return coords_.data(); }
+
+  ray operator [] (std::size_t i) const;
+
+private:
+  std::vector<real> coords_;
+  std::size_t       size_ = 0;
+};
+
 // A source of rays.
 //
 // This models a simple pinhole camera. In its default position, the camera
@@ -15,23 +40,51 @@ namespace oxatrace {
 class camera {
 public:
   // field_of_view must be in (0, pi).
-  camera(double aspect_ratio, double field_of_view);
+  camera(real aspect_ratio, real field_of_view);
+
+  // Camera for one face of a cube map: Its film is square and spans exactly
+  // a right angle in both directions, so that six such cameras, rotated
+  // towards the six axes, see the whole sphere of directions without gaps.
+  static camera
+  cube_face();
 
   // Creates a ray corresponding to a position (u, v) on the film.  Throws
   // (u, v) must be in [0, 1]^2.
-  ray make_ray(double u, double v) const;
+  ray make_ray(real u, real v) const;
   ray make_ray(vector2 pos) const { return make_ray(pos.x(), pos.y()); }
 
+  // Create the rays for count positions on the film, given by the arrays u
+  // and v, at once. The result is the same as make_ray's for each position.
+  void make_rays(std::size_t count, real const* u, real const* v,
+                 ray_batch& rays) const;
+
+  // Angle, in radians, that a pixel spans when the film is frame_height
+  // pixels high, taken at the centre of the film. Rays start on the film,
+  // which is taken to be at the pinhole for this, so that a pixel's rays are
+  // about pixel_spread() * d apart at distance d from their origin.
+  real pixel_spread(std::size_t frame_height) const;
+
   // Translate the camera in space.
   camera& translate(vector3 const& tr);
 
   // Rotate the camera in space.
-  camera& rotate(Eigen::AngleAxisd const& rot);
+  camera& rotate(angle_axis const& rot);
 
 private:
-  Eigen::Affine3d   camera_to_world_;
-  double            film_max_x_;
-  double            film_max_y_;
+  affine3   camera_to_world_;
+  real      film_max_x_;
+  real      film_max_y_;
+
+  // The film in world space: The point (u, v) of the film lies at
+  // position + film_corner + u * film_u + v * film_v, and the ray through it
+  // heads back through position. Updated by update_film whenever the camera
+  // or its film changes, so that no ray needs a matrix product.
+  vector3   position_;
+  vector3   film_corner_;
+  vector3   film_u_;
+  vector3   film_v_;
+
+  void update_film();
 };
 
 } // namespace oxatrace
@@ -0,0 +1,189 @@
+#include "checkpoint.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace oxatrace;
+
+static char const* const MAGIC = "OXATRACE-CHECKPOINT 2";
+
+// FNV-1a hash of the tiles, which stands for them in the header.
+static std::uint64_t
+hash_tiles(std::vector<checkpoint_tile> const& tiles) {
+  std::uint64_t hash = 0xcbf29ce484222325u;
+  for (checkpoint_tile const& t : tiles)
+    for (std::uint64_t x : {std::uint64_t(t.view), std::uint64_t(t.tile.x),
+                            std::uint64_t(t.tile.y),
+                            std::uint64_t(t.tile.width),
+                            std::uint64_t(t.tile.height)})
+      for (unsigned byte = 0; byte < 8; ++byte) {
+        hash ^= (x >> (8 * byte)) & 0xff;
+        hash *= 0x100000001b3u;
+      }
+  return hash;
+}
+
+// Flush the file or directory at path to disk.
+static void
+sync_path(std::string const& path) {
+  int const fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::system_error{errno, std::generic_category(), "open " + path};
+  int const result = fsync(fd);
+  int const error = errno;
+  close(fd);
+  if (result != 0)
+    throw std::system_error{error, std::generic_category(), "fsync " + path};
+}
+
+// Write or read the rows of image within tile t.
+template <typename Image>
+static void
+write_tile(std::ostream& out, Image const& image, tile const& t) {
+  using pixel = typename Image::pixel_type;
+  for (std::size_t y = t.y; y < t.y + t.height; ++y)
+    out.write(reinterpret_cast<char const*>(&image.pixel_at(t.x, y)),
+              t.width * sizeof(pixel));
+}
+
+template <typename Image>
+static void
+read_tile(std::istream& in, Image& image, tile const& t) {
+  using pixel = typename Image::pixel_type;
+  for (std::size_t y = t.y; y < t.y + t.height; ++y)
+    in.read(reinterpret_cast<char*>(&image.pixel_at(t.x, y)),
+            t.width * sizeof(pixel));
+}
+
+checkpoint::checkpoint(std::string fingerprint,
+                       std::vector<checkpoint_view> views,
+                       std::vector<checkpoint_tile> tiles)
+  : fingerprint_{std::move(fingerprint)}
+  , views_{std::move(views)}
+  , tiles_{std::move(tiles)}
+  , finished_{new std::atomic<bool>[tiles_.size()]}
+  , saved_(tiles_.size(), false)
+{
+  for (std::size_t i = 0; i < tiles_.size(); ++i)
+    finished_[i] = false;
+}
+
+std::string
+checkpoint::header() const {
+  std::ostringstream result;
+  result << MAGIC << '\n'
+         << fingerprint_ << '\n'
+         << sizeof(hdr_color) << ' ' << sizeof(pixel_features) << ' '
+         << views_.size();
+  for (checkpoint_view const& view : views_)
+    result << ' ' << view.image->width() << ' ' << view.image->height() << ' '
+           << (view.features != nullptr);
+  result << '\n' << tiles_.size() << ' ' << hash_tiles(tiles_) << '\n';
+  return result.str();
+}
+
+void
+checkpoint::write_record(std::ostream& out, std::uint64_t i) const {
+  checkpoint_view const& view = views_[tiles_[i].view];
+  out.write(reinterpret_cast<char const*>(&i), sizeof(i));
+  write_tile(out, *view.image, tiles_[i].tile);
+  if (view.features)
+    write_tile(out, *view.features, tiles_[i].tile);
+}
+
+void
+checkpoint::save(std::string const& filename) {
+  std::vector<std::uint64_t> done;
+  for (std::size_t i = 0; i < tiles_.size(); ++i)
+    if (finished(i) && !saved_[i])
+      done.push_back(i);
+
+  if (log_.is_open()) {
+    for (std::uint64_t i : done)
+      write_record(log_, i);
+    log_.flush();
+    sync_path(filename);
+  } else {
+    std::string const temp = filename + ".tmp";
+    {
+      std::ofstream out(temp.c_str(), std::ios::out | std::ios::binary);
+      out.exceptions(std::ios::badbit | std::ios::failbit);
+      out << header();
+      for (std::uint64_t i : done)
+        write_record(out, i);
+    }
+
+    sync_path(temp);
+    if (std::rename(temp.c_str(), filename.c_str()) != 0)
+      throw std::system_error{errno, std::generic_category(),
+                              "rename " + filename};
+
+    std::string::size_type const slash = filename.rfind('/');
+    sync_path(slash == std::string::npos ? "."
+                                         : filename.substr(0, slash + 1));
+
+    log_.exceptions(std::ios::badbit | std::ios::failbit);
+    log_.open(filename.c_str(),
+              std::ios::out | std::ios::binary | std::ios::app);
+  }
+
+  for (std::uint64_t i : done)
+    saved_[i] = true;
+}
+
+std::size_t
+checkpoint::load(std::string const& filename) {
+  std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+  in.exceptions(std::ios::badbit);
+  if (!in)
+    throw std::ios_base::failure{"checkpoint::load: Can't open " + filename};
+
+  std::string magic;
+  if (!std::getline(in, magic) || magic != MAGIC)
+    throw std::runtime_error{"checkpoint::load: Not a checkpoint: "
+                             + filename};
+
+  // The rest of the header must match this render's.
+  std::string const expected = header().substr(magic.size() + 1);
+  std::string actual(expected.size(), '\0');
+  in.read(&actual[0], actual.size());
+  if (!in || actual != expected)
+    throw std::runtime_error{"checkpoint::load: " + filename
+                             + " is a checkpoint of a different render"};
+
+  auto malformed = [&] {
+    return std::runtime_error{"checkpoint::load: Malformed checkpoint "
+                              + filename};
+  };
+
+  // Tiles follow until the end of the file. One cut short by the process
+  // being killed while saving is left unfinished, to be rendered again.
+  std::size_t count = 0;
+  while (in.peek() != std::ifstream::traits_type::eof()) {
+    std::uint64_t i;
+    in.read(reinterpret_cast<char*>(&i), sizeof(i));
+    if (!in)
+      break;
+    if (i >= tiles_.size() || finished(i))
+      throw malformed();
+
+    checkpoint_view const& view = views_[tiles_[i].view];
+    read_tile(in, *view.image, tiles_[i].tile);
+    if (view.features)
+      read_tile(in, *view.features, tiles_[i].tile);
+    if (!in)
+      break;
+    finish(i);
+    ++count;
+  }
+  return count;
+}
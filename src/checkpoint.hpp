@@ -0,0 +1,117 @@
+#ifndef OXATRACE_CHECKPOINT_HPP
+#define OXATRACE_CHECKPOINT_HPP
+
+#include "features.hpp"
+#include "image.hpp"
+#include "tiles.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace oxatrace {
+
+// An image being rendered, along with its features if those are kept.
+struct checkpoint_view {
+  hdr_image*     image;
+  feature_image* features;  // May be null.
+};
+
+// A tile of one of the images.
+struct checkpoint_tile {
+  std::size_t    view;
+  oxatrace::tile tile;
+};
+
+// The tiles of a render finished so far, so that a render that gets
+// interrupted can be resumed from where it was.
+//
+// Workers report each tile once all of its pixels are final; those pixels are
+// only read from then on, so a checkpoint can be saved while the render goes
+// on, and workers never wait for it. Resuming a render then gives the same
+// result as an uninterrupted one, since the samples of each pixel don't depend
+// on the order the pixels are rendered in.
+//
+// The file is a log: the first save writes all tiles finished so far, and each
+// later one appends only those finished since. So each save costs the tiles
+// rendered in between plus one fsync, rather than the whole image again. A
+// checkpoint that resumes a render rewrites the file with the tiles it loaded
+// on its first save, which compacts it.
+//
+// Pixels are saved as they are in memory, so a checkpoint can only be resumed
+// by a build of the same precision, on a machine of the same byte order.
+class checkpoint {
+public:
+  // fingerprint identifies the render, by all that affects its pixels. A
+  // checkpoint is only loaded into a render of the same fingerprint, views and
+  // tiles.
+  checkpoint(std::string fingerprint, std::vector<checkpoint_view> views,
+             std::vector<checkpoint_tile> tiles);
+
+  std::size_t
+  tiles() const { return tiles_.size(); }
+
+  bool
+  finished(std::size_t tile) const {
+    return finished_[tile].load(std::memory_order_acquire);
+  }
+
+  // Mark a tile as finished. Lock-free; may be called by any thread.
+  void
+  finish(std::size_t tile) {
+    finished_[tile].store(true, std::memory_order_release);
+  }
+
+  // Save the tiles finished so far to filename, which must be the same on
+  // every call.
+  //
+  // On the first call, the checkpoint is written to a temporary file, flushed
+  // to disk and renamed over filename, so that filename always holds a whole
+  // checkpoint. Later calls append the tiles finished since and flush
+  // filename. If the process is killed while appending, the last tile may be
+  // cut short; load skips it.
+  //
+  // Must not be called by several threads at once.
+  //
+  // Throws std::ios_base::failure: I/O error.
+  //        std::system_error: Can't flush or rename the file.
+  void
+  save(std::string const& filename);
+
+  // Copy the tiles saved in filename into the views, and mark them finished.
+  // Returns the number of tiles loaded. A tile cut short at the end of the file
+  // is left unfinished.
+  //
+  // Throws std::ios_base::failure: I/O error.
+  //        std::runtime_error: Not a checkpoint, a malformed one, or one of a
+  //                            different render.
+  std::size_t
+  load(std::string const& filename);
+
+private:
+  std::string                          fingerprint_;
+  std::vector<checkpoint_view>         views_;
+  std::vector<checkpoint_tile>         tiles_;
+  std::unique_ptr<std::atomic<bool>[]> finished_;
+
+  // The file saved to, open for appending once first written, and the tiles
+  // in it. Only used by save.
+  std::ofstream                        log_;
+  std::vector<bool>                    saved_;
+
+  // The header of checkpoints of this render.
+  std::string
+  header() const;
+
+  // Write tile number i, with its index, to out.
+  void
+  write_record(std::ostream& out, std::uint64_t i) const;
+};
+
+}  // namespace oxatrace
+
+#endif
@@ -6,16 +6,16 @@ using namespace oxatrace;
 
 /// See http://en.wikipedia.org/wiki/Luminance
 /// See http://en.wikipedia.org/wiki/Luma_(video)
-double
+real
 oxatrace::luminance(hdr_color const& color) {
   return 0.2126 * color[0] + 0.7152 * color[1] + 0.0722 * color[2];
 }
 
-double
+real
 oxatrace::distance(hdr_color x, hdr_color y) {
-  double sum{};
+  real sum{};
   for (std::size_t channel = 0; channel < hdr_color::CHANNELS; ++channel) {
-    double const d = x[channel] - y[channel];
+    real const d = x[channel] - y[channel];
     sum += d * d;
   }
 
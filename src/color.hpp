@@ -1,6 +1,8 @@
 #ifndef OXATRACE_PIXEL_HPP
 #define OXATRACE_PIXEL_HPP
 
+#include "math.hpp"
+
 #include <boost/operators.hpp>
 
 #include <array>
@@ -18,6 +20,11 @@ namespace oxatrace {
 // of type ChannelT.
 //
 // The channel type must not throw exceptions.
+//
+// The channels are stored padded to four lanes, the fourth one being always
+// zero, and aligned to the size of the lanes (up to 16 bytes, which is what
+// operator new guarantees). This allows the arithmetic operators to work on
+// whole SIMD registers. Iteration only covers the three real channels.
 template <typename ChannelT>
 class basic_color
   : boost::field_operators<basic_color<ChannelT>>
@@ -26,16 +33,22 @@ class basic_color
 {
 public:
   static constexpr std::size_t CHANNELS{3};  // Number of channels in a pixel.
+  static constexpr std::size_t LANES{4};     // Channels including padding.
 
 private:
-  using channel_list = std::array<ChannelT, CHANNELS>;
-  
+  static constexpr std::size_t ALIGNMENT{
+    LANES * sizeof(ChannelT) < 16 ? LANES * sizeof(ChannelT) : 16
+  };
+
+  using channel_list = std::array<ChannelT, LANES>;
+
 public:
   using channel                 = ChannelT;
   using channel_iterator        = typename channel_list::iterator;
   using const_channel_iterator  = typename channel_list::const_iterator;
 
-  basic_color() noexcept { }  // Leaves channels uninitialised
+  // Leaves channels uninitialised, only the padding is zeroed.
+  basic_color() noexcept { channels_[CHANNELS] = ChannelT{}; }
   basic_color(channel r, channel g, channel b) noexcept;
 
   channel&
@@ -47,17 +60,17 @@ public:
   channel_iterator
   begin() noexcept          { return channels_.begin(); }
   channel_iterator
-  end() noexcept            { return channels_.end(); }
+  end() noexcept            { return channels_.begin() + CHANNELS; }
 
   const_channel_iterator
   begin() const noexcept    { return channels_.begin(); }
   const_channel_iterator
-  end() const noexcept      { return channels_.end(); }
+  end() const noexcept      { return channels_.begin() + CHANNELS; }
 
   const_channel_iterator
   cbegin() const noexcept   { return channels_.begin(); }
   const_channel_iterator
-  cend() const noexcept     { return channels_.end(); }
+  cend() const noexcept     { return channels_.begin() + CHANNELS; }
 
   basic_color& operator += (basic_color other) noexcept;
   basic_color& operator -= (basic_color other) noexcept;
@@ -68,18 +81,18 @@ public:
   basic_color& operator /= (ChannelT d) noexcept;
 
 private:
-  channel_list channels_;
+  alignas(ALIGNMENT) channel_list channels_;
 };
 
-using hdr_color = basic_color<double>;
+using hdr_color = basic_color<real>;
 using ldr_color = basic_color<std::uint8_t>;
 
 // Get the luminance of a pixel.
-double
+real
 luminance(hdr_color const& color);
 
 // Get the distance between two colours.
-double
+real
 distance(hdr_color x, hdr_color y);
 
 //
@@ -90,29 +103,30 @@ template <typename ChannelT>
 basic_color<ChannelT>::basic_color(
   ChannelT r, ChannelT g, ChannelT b
 ) noexcept
-  : channels_{{r, g, b}}
+  : channels_{{r, g, b, ChannelT{}}}
 { }
 
-#define impl_op(op)                                                            \
+// Operations that keep the padding lane at zero run over all lanes.
+#define impl_op(op, lanes)                                                     \
   template <typename ChannelT>                                                 \
   basic_color<ChannelT>&                                                       \
   basic_color<ChannelT>::operator op (basic_color other) noexcept {            \
-    for (std::size_t i = 0; i < CHANNELS; ++i)                                 \
+    for (std::size_t i = 0; i < lanes; ++i)                                    \
       channels_[i] op other.channels_[i];                                      \
     return *this;                                                              \
   }
 
-impl_op(+=)
-impl_op(-=)
-impl_op(*=)
-impl_op(/=)
+impl_op(+=, LANES)
+impl_op(-=, LANES)
+impl_op(*=, LANES)
+impl_op(/=, CHANNELS)  // 0 / 0 in the padding would be NaN, or a trap.
 
 #undef impl_op
 #define impl_op2(op)                                                           \
   template <typename ChannelT>                                                 \
   basic_color<ChannelT>&                                                       \
   basic_color<ChannelT>::operator op (ChannelT d) noexcept {                   \
-    for (std::size_t i = 0; i < CHANNELS; ++i)                                 \
+    for (std::size_t i = 0; i < LANES; ++i)                                    \
       channels_[i] op d;                                                       \
     return *this;                                                              \
   }
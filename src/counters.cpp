@@ -0,0 +1,48 @@
+#include "counters.hpp"
+
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace oxatrace;
+
+cache_miss_counter::cache_miss_counter() {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof attr);
+  attr.size = sizeof attr;
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  // There's no glibc wrapper for this one.
+  fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+cache_miss_counter::~cache_miss_counter() {
+  if (available())
+    close(fd_);
+}
+
+void
+cache_miss_counter::start() {
+  if (!available()) return;
+  ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+  ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+std::uint64_t
+cache_miss_counter::stop() {
+  if (!available()) return 0;
+  ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+
+  std::uint64_t count = 0;
+  if (read(fd_, &count, sizeof count) != sizeof count)
+    return 0;
+  return count;
+}
@@ -0,0 +1,38 @@
+#ifndef OXATRACE_COUNTERS_HPP
+#define OXATRACE_COUNTERS_HPP
+
+#include <cstdint>
+
+namespace oxatrace {
+
+// Counts the cache misses of this process through the Linux perf events
+// interface: those of the calling thread and of all threads it starts while
+// the counter is open. Counts of such threads are only included once they have
+// been joined.
+//
+// What exactly counts as a cache miss is up to the CPU; it's generally a miss
+// in the last-level cache. Many virtual machines don't expose the counter at
+// all, in which case available() is false and nothing is counted.
+class cache_miss_counter {
+public:
+  cache_miss_counter();
+  ~cache_miss_counter();
+
+  cache_miss_counter(cache_miss_counter const&) = delete;
+  cache_miss_counter& operator = (cache_miss_counter const&) = delete;
+
+  bool available() const noexcept { return fd_ >= 0; }
+
+  // Reset the count to zero and start counting.
+  void start();
+
+  // Stop counting and get the count since start.
+  std::uint64_t stop();
+
+private:
+  int fd_;
+};
+
+}  // namespace oxatrace
+
+#endif
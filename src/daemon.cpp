@@ -0,0 +1,652 @@
+#include "daemon.hpp"
+
+#include "scene.hpp"
+#include "scenes.hpp"
+#include "text_interface.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <list>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace oxatrace;
+
+namespace {
+  // Owns a file descriptor.
+  class socket_fd {
+  public:
+    explicit
+    socket_fd(int fd) : fd_{fd} { }
+
+    socket_fd(socket_fd&& other) noexcept : fd_{other.fd_} { other.fd_ = -1; }
+
+    socket_fd(socket_fd const&) = delete;
+    socket_fd& operator = (socket_fd const&) = delete;
+
+    ~socket_fd() {
+      if (fd_ >= 0)
+        close(fd_);
+    }
+
+    int get() const noexcept { return fd_; }
+
+  private:
+    int fd_;
+  };
+
+  // Reads lines and blocks of bytes from a socket.
+  class socket_reader {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    explicit
+    socket_reader(int fd) : fd_{fd} { }
+
+    // Fail reads not done by deadline with std::runtime_error.
+    void
+    set_deadline(clock::time_point deadline) { deadline_ = deadline; }
+
+    // Read the next line, without the newline. Returns false at the end of
+    // the stream.
+    bool
+    line(std::string& result);
+
+    // Read exactly size bytes.
+    void
+    bytes(char* out, std::size_t size);
+
+  private:
+    static constexpr std::size_t MAX_LINE = 1 << 16;
+
+    int               fd_;
+    std::string       buffer_;
+    clock::time_point deadline_ = clock::time_point::max();
+
+    // Append what's available to buffer_. Returns false at the end of the
+    // stream.
+    bool
+    fill();
+  };
+}
+
+static std::system_error
+system_error(char const* what) {
+  return std::system_error{errno, std::generic_category(), what};
+}
+
+bool
+socket_reader::fill() {
+  if (deadline_ != clock::time_point::max()) {
+    int ready;
+    do {
+      auto const left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline_ - clock::now()
+      );
+      pollfd readable{fd_, POLLIN, 0};
+      ready = poll(&readable, 1, std::max<int>(0, left.count()));
+    } while (ready < 0 && errno == EINTR);
+
+    if (ready < 0)
+      throw system_error("socket_reader: poll");
+    if (ready == 0)
+      throw std::runtime_error{"socket_reader: Timed out"};
+  }
+
+  char chunk[4096];
+  ssize_t received;
+  do
+    received = recv(fd_, chunk, sizeof chunk, 0);
+  while (received < 0 && errno == EINTR);
+
+  if (received < 0)
+    throw system_error("socket_reader: recv");
+  buffer_.append(chunk, received);
+  return received > 0;
+}
+
+bool
+socket_reader::line(std::string& result) {
+  std::string::size_type newline;
+  while ((newline = buffer_.find('\n')) == std::string::npos) {
+    if (buffer_.size() > MAX_LINE)
+      throw std::runtime_error{"socket_reader::line: Line too long"};
+    if (!fill()) {
+      if (buffer_.empty())
+        return false;
+      throw std::runtime_error{"socket_reader::line: Unterminated line"};
+    }
+  }
+
+  result = buffer_.substr(0, newline);
+  buffer_.erase(0, newline + 1);
+  return true;
+}
+
+void
+socket_reader::bytes(char* out, std::size_t size) {
+  while (buffer_.size() < size) {
+    std::size_t const taken = buffer_.size();
+    std::memcpy(out, buffer_.data(), taken);
+    out += taken;
+    size -= taken;
+    buffer_.clear();
+    if (!fill())
+      throw std::runtime_error{"socket_reader::bytes: Unexpected end"};
+  }
+
+  std::memcpy(out, buffer_.data(), size);
+  buffer_.erase(0, size);
+}
+
+static void
+send_all(int fd, char const* data, std::size_t size) {
+  while (size > 0) {
+    ssize_t const sent = send(fd, data, size, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR)
+        continue;
+      throw system_error("send_all: send");
+    }
+    data += sent;
+    size -= sent;
+  }
+}
+
+static void
+send_all(int fd, std::string const& data) {
+  send_all(fd, data.data(), data.size());
+}
+
+static sockaddr_un
+socket_address(std::string const& path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof address.sun_path)
+    throw std::system_error{ENAMETOOLONG, std::generic_category(),
+                            "socket_address: " + path};
+  std::strcpy(address.sun_path, path.c_str());
+  return address;
+}
+
+static socket_fd
+connect_to(std::string const& path) {
+  sockaddr_un const address = socket_address(path);
+  socket_fd fd{socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+  if (fd.get() < 0)
+    throw system_error("connect_to: socket");
+
+  if (connect(fd.get(), reinterpret_cast<sockaddr const*>(&address),
+              sizeof address) != 0)
+    throw std::system_error{errno, std::generic_category(),
+                            "connect_to: Can't connect to " + path};
+  return fd;
+}
+
+static socket_fd
+listen_on(std::string const& path) {
+  // A socket file left behind by a daemon that didn't stop cleanly is in the
+  // way; one that somebody answers on isn't ours to take.
+  struct stat status;
+  if (stat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+    try {
+      connect_to(path);
+      throw std::system_error{EADDRINUSE, std::generic_category(),
+                              "listen_on: A daemon is listening on " + path};
+    } catch (std::system_error const& e) {
+      if (e.code().value() == EADDRINUSE)
+        throw;
+    }
+    unlink(path.c_str());
+  }
+
+  sockaddr_un const address = socket_address(path);
+  socket_fd fd{socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+  if (fd.get() < 0)
+    throw system_error("listen_on: socket");
+  if (bind(fd.get(), reinterpret_cast<sockaddr const*>(&address),
+           sizeof address) != 0)
+    throw std::system_error{errno, std::generic_category(),
+                            "listen_on: Can't bind " + path};
+  if (listen(fd.get(), SOMAXCONN) != 0)
+    throw system_error("listen_on: listen");
+  return fd;
+}
+
+//
+// Requests
+//
+
+static char const*
+tone_mapping_name(output_spec::tone_mapping t) {
+  switch (t) {
+  case output_spec::tone_mapping::none:     return "none";
+  case output_spec::tone_mapping::reinhard: return "reinhard";
+  case output_spec::tone_mapping::exposure: return "exposure";
+  }
+  return "";
+}
+
+std::string
+oxatrace::format_request(render_request const& r) {
+  std::ostringstream out;
+  out << std::setprecision(std::numeric_limits<double>::max_digits10)
+      << "render"
+      << " scene=" << r.scene
+      << " width=" << r.width
+      << " height=" << r.height
+      << " supersampling=" << r.supersampling
+      << " jitter=" << r.jitter
+      << " fast_math=" << r.fast_math
+      << " sampler=" << r.sampler
+      << " seed=" << r.seed
+      << " priority=" << r.priority
+      << " deadline_ms=" << r.deadline_ms
+      << " position=" << double(r.position.x()) << ','
+                      << double(r.position.y()) << ','
+                      << double(r.position.z())
+      << " yaw=" << r.yaw
+      << " pitch=" << r.pitch
+      << " fov=" << r.fov
+      << " tone=" << tone_mapping_name(r.output.tone_map)
+      << " key=" << r.output.key
+      << " exposure=" << r.output.exposure
+      << " gamma=" << r.output.gamma;
+  return out.str();
+}
+
+// Parse the whole of text as a T.
+template <typename T>
+static T
+parse_value(std::string const& key, std::string const& text) {
+  // Streams read "-1" into an unsigned type as its largest value.
+  if (std::is_unsigned<T>::value && text.find('-') != std::string::npos)
+    throw std::invalid_argument{"parse_request: Malformed " + key};
+
+  std::istringstream in{text};
+  T result;
+  if (!(in >> result) || in.peek() != std::char_traits<char>::eof())
+    throw std::invalid_argument{"parse_request: Malformed " + key};
+  return result;
+}
+
+render_request
+oxatrace::parse_request(std::string const& line) {
+  std::istringstream words{line};
+  std::string word;
+  if (!(words >> word) || word != "render")
+    throw std::invalid_argument{"parse_request: Not a render request"};
+
+  render_request r;
+  while (words >> word) {
+    std::string::size_type const equals = word.find('=');
+    if (equals == std::string::npos)
+      throw std::invalid_argument{"parse_request: Expected key=value"};
+    std::string const key = word.substr(0, equals);
+    std::string const value = word.substr(equals + 1);
+
+    if (key == "scene")
+      r.scene = value;
+    else if (key == "width")
+      r.width = parse_value<std::size_t>(key, value);
+    else if (key == "height")
+      r.height = parse_value<std::size_t>(key, value);
+    else if (key == "supersampling")
+      r.supersampling = parse_value<unsigned>(key, value);
+    else if (key == "jitter")
+      r.jitter = parse_value<bool>(key, value);
+    else if (key == "fast_math")
+      r.fast_math = parse_value<bool>(key, value);
+    else if (key == "sampler")
+      r.sampler = value;
+    else if (key == "seed")
+      r.seed = parse_value<std::uint32_t>(key, value);
+    else if (key == "priority")
+      r.priority = parse_value<int>(key, value);
+    else if (key == "deadline_ms")
+      r.deadline_ms = parse_value<unsigned>(key, value);
+    else if (key == "position") {
+      std::istringstream coords{value};
+      std::string coord;
+      for (int i = 0; i < 3; ++i) {
+        if (!std::getline(coords, coord, ','))
+          throw std::invalid_argument{"parse_request: Malformed position"};
+        r.position[i] = parse_value<double>(key, coord);
+      }
+    } else if (key == "yaw")
+      r.yaw = parse_value<double>(key, value);
+    else if (key == "pitch")
+      r.pitch = parse_value<double>(key, value);
+    else if (key == "fov")
+      r.fov = parse_value<double>(key, value);
+    else if (key == "tone") {
+      if (value == "none")
+        r.output.tone_map = output_spec::tone_mapping::none;
+      else if (value == "reinhard")
+        r.output.tone_map = output_spec::tone_mapping::reinhard;
+      else if (value == "exposure")
+        r.output.tone_map = output_spec::tone_mapping::exposure;
+      else
+        throw std::invalid_argument{"parse_request: Unknown tone mapping"};
+    } else if (key == "key")
+      r.output.key = parse_value<double>(key, value);
+    else if (key == "exposure")
+      r.output.exposure = parse_value<double>(key, value);
+    else if (key == "gamma")
+      r.output.gamma = parse_value<double>(key, value);
+    else
+      throw std::invalid_argument{"parse_request: Unknown key " + key};
+  }
+
+  if (r.width == 0 || r.height == 0)
+    throw std::invalid_argument{"parse_request: Empty image"};
+  if (!is_power2(r.supersampling))
+    throw std::invalid_argument{"parse_request: Bad supersampling"};
+  if (r.width > MAX_REQUEST_SIDE || r.height > MAX_REQUEST_SIDE
+      || r.supersampling > MAX_REQUEST_SUPERSAMPLING)
+    throw std::invalid_argument{"parse_request: Image too large"};
+  std::uint64_t const pixels = std::uint64_t(r.width) * r.height;
+  std::uint64_t const samples =
+    pixels * r.supersampling * r.supersampling;
+  if (pixels > MAX_REQUEST_PIXELS || samples > MAX_REQUEST_SAMPLES)
+    throw std::invalid_argument{"parse_request: Image too large"};
+  if (!(r.fov > 0.0 && r.fov < 180.0))
+    throw std::invalid_argument{"parse_request: Field of view out of range"};
+  if (!std::isfinite(r.yaw) || !std::isfinite(r.pitch)
+      || !std::isfinite(r.position.x()) || !std::isfinite(r.position.y())
+      || !std::isfinite(r.position.z()))
+    throw std::invalid_argument{"parse_request: Camera not finite"};
+
+  // The tone curves take these to be positive and finite.
+  if (!(r.output.key > 0.0 && std::isfinite(r.output.key)))
+    throw std::invalid_argument{"parse_request: Key out of range"};
+  if (!(r.output.exposure > 0.0 && std::isfinite(r.output.exposure)))
+    throw std::invalid_argument{"parse_request: Exposure out of range"};
+  if (!(r.output.gamma >= 0.0 && std::isfinite(r.output.gamma)))
+    throw std::invalid_argument{"parse_request: Gamma out of range"};
+
+  return r;
+}
+
+camera
+oxatrace::request_camera(render_request const& r) {
+  camera result{real(r.width) / real(r.height), real(r.fov / 180.0 * PI)};
+  result
+    .rotate(angle_axis{real(r.pitch / 180.0 * PI), vector3::UnitX()})
+    .rotate(angle_axis{real(r.yaw / 180.0 * PI), vector3::UnitY()})
+    .translate(r.position)
+    ;
+  return result;
+}
+
+std::shared_ptr<scene const>
+scene_cache::get(std::string const& name, bool& built) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto const cached = scenes_.find(name);
+  built = cached == scenes_.end();
+  if (!built)
+    return cached->second;
+
+  std::shared_ptr<scene const> result{
+    simple_scene::make(make_scene_definition(name))
+  };
+  scenes_.emplace(name, result);
+  return result;
+}
+
+//
+// Daemon
+//
+
+namespace {
+  // What the connections of a daemon share.
+  struct daemon_state {
+    render_service    service;
+    scene_cache       scenes;
+    std::atomic<bool> stopping{false};
+    std::mutex        log_mutex;
+    progress_monitor& monitor;
+
+    daemon_state(thread_pool& pool, progress_monitor& monitor)
+      : service{pool}
+      , monitor(monitor) { }
+
+    void
+    log(std::string const& message) {
+      std::lock_guard<std::mutex> lock{log_mutex};
+      monitor.change_phase(message);
+    }
+  };
+}
+
+namespace {
+  // Cancels a job when it goes out of scope, unless its result was delivered,
+  // so that a client going away doesn't leave the workers rendering for no
+  // one.
+  class cancel_guard {
+  public:
+    explicit
+    cancel_guard(render_handle& handle) : handle_(handle) { }
+
+    cancel_guard(cancel_guard const&) = delete;
+    cancel_guard& operator = (cancel_guard const&) = delete;
+
+    ~cancel_guard() {
+      if (!delivered_)
+        handle_.cancel();
+    }
+
+    void
+    delivered() noexcept { delivered_ = true; }
+
+  private:
+    render_handle& handle_;
+    bool           delivered_ = false;
+  };
+}
+
+// Handle the request of one connection.
+static void
+serve(socket_fd const& client, daemon_state& daemon) {
+  using clock = std::chrono::steady_clock;
+  std::chrono::milliseconds const poll_interval{100};
+
+  clock::time_point const start = clock::now();
+  std::string line;
+  try {
+    socket_reader in{client.get()};
+    in.set_deadline(start + REQUEST_TIMEOUT);
+    if (!in.line(line))
+      return;
+
+    if (line == "shutdown") {
+      daemon.stopping = true;
+      send_all(client.get(), "ok\n");
+      return;
+    }
+
+    render_request const request = parse_request(line);
+    bool built;
+    render_job job{
+      daemon.scenes.get(request.scene, built), request_camera(request),
+      default_shading_policy(), request.width, request.height, request.output
+    };
+    send_all(client.get(), built ? "scene built\n" : "scene cached\n");
+
+    job.policy.supersampling = request.supersampling;
+    job.policy.jitter = request.jitter;
+    job.policy.math = request.fast_math ? math_mode::fast : math_mode::exact;
+    job.sampler = request.sampler;
+    job.seed = request.seed;
+    job.priority = request.priority;
+    if (request.deadline_ms > 0)
+      job.deadline = start + std::chrono::milliseconds{request.deadline_ms};
+
+    render_handle handle = daemon.service.submit(std::move(job));
+    cancel_guard guard{handle};
+    std::shared_future<ldr_image> const result = handle.result();
+    while (result.wait_for(poll_interval) != std::future_status::ready)
+      send_all(client.get(),
+               "progress " + std::to_string(handle.progress()) + '\n');
+
+    ldr_image const& image = result.get();
+    guard.delivered();
+    std::string header = "image " + std::to_string(image.width()) + ' '
+                         + std::to_string(image.height()) + '\n';
+    std::vector<char> data;
+    data.reserve(header.size() + image.size() * ldr_color::CHANNELS);
+    data.insert(data.end(), header.begin(), header.end());
+    for (ldr_color const& pixel : image)
+      data.insert(data.end(), pixel.begin(), pixel.end());
+    send_all(client.get(), data.data(), data.size());
+
+    std::ostringstream message;
+    message << request.scene << ' ' << request.width << 'x' << request.height
+            << (built ? ", scene built" : "") << ", "
+            << std::fixed << std::setprecision(3)
+            << std::chrono::duration<double>(clock::now() - start).count()
+            << " s";
+    daemon.log(message.str());
+  } catch (std::exception const& e) {
+    daemon.log(std::string{"Request failed: "} + e.what());
+    try {
+      send_all(client.get(), std::string{"error "} + e.what() + '\n');
+    } catch (std::exception const&) { }
+  }
+}
+
+void
+oxatrace::run_daemon(std::string const& socket_path, thread_pool& pool,
+                     progress_monitor& monitor) {
+  socket_fd const listener = listen_on(socket_path);
+  daemon_state daemon{pool, monitor};
+  monitor.change_phase("Listening on " + socket_path);
+
+  // Each connection is served by a thread of its own, which mostly waits for
+  // the render_service. The socket is closed once the thread is joined, so
+  // that it can be shut down until then.
+  struct connection {
+    socket_fd                          client;
+    std::shared_ptr<std::atomic<bool>> done;
+    std::thread                        thread;
+  };
+  std::list<connection> connections;
+
+  while (!daemon.stopping) {
+    for (auto c = connections.begin(); c != connections.end();)
+      if (*c->done) {
+        c->thread.join();
+        c = connections.erase(c);
+      } else
+        ++c;
+
+    // Polled, so that a shutdown request is noticed soon.
+    pollfd ready{listener.get(), POLLIN, 0};
+    if (poll(&ready, 1, 100) <= 0)
+      continue;
+
+    socket_fd client{
+      accept4(listener.get(), nullptr, nullptr, SOCK_CLOEXEC)
+    };
+    if (client.get() < 0)
+      continue;
+
+    if (connections.size() >= MAX_CONNECTIONS) {
+      try {
+        send_all(client.get(), "error Too many connections\n");
+      } catch (std::exception const&) { }
+      continue;
+    }
+
+    auto done = std::make_shared<std::atomic<bool>>(false);
+    connections.push_back({std::move(client), done, {}});
+    connection& c = connections.back();
+    c.thread = std::thread{[&c, &daemon] {
+      serve(c.client, daemon);
+      *c.done = true;
+    }};
+  }
+
+  // Clients still waiting for a request or a result are cut off, so that
+  // none can keep the daemon from stopping.
+  for (connection& c : connections) {
+    shutdown(c.client.get(), SHUT_RDWR);
+    c.thread.join();
+  }
+  unlink(socket_path.c_str());
+}
+
+//
+// Client
+//
+
+remote_result
+oxatrace::render_remotely(std::string const& socket_path,
+                          render_request const& request,
+                          std::function<void(double)> const& on_progress) {
+  socket_fd const fd = connect_to(socket_path);
+  send_all(fd.get(), format_request(request) + '\n');
+
+  socket_reader in{fd.get()};
+  bool scene_built = false;
+  std::string line;
+  while (in.line(line)) {
+    std::istringstream words{line};
+    std::string word;
+    words >> word;
+
+    if (word == "progress") {
+      double progress;
+      if (words >> progress && on_progress)
+        on_progress(progress);
+    } else if (word == "scene") {
+      words >> word;
+      scene_built = word == "built";
+    } else if (word == "error")
+      throw std::runtime_error{"render_remotely: " + line.substr(6)};
+    else if (word == "image") {
+      std::size_t width, height;
+      if (!(words >> width >> height) || width == 0 || height == 0)
+        throw std::runtime_error{"render_remotely: Malformed image header"};
+
+      std::vector<char> data(width * height * ldr_color::CHANNELS);
+      in.bytes(data.data(), data.size());
+
+      ldr_image image{width, height};
+      char const* channel = data.data();
+      for (ldr_color& pixel : image)
+        for (auto& c : pixel)
+          c = *channel++;
+      return {std::move(image), scene_built};
+    } else
+      throw std::runtime_error{"render_remotely: Unexpected " + line};
+  }
+
+  throw std::runtime_error{"render_remotely: Daemon closed the connection"};
+}
+
+void
+oxatrace::shut_down_daemon(std::string const& socket_path) {
+  socket_fd const fd = connect_to(socket_path);
+  send_all(fd.get(), "shutdown\n");
+  socket_reader in{fd.get()};
+  std::string line;
+  in.line(line);
+}
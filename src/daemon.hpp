@@ -0,0 +1,140 @@
+#ifndef OXATRACE_DAEMON_HPP
+#define OXATRACE_DAEMON_HPP
+
+#include "camera.hpp"
+#include "image.hpp"
+#include "render_service.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace oxatrace {
+
+class progress_monitor;
+class scene;
+class thread_pool;
+
+// A render daemon keeps built scenes in memory and renders requests sent to it
+// over a Unix domain socket, so that rendering many images of the same scenes
+// costs neither process startup nor scene construction each time.
+//
+// The protocol is one request per connection. The client sends a single line:
+//
+//   render key=value key=value ...
+//
+// with keys as in render_request, or "shutdown" to stop the daemon. The daemon
+// answers "scene built" or "scene cached", then "progress <fraction>" every
+// so often while rendering, and finally either "image <width> <height>"
+// followed by width * height RGB byte triples in row-major order, or
+// "error <message>" at any point.
+
+// What a client asks the daemon to render. The camera is tilted by pitch
+// around the x axis, then turned by yaw around the y axis, both in degrees,
+// and moved to position; the defaults give the camera of the command line.
+struct render_request {
+  std::string   scene         = "two_balls";
+  std::size_t   width         = 640;
+  std::size_t   height        = 480;
+  unsigned      supersampling = 4;
+  bool          jitter        = true;
+  bool          fast_math     = false;
+  std::string   sampler       = "sobol";
+  std::uint32_t seed          = 0;
+  int           priority      = 0;
+  unsigned      deadline_ms   = 0;  // 0 for none.
+  vector3       position      = {0.0, 4.0, 0.0};
+  double        yaw           = 12.0;
+  double        pitch         = -10.0;
+  double        fov           = 90.0;
+  output_spec   output;             // Without a filename.
+};
+
+// The request line for a request, without the terminating newline.
+std::string
+format_request(render_request const& request);
+
+// Largest requests the daemon takes, so that no client can make it allocate
+// or render without bound. With these, neither the number of pixels nor that
+// of samples can overflow.
+constexpr std::size_t   MAX_REQUEST_SIDE          = 16384;
+constexpr std::uint64_t MAX_REQUEST_PIXELS        = std::uint64_t(1) << 26;
+constexpr unsigned      MAX_REQUEST_SUPERSAMPLING = 64;
+// Of width * height * supersampling^2.
+constexpr std::uint64_t MAX_REQUEST_SAMPLES       = std::uint64_t(1) << 34;
+
+// Longest a client may take to send its request line, and most connections
+// the daemon serves at once; those beyond are turned away with an error.
+constexpr std::chrono::seconds REQUEST_TIMEOUT{10};
+constexpr std::size_t          MAX_CONNECTIONS = 64;
+
+// Parse a request line, without the terminating newline.
+//
+// Throws std::invalid_argument: Not a render request, unknown key, malformed
+//                               value, a request over the limits above, or
+//                               a value out of range: a field of view not in
+//                               (0, 180), a key or exposure not positive, a
+//                               negative gamma, or any of those, the angles
+//                               or the position not finite.
+render_request
+parse_request(std::string const& line);
+
+// The camera of a request, with the aspect ratio of its image.
+camera
+request_camera(render_request const& request);
+
+// Built scenes, by name. Thread-safe.
+class scene_cache {
+public:
+  // Get the scene of given name, building it if this is the first time it is
+  // asked for. Sets built to whether it was.
+  //
+  // Throws std::invalid_argument: Unknown scene.
+  std::shared_ptr<scene const>
+  get(std::string const& name, bool& built);
+
+private:
+  std::mutex                                          mutex_;
+  std::map<std::string, std::shared_ptr<scene const>> scenes_;
+};
+
+// Listen on socket_path and render the requests sent there on pool, until a
+// client asks for shutdown. Each request is logged through monitor. On
+// shutdown, the connections still open are shut down, cancelling their jobs.
+//
+// Throws std::system_error: Can't set up the socket, or another daemon is
+//                           already listening on it.
+void
+run_daemon(std::string const& socket_path, thread_pool& pool,
+           progress_monitor& monitor);
+
+// Result of render_remotely.
+struct remote_result {
+  ldr_image image;
+  bool      scene_built;  // Did the daemon have to build the scene?
+};
+
+// Send a request to the daemon listening on socket_path and wait for the
+// result, calling on_progress with the daemon's progress reports.
+//
+// Throws std::system_error: Can't reach the daemon.
+//        std::runtime_error: The daemon failed to render the request, or
+//                            broke the protocol.
+remote_result
+render_remotely(std::string const& socket_path, render_request const& request,
+                std::function<void(double)> const& on_progress = {});
+
+// Ask the daemon listening on socket_path to stop.
+//
+// Throws std::system_error: Can't reach the daemon.
+void
+shut_down_daemon(std::string const& socket_path);
+
+}  // namespace oxatrace
+
+#endif
@@ -0,0 +1,112 @@
+#include "denoise.hpp"
+
+#include "fast_math.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+using namespace oxatrace;
+
+// Rows filtered by a task at a time, between checks for idle workers.
+static constexpr std::size_t ROWS_PER_TASK = 8;
+
+static real
+squared_distance(hdr_color const& x, hdr_color const& y) {
+  real sum{};
+  for (std::size_t c = 0; c < hdr_color::CHANNELS; ++c)
+    sum += (x[c] - y[c]) * (x[c] - y[c]);
+  return sum;
+}
+
+// One iteration of the filter, with taps step pixels apart.
+static void
+filter_rows(hdr_image const& in, hdr_image& out, feature_image const& features,
+            denoise_params const& params, real sigma_color, int step,
+            std::size_t begin, std::size_t end) {
+  constexpr std::array<real, 5> spline{{
+    1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16
+  }};
+  constexpr double LOG2E = 1.4426950408889634;
+
+  // Weights are exp(-sum of d^2 / sigma^2), evaluated as 2^(-sum).
+  real const color_scale  = LOG2E / (sigma_color * sigma_color);
+  real const normal_scale = LOG2E / (params.sigma_normal * params.sigma_normal);
+  real const depth_scale  = LOG2E / (params.sigma_depth * params.sigma_depth);
+  real const albedo_scale = LOG2E / (params.sigma_albedo * params.sigma_albedo);
+
+  int const width = in.width();
+  int const height = in.height();
+  hdr_color const* const pixels = in.data();
+  pixel_features const* const guides = features.data();
+
+  for (int y = begin; y < int(end); ++y)
+    for (int x = 0; x < width; ++x) {
+      hdr_color const& color = pixels[y * width + x];
+      pixel_features const& f = guides[y * width + x];
+      bool const hit = f.solid != pixel_features::NO_SOLID;
+      real const inv_depth = hit ? 1 / f.depth : 0;
+
+      hdr_color sum{0.0, 0.0, 0.0};
+      real weight_sum{};
+
+      for (int j = 0; j < 5; ++j) {
+        int const qy = y + (j - 2) * step;
+        if (qy < 0 || qy >= height) continue;
+
+        for (int i = 0; i < 5; ++i) {
+          int const qx = x + (i - 2) * step;
+          if (qx < 0 || qx >= width) continue;
+
+          pixel_features const& g = guides[qy * width + qx];
+          if (g.solid != f.solid) continue;
+
+          hdr_color const& q = pixels[qy * width + qx];
+          real exponent = color_scale * squared_distance(color, q);
+          if (hit) {
+            real const d = (f.depth - g.depth) * inv_depth;
+            exponent += normal_scale * (f.normal - g.normal).squaredNorm()
+                      + depth_scale * d * d
+                      + albedo_scale * squared_distance(f.albedo, g.albedo);
+          }
+
+          real const weight = spline[i] * spline[j] * fast_exp2(-exponent);
+          sum += q * weight;
+          weight_sum += weight;
+        }
+      }
+
+      // The centre tap always has weight > 0.
+      out.data()[y * width + x] = sum / weight_sum;
+    }
+}
+
+hdr_image
+oxatrace::denoise(hdr_image const& image, feature_image const& features,
+                  denoise_params const& params, thread_pool& pool) {
+  if (image.width() != features.width() || image.size() != features.size())
+    throw std::invalid_argument{"denoise: Image and features differ in size"};
+
+  hdr_image current = image;
+  hdr_image next{image.width(), image.height()};
+  real sigma_color = params.sigma_color;
+
+  for (unsigned iteration = 0; iteration < params.iterations; ++iteration) {
+    int const step = 1 << iteration;
+    pool.parallel_for(
+      0, image.height(), ROWS_PER_TASK,
+      [&] (std::size_t begin, std::size_t end) {
+        filter_rows(current, next, features, params, sigma_color, step,
+                    begin, end);
+      }
+    );
+
+    std::swap(current, next);
+    sigma_color /= 2;
+  }
+
+  return current;
+}
@@ -0,0 +1,44 @@
+#ifndef OXATRACE_DENOISE_HPP
+#define OXATRACE_DENOISE_HPP
+
+#include "features.hpp"
+#include "image.hpp"
+#include "math.hpp"
+
+namespace oxatrace {
+
+class thread_pool;
+
+// Parameters of denoise. Each sigma gives how big a difference in the
+// respective quantity between two pixels is tolerated before they stop being
+// averaged together; smaller values preserve more edges and remove less
+// noise.
+struct denoise_params {
+  unsigned iterations   = 2;
+  real     sigma_color  = 0.2;   // Halved with every iteration.
+  real     sigma_normal = 0.2;
+  real     sigma_depth  = 0.05;  // Relative to the depth of the pixel.
+  real     sigma_albedo = 0.5;
+};
+
+// Remove noise from a rendered image, guided by its features.
+//
+// This is the edge-avoiding à-trous wavelet filter of Dammertz et al., "Edge-
+// Avoiding À-Trous Wavelet Transform for fast Global Illumination Filtering"
+// (2010): Each iteration applies a 5x5 B-spline kernel whose taps are spread
+// twice as far apart as in the previous one, so that n iterations cover
+// (2^(n+2) - 3)^2 pixels at the cost of 25n taps. Each tap is weighted down by
+// the difference in colour, normal, depth and albedo from the centre pixel,
+// and taps on a different solid are left out entirely, so that edges present
+// in the features stay sharp.
+//
+// The work is split by rows among the threads of pool.
+//
+// Throws std::invalid_argument: image and features differ in size.
+hdr_image
+denoise(hdr_image const& image, feature_image const& features,
+        denoise_params const& params, thread_pool& pool);
+
+}  // namespace oxatrace
+
+#endif
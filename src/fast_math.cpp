@@ -0,0 +1,94 @@
+#include "fast_math.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+using namespace oxatrace;
+
+namespace {
+  struct error_stats {
+    double max  = 0.0;
+    double mean = 0.0;
+  };
+}
+
+// Evaluate error = approx(x) - exact(x) at SAMPLES evenly spaced points in
+// [from, to].
+static error_stats
+measure(std::function<double(double)> const& approx,
+        std::function<double(double)> const& exact,
+        double from, double to) {
+  constexpr unsigned SAMPLES = 1000000;
+
+  error_stats result;
+  for (unsigned i = 0; i < SAMPLES; ++i) {
+    double const x = from + (to - from) * i / (SAMPLES - 1);
+    double const error = std::abs(approx(x) - exact(x));
+    result.max = std::max(result.max, error);
+    result.mean += error;
+  }
+
+  result.mean /= SAMPLES;
+  return result;
+}
+
+static void
+print_row(std::ostream& out, std::string const& name, error_stats stats) {
+  out << std::setw(32) << std::left << name << std::right
+      << std::scientific << std::setprecision(3)
+      << std::setw(12) << stats.max
+      << std::setw(12) << stats.mean << '\n';
+}
+
+void
+oxatrace::fast_math_report(std::ostream& out) {
+  out << std::setw(32) << std::left << "Approximation" << std::right
+      << std::setw(12) << "max error"
+      << std::setw(12) << "mean error" << '\n';
+
+  // Specular highlights: cos^n for cos in [0, 1].
+  for (unsigned n : {20u, 200u, 1000u})
+    print_row(
+      out, "pow_int(x, " + std::to_string(n) + "), x in [0, 1]",
+      measure([n] (double x) { return pow_int(x, n); },
+              [n] (double x) { return std::pow(x, n); },
+              0.0, 1.0)
+    );
+
+  // Lobe sampling: r^(1 / (n + 1)) for r in [0, 1).
+  for (unsigned n : {1u, 20u, 1000u}) {
+    double const e = 1.0 / (n + 1.0);
+    print_row(
+      out, "fast_pow(x, 1/" + std::to_string(n + 1) + "), x in [0, 1]",
+      measure([e] (double x) { return fast_pow(x, e); },
+              [e] (double x) { return std::pow(x, e); },
+              0.0, 1.0)
+    );
+  }
+
+  print_row(out, "fast_sin(x), x in [0, 2pi]",
+            measure([] (double x) { return fast_sin(x); },
+                    [] (double x) { return std::sin(x); },
+                    0.0, 2 * PI));
+  print_row(out, "fast_cos(x), x in [0, 2pi]",
+            measure([] (double x) { return fast_cos(x); },
+                    [] (double x) { return std::cos(x); },
+                    0.0, 2 * PI));
+
+  // Texture mapping of spheres: atan2 of a direction, taken around the unit
+  // circle.
+  print_row(out, "fast_atan2(sin t, cos t)",
+            measure([] (double t) { return fast_atan2(std::sin(t),
+                                                      std::cos(t)); },
+                    [] (double t) { return std::atan2(std::sin(t),
+                                                      std::cos(t)); },
+                    -PI + EPSILON, PI - EPSILON));
+  print_row(out, "fast_asin(x), x in [-1, 1]",
+            measure([] (double x) { return fast_asin(x); },
+                    [] (double x) { return std::asin(x); },
+                    -1.0, 1.0));
+}
@@ -0,0 +1,149 @@
+#ifndef OXATRACE_FAST_MATH_HPP
+#define OXATRACE_FAST_MATH_HPP
+
+#include "math.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iosfwd>
+
+namespace oxatrace {
+
+// Cheap approximations of the transcendental functions used while shading.
+//
+// These trade accuracy for speed. They contain no calls into libm and no
+// branches besides conditional moves, so that the compiler is free to inline
+// and vectorise them. fast_math_report gives the measured accuracy of each of
+// them.
+
+// x^n by repeated squaring. This is exact up to rounding for any n.
+inline double
+pow_int(double x, unsigned n) noexcept {
+  double result = 1.0;
+  while (n) {
+    if (n & 1) result *= x;
+    x *= x;
+    n >>= 1;
+  }
+  return result;
+}
+
+// Base-2 logarithm. x must be positive and finite.
+//
+// The mantissa is reduced to [sqrt(1/2), sqrt(2)) and the logarithm is then
+// given by the series ln(m) = 2 (t + t^3/3 + t^5/5 + ...), t = (m-1)/(m+1).
+inline double
+fast_log2(double x) noexcept {
+  constexpr double SQRT2 = 1.4142135623730951;
+  constexpr double LOG2E = 1.4426950408889634;
+
+  std::uint64_t bits;
+  std::memcpy(&bits, &x, sizeof bits);
+  double exponent = double(int((bits >> 52) & 0x7ff) - 1023);
+  bits = (bits & 0x000fffffffffffffull) | 0x3ff0000000000000ull;
+  double m;
+  std::memcpy(&m, &bits, sizeof m);
+
+  bool const high = m > SQRT2;
+  m = high ? m * 0.5 : m;
+  exponent = high ? exponent + 1.0 : exponent;
+
+  double const t  = (m - 1.0) / (m + 1.0);
+  double const t2 = t * t;
+  double const series =
+    t * (2.0 + t2 * (2.0 / 3 + t2 * (2.0 / 5
+                                     + t2 * (2.0 / 7 + t2 * (2.0 / 9)))));
+  return exponent + series * LOG2E;
+}
+
+// 2^y. Results below the normal range of double are flushed to zero.
+inline double
+fast_exp2(double y) noexcept {
+  constexpr double LN2 = 0.6931471805599453;
+  constexpr double SQRT2 = 1.4142135623730951;
+
+  bool const underflow = y < -1022.0;
+  y = underflow ? -1022.0 : y;
+
+  // y = i + f, f in [0, 1); 2^f = sqrt(2) * e^z, z = (f - 1/2) ln 2.
+  double const i = std::floor(y);
+  double const z = (y - i - 0.5) * LN2;
+  double const e =
+    1.0 + z * (1.0 + z * (1.0 / 2 + z * (1.0 / 6 + z * (1.0 / 24
+      + z * (1.0 / 120 + z * (1.0 / 720 + z * (1.0 / 5040)))))));
+
+  std::uint64_t const bits = std::uint64_t(std::int64_t(i) + 1023) << 52;
+  double scale;
+  std::memcpy(&scale, &bits, sizeof scale);
+  return underflow ? 0.0 : SQRT2 * e * scale;
+}
+
+// x^y for x >= 0.
+inline double
+fast_pow(double x, double y) noexcept {
+  return x > 0.0 ? fast_exp2(y * fast_log2(x)) : 0.0;
+}
+
+// Sine of x in [-2pi, 2pi]. Reduced to [-pi/2, pi/2] using symmetries of the
+// sine, then evaluated using the Taylor polynomial of degree 11. Its
+// coefficients are folded into constants, so that it takes no divisions.
+inline double
+fast_sin(double x) noexcept {
+  x = x > PI ? x - 2 * PI : x;
+  x = x < -PI ? x + 2 * PI : x;
+  x = x > PI / 2 ? PI - x : x;
+  x = x < -PI / 2 ? -PI - x : x;
+
+  constexpr double S3  = -1.0 / 6;
+  constexpr double S5  =  1.0 / 120;
+  constexpr double S7  = -1.0 / 5040;
+  constexpr double S9  =  1.0 / 362880;
+  constexpr double S11 = -1.0 / 39916800;
+
+  double const x2 = x * x;
+  return x * (1.0 + x2 * (S3 + x2 * (S5 + x2 * (S7 + x2 * (S9 + x2 * S11)))));
+}
+
+// Cosine of x in [-2pi, 2pi].
+inline double
+fast_cos(double x) noexcept {
+  return fast_sin(x > PI ? x - 3 * PI / 2 : x + PI / 2);
+}
+
+// Arc tangent of y / x, in the range [-pi, pi]. Reduced to the first octant,
+// then approximated by a minimax polynomial.
+inline double
+fast_atan2(double y, double x) noexcept {
+  double const ax = std::abs(x);
+  double const ay = std::abs(y);
+  double const big = ax > ay ? ax : ay;
+  double const small = ax > ay ? ay : ax;
+  double const a = big > 0.0 ? small / big : 0.0;
+  double const s = a * a;
+  double r =
+    ((-0.0464964749 * s + 0.15931422) * s - 0.327622764) * s * a + a;
+
+  r = ay > ax ? PI / 2 - r : r;
+  r = x < 0.0 ? PI - r : r;
+  return y < 0.0 ? -r : r;
+}
+
+// Arc sine of x in [-1, 1]. Uses Abramowitz & Stegun 4.4.45.
+inline double
+fast_asin(double x) noexcept {
+  double const a = std::abs(x);
+  double const r = PI / 2 - std::sqrt(1.0 - a) *
+    (1.5707288 + a * (-0.2121144 + a * (0.0742610 + a * -0.0187293)));
+  return x < 0.0 ? -r : r;
+}
+
+// Measure the error of each approximation above against the standard library
+// over its domain, as used by the renderer, and print a table of maximum and
+// mean absolute errors.
+void
+fast_math_report(std::ostream& out);
+
+}  // namespace oxatrace
+
+#endif
@@ -0,0 +1,76 @@
+#include "features.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+using namespace oxatrace;
+
+constexpr int pixel_features::NO_SOLID;
+
+static std::uint8_t
+to_channel(real x) {
+  return round<std::uint8_t>(std::min(std::max(x, real(0)), real(1)) * 255);
+}
+
+// Colour of a solid: bits of a hash of its id, spread over the channels.
+static ldr_color
+solid_color(int solid) {
+  if (solid == pixel_features::NO_SOLID)
+    return {0, 0, 0};
+
+  std::uint32_t h = std::uint32_t(solid) * 0x9e3779b9u;
+  h ^= h >> 15;
+  return {std::uint8_t(64 + (h & 0x7f)), std::uint8_t(64 + ((h >> 8) & 0x7f)),
+          std::uint8_t(64 + ((h >> 16) & 0x7f))};
+}
+
+ldr_image
+oxatrace::visualise(feature_image const& features,
+                    std::string const& feature) {
+  ldr_image result{features.width(), features.height()};
+
+  if (feature == "normal") {
+    std::transform(
+      features.begin(), features.end(), result.begin(),
+      [] (pixel_features const& f) -> ldr_color {
+        vector3 const c = (f.normal + vector3::Ones()) / 2;
+        return {to_channel(c.x()), to_channel(c.y()), to_channel(c.z())};
+      }
+    );
+  } else if (feature == "depth") {
+    // Shown as inverse depth relative to the nearest point, which keeps
+    // detail close to the camera visible even when the scene extends far.
+    real min_depth = std::numeric_limits<real>::max();
+    for (pixel_features const& f : features)
+      if (f.solid != pixel_features::NO_SOLID)
+        min_depth = std::min(min_depth, f.depth);
+
+    std::transform(
+      features.begin(), features.end(), result.begin(),
+      [min_depth] (pixel_features const& f) -> ldr_color {
+        if (f.solid == pixel_features::NO_SOLID)
+          return {0, 0, 0};
+        std::uint8_t const v = to_channel(min_depth / f.depth);
+        return {v, v, v};
+      }
+    );
+  } else if (feature == "albedo") {
+    std::transform(
+      features.begin(), features.end(), result.begin(),
+      [] (pixel_features const& f) -> ldr_color {
+        return {to_channel(f.albedo[0]), to_channel(f.albedo[1]),
+                to_channel(f.albedo[2])};
+      }
+    );
+  } else if (feature == "solid") {
+    std::transform(features.begin(), features.end(), result.begin(),
+                   [] (pixel_features const& f) {
+                     return solid_color(f.solid);
+                   });
+  } else
+    throw std::invalid_argument{"visualise: Unknown feature " + feature};
+
+  return result;
+}
@@ -0,0 +1,40 @@
+#ifndef OXATRACE_FEATURES_HPP
+#define OXATRACE_FEATURES_HPP
+
+#include "color.hpp"
+#include "image.hpp"
+#include "math.hpp"
+
+#include <string>
+
+namespace oxatrace {
+
+// What a pixel sees first: its solid, and the normal, distance and texture
+// colour of that solid averaged over the pixel's samples.
+//
+// These auxiliary buffers are noise-free even at low sample counts, since they
+// ignore lighting, and so can guide the denoiser. They can also be saved for
+// inspection or for use by other tools.
+struct pixel_features {
+  static constexpr int NO_SOLID = -1;
+
+  vector3   normal = vector3::Zero();   // Unit normal, or zero if no hit.
+  real      depth  = 0.0;               // Distance from the film.
+  hdr_color albedo = {0.0, 0.0, 0.0};   // intersection::texture.
+  int       solid  = NO_SOLID;          // intersection::solid_id.
+};
+
+using feature_image = basic_image<pixel_features>;
+
+// Get a picture of one of the features for viewing: "normal" (components
+// mapped from [-1, 1] to [0, 255]), "depth" (brighter is closer), "albedo" or
+// "solid" (a distinct colour for each solid). Pixels that hit nothing are
+// black, except in normal.
+//
+// Throws std::invalid_argument: Unknown feature.
+ldr_image
+visualise(feature_image const& features, std::string const& feature);
+
+}  // namespace oxatrace
+
+#endif
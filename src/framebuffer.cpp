@@ -0,0 +1,139 @@
+#include "framebuffer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace oxatrace;
+
+static char const* const MAGIC = "OXATRACE-FRAMEBUFFER 2";
+
+static std::uint64_t
+round_up(std::uint64_t x, std::uint64_t multiple) {
+  return (x + multiple - 1) / multiple * multiple;
+}
+
+static std::uint64_t
+page_size() {
+  return sysconf(_SC_PAGESIZE);
+}
+
+tiled_framebuffer::tiled_framebuffer(std::string const& filename,
+                                     std::uint64_t width, std::uint64_t height,
+                                     std::size_t tile_side,
+                                     pixel_format format)
+  : width_{width}
+  , height_{height}
+  , tile_side_{tile_side}
+  , format_{format}
+  , fd_{-1}
+{
+  if (width == 0 || height == 0)
+    throw std::invalid_argument{"tiled_framebuffer: Empty image"};
+  if (tile_side == 0)
+    throw std::invalid_argument{"tiled_framebuffer: Tile side is 0"};
+
+  columns_ = (width + tile_side - 1) / tile_side;
+  rows_ = (height + tile_side - 1) / tile_side;
+  tile_bytes_ = round_up(std::uint64_t(tile_side) * tile_side
+                         * pixel_bytes(format),
+                         page_size());
+  mapping_bytes_ = page_size() + tile_count() * tile_bytes_;
+
+  void* mapping = MAP_FAILED;
+  if (filename.empty())
+    mapping = mmap(nullptr, mapping_bytes_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  else {
+    fd_ = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+               0666);
+    if (fd_ < 0)
+      throw std::system_error{errno, std::generic_category(),
+                              "tiled_framebuffer: Can't create " + filename};
+
+    if (ftruncate(fd_, mapping_bytes_) == 0)
+      mapping = mmap(nullptr, mapping_bytes_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_NORESERVE, fd_, 0);
+  }
+  if (mapping == MAP_FAILED) {
+    int const error = errno;
+    if (fd_ >= 0)
+      close(fd_);
+    throw std::system_error{error, std::generic_category(),
+                            "tiled_framebuffer: Can't map " + filename};
+  }
+  mapping_ = static_cast<unsigned char*>(mapping);
+
+  std::ostringstream header;
+  header << MAGIC << '\n'
+         << width << ' ' << height << ' ' << tile_side << ' '
+         << pixel_format_name(format) << ' ' << pixel_bytes(format) << '\n';
+  std::string const text = header.str();
+  std::memcpy(mapping_, text.data(), text.size());
+}
+
+tiled_framebuffer::~tiled_framebuffer() {
+  munmap(mapping_, mapping_bytes_);
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+tile
+tiled_framebuffer::tile_at(std::uint64_t i) const {
+  std::uint64_t const x = i % columns_ * tile_side_;
+  std::uint64_t const y = i / columns_ * tile_side_;
+  return {x, y, std::min<std::uint64_t>(tile_side_, width_ - x),
+          std::min<std::uint64_t>(tile_side_, height_ - y)};
+}
+
+std::uint64_t
+tiled_framebuffer::offset(std::uint64_t i) const {
+  return page_size() + i * tile_bytes_;
+}
+
+void
+tiled_framebuffer::store(std::uint64_t i, hdr_image const& pixels) {
+  tile const t = tile_at(i);
+  if (pixels.width() != t.width || pixels.height() != t.height)
+    throw std::invalid_argument{"tiled_framebuffer::store: Wrong tile size"};
+
+  pack_pixels(format_, pixels.data(), pixels.size(), mapping_ + offset(i));
+  evict(i);
+}
+
+hdr_image
+tiled_framebuffer::load(std::uint64_t i) const {
+  tile const t = tile_at(i);
+  hdr_image result{t.width, t.height};
+  unpack_pixels(format_, mapping_ + offset(i), result.size(), result.data());
+  evict(i);
+  return result;
+}
+
+void
+tiled_framebuffer::evict(std::uint64_t i) const {
+  // Anonymous pages would be lost.
+  if (fd_ < 0)
+    return;
+
+  // Unmap the pages, which leaves them dirty in the page cache, start writing
+  // them back, and drop those that are clean already. The rest are dropped by
+  // the kernel once written, should it need the memory.
+  madvise(mapping_ + offset(i), tile_bytes_, MADV_DONTNEED);
+  sync_file_range(fd_, offset(i), tile_bytes_, SYNC_FILE_RANGE_WRITE);
+  posix_fadvise(fd_, offset(i), tile_bytes_, POSIX_FADV_DONTNEED);
+}
+
+void
+tiled_framebuffer::sync() const {
+  if (fd_ >= 0 && fsync(fd_) != 0)
+    throw std::system_error{errno, std::generic_category(),
+                            "tiled_framebuffer::sync"};
+}
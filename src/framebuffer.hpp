@@ -0,0 +1,106 @@
+#ifndef OXATRACE_FRAMEBUFFER_HPP
+#define OXATRACE_FRAMEBUFFER_HPP
+
+#include "image.hpp"
+#include "pixel_format.hpp"
+#include "tiles.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace oxatrace {
+
+// An HDR image kept in a memory-mapped file rather than in memory, for images
+// too large to render into an hdr_image, or in memory but in a compact pixel
+// format.
+//
+// The image is cut into square tiles, in row-major order, and the pixels of
+// each tile are stored together, in row-major order, starting on a page
+// boundary. A tile is rendered into an hdr_image of its own and then stored:
+// converted into the pixel format of the framebuffer and copied into the
+// mapping. With a file, the tile is then written back and dropped from memory,
+// so the memory used stays bounded whatever the size of the image. The kernel
+// may still keep written pages in its page cache, but those are clean and
+// reclaimed as needed.
+//
+// The file starts with a page holding a text header:
+//
+//   OXATRACE-FRAMEBUFFER 2
+//   <width> <height> <tile side> <pixel format> <bytes per pixel>
+//
+// Pixels are stored as pack_pixels stores them, in the byte order of the
+// program that rendered them, and for the native format, in its precision.
+// All indices are 64-bit.
+class tiled_framebuffer {
+public:
+  // Create, or truncate, filename for an image of given size, whose pixels
+  // are stored in format. The file is sparse until tiles are stored. If
+  // filename is empty, the image is kept in anonymous memory instead, which is
+  // only committed as tiles are stored.
+  //
+  // Throws std::invalid_argument: Empty image, or tile_side is 0.
+  //        std::system_error: Can't create or map the file.
+  tiled_framebuffer(std::string const& filename, std::uint64_t width,
+                    std::uint64_t height, std::size_t tile_side,
+                    pixel_format format = pixel_format::native);
+
+  tiled_framebuffer(tiled_framebuffer const&) = delete;
+  tiled_framebuffer& operator = (tiled_framebuffer const&) = delete;
+
+  // Unmaps the file, which keeps whatever was stored in it.
+  ~tiled_framebuffer();
+
+  std::uint64_t width() const noexcept     { return width_; }
+  std::uint64_t height() const noexcept    { return height_; }
+  std::size_t   tile_side() const noexcept { return tile_side_; }
+  pixel_format  format() const noexcept    { return format_; }
+
+  std::uint64_t tile_columns() const noexcept { return columns_; }
+  std::uint64_t tile_rows() const noexcept    { return rows_; }
+  std::uint64_t tile_count() const noexcept   { return columns_ * rows_; }
+
+  // Where tile i lies in the image.
+  tile
+  tile_at(std::uint64_t i) const;
+
+  // Store pixels, of the size of tile i, as its pixels. Thread-safe as long as
+  // the threads store different tiles.
+  void
+  store(std::uint64_t i, hdr_image const& pixels);
+
+  // Read the pixels of tile i, which are dropped from memory again afterwards
+  // if they are in a file. Tiles never stored are black. Thread-safe.
+  hdr_image
+  load(std::uint64_t i) const;
+
+  // Wait until all stored tiles are on disk. Does nothing without a file.
+  //
+  // Throws std::system_error: Writing failed.
+  void
+  sync() const;
+
+private:
+  std::uint64_t  width_;
+  std::uint64_t  height_;
+  std::size_t    tile_side_;
+  pixel_format   format_;
+  std::uint64_t  columns_;
+  std::uint64_t  rows_;
+  std::uint64_t  tile_bytes_;  // Bytes reserved for each tile.
+  int            fd_;          // -1 without a file.
+  unsigned char* mapping_;
+  std::uint64_t  mapping_bytes_;
+
+  // Where the pixels of tile i start in the file.
+  std::uint64_t
+  offset(std::uint64_t i) const;
+
+  // Write back and drop the pages of tile i, if in a file.
+  void
+  evict(std::uint64_t i) const;
+};
+
+}  // namespace oxatrace
+
+#endif
@@ -1,57 +1,77 @@
 #include "image.hpp"
 
+#include "isa.hpp"
 #include "math.hpp"
+#include "png.hpp"
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
 #include <limits>
 
 using namespace oxatrace;
 
-static hdr_color::channel
-clip_channel(hdr_color::channel in) {
-  return in <= 1.0 ? in : 1.0;
+static_assert(sizeof(hdr_color) == hdr_color::LANES * sizeof(real),
+              "Kernels expect hdr_colors to be packed");
+static_assert(sizeof(ldr_color) == ldr_color::LANES,
+              "Kernels expect ldr_colors to be packed");
+
+// The loops over pixels are done by kernels; see kernels.hpp.
+
+static real*
+lanes(hdr_image& image) {
+  return &image.data()[0][0];
+}
+
+static real const*
+lanes(hdr_image const& image) {
+  return &image.data()[0][0];
 }
 
 double
 oxatrace::log_avg_luminance(hdr_image const& image) {
+  std::vector<double> block_sums(luminance_blocks(image));
+  for (std::size_t n = 0; n < block_sums.size(); ++n)
+    block_sums[n] = log_luminance_block(image, n);
+  return log_avg_luminance(image, block_sums);
+}
+
+double
+oxatrace::log_luminance_block(hdr_image const& image, std::size_t n) {
   constexpr double DELTA = 0.001;
 
-  double accum = 0.0;
-  for (hdr_color c : image)
-    accum += std::log(DELTA + luminance(c));
+  std::size_t const first = n * LUMINANCE_BLOCK;
+  assert(first < image.size());
+  return kernels().log_luminance_sum(
+    lanes(image) + first * hdr_color::LANES,
+    std::min(LUMINANCE_BLOCK, image.size() - first), DELTA
+  );
+}
 
+double
+oxatrace::log_avg_luminance(hdr_image const& image,
+                            std::vector<double> const& block_sums) {
+  assert(block_sums.size() == luminance_blocks(image));
+
+  double accum = 0.0;
+  for (double sum : block_sums)
+    accum += sum;
   return std::exp(accum / (image.width() * image.height()));
 }
 
 ldr_image
 oxatrace::ldr_from_hdr(hdr_image const& hdr) {
-  using ldr_pixel   = ldr_image::pixel_type;
-  using hdr_pixel   = hdr_image::pixel_type;
-  using ldr_channel = ldr_pixel::channel;
-  ldr_channel const out_max = std::numeric_limits<ldr_channel>::max();
-
   ldr_image result{hdr.width(), hdr.height()};
-  std::transform(
-    hdr.begin(), hdr.end(), result.begin(),
-    [&] (hdr_pixel const& in) -> ldr_pixel {
-      ldr_pixel out;
-      for (std::size_t i = 0; i < ldr_pixel::CHANNELS; ++i)
-        out[i] = round<ldr_channel>(clip_channel(in[i]) * out_max);
-      return out;
-    }
-  );
-
+  kernels().quantize(lanes(hdr), hdr.size(), &result.data()[0][0]);
   return result;
 }
 
 hdr_image
 oxatrace::expose(hdr_image image, double exposure) {
   assert(exposure > 0.0);
-  
-  for (auto& pixel : image)
-    for (auto& channel : pixel)
-      channel = 1.0 - std::exp(channel * -exposure);
+
+  kernels().expose(lanes(image), image.size(), exposure);
   return image;
 }
 
@@ -60,41 +80,225 @@ oxatrace::apply_reinhard(hdr_image image, double key) {
   assert(key > 0.0);
   
   double const avg_luminance = log_avg_luminance(image);
-
-  for (auto& pixel : image) {
-    pixel *= key / avg_luminance;
-    for (auto& channel : pixel)
-      channel /= 1.0 + channel;
-  }
-
+  kernels().reinhard(lanes(image), image.size(), key / avg_luminance);
   return image;
 }
 
 hdr_image
 oxatrace::correct_gamma(hdr_image image, double gamma) {
-  double const g = 1 / gamma;
-  for (auto& pixel : image)
-    for (auto& c : pixel)
-      c = std::pow(c, g);
+  kernels().gamma(lanes(image), image.size(), 1 / gamma);
   return image;
 }
 
+void
+oxatrace::develop_pixels(hdr_image const& hdr, std::size_t first,
+                         std::size_t count, tone_curve const& curve,
+                         ldr_image& ldr) {
+  assert(ldr.size() == hdr.size() && first + count <= hdr.size());
+
+  kernels().develop(lanes(hdr) + first * hdr_color::LANES, count, curve.op,
+                    curve.param, curve.exponent,
+                    &ldr.data()[first][0]);
+}
+
+// Level curve develops channel c into.
+static unsigned
+develop_channel(tone_curve const& curve, real c) {
+  hdr_color const pixel{c, 0.0, 0.0};
+  ldr_color out;
+  kernels().develop(&pixel[0], 1, curve.op, curve.param, curve.exponent,
+                    &out[0]);
+  return out[0];
+}
+
+// Ulps either side of a level's threshold searched at first for channels that
+// develop out of order.
+static constexpr real_bits DEVELOP_MARGIN = 64;
+
+develop_table
+oxatrace::make_develop_table(tone_curve const& curve) {
+  real_bits const infinity = bits_of(std::numeric_limits<real>::infinity());
+  assert(develop_channel(curve, real_of(infinity)) == 255);
+
+  develop_table result;
+  result.curve = curve;
+  result.low[0] = result.high[0] = 0.0;
+  real_bits low = 0;  // Develops into less than the level being looked for.
+  for (unsigned level = 1; level < 256; ++level) {
+    if (develop_channel(curve, 0.0) >= level) {
+      result.low[level] = result.high[level] = 0.0;
+      continue;
+    }
+
+    // Some channel from low + 1 to high is the least to reach level.
+    real_bits high = infinity;
+    while (high - low > 1) {
+      real_bits const middle = low + (high - low) / 2;
+      if (develop_channel(curve, real_of(middle)) >= level)
+        high = middle;
+      else
+        low = middle;
+    }
+
+    // Rounding makes developing go back and forth by a level over a few ulps
+    // around the threshold, so look that far for channels out of order, until
+    // the margin holds none.
+    real_bits least = high;
+    real_bits end = high;
+    for (real_bits margin = DEVELOP_MARGIN; ; margin *= 2) {
+      real_bits const from = std::max(real_bits(1), high - margin);
+      real_bits const to = std::min(infinity, high + margin);
+      for (real_bits x = from; x < high; ++x)
+        if (develop_channel(curve, real_of(x)) >= level) {
+          least = std::min(least, x);
+          break;
+        }
+      for (real_bits x = to; x > high; --x)
+        if (develop_channel(curve, real_of(x - 1)) < level) {
+          end = std::max(end, x);
+          break;
+        }
+
+      if ((least - from > margin / 2 || from == 1)
+          && (to - end > margin / 2 || to == infinity))
+        break;
+    }
+
+    result.low[level] = real_of(least);
+    result.high[level] = real_of(end);
+    assert(result.high[level - 1] <= result.low[level]);
+  }
+
+  // Bucket i holds channels from bits first + (i << shift) on.
+  real_bits const first = bits_of(result.low[1]);
+  real_bits const span = bits_of(result.high[255]) - first;
+  result.shift = 0;
+  while ((span >> result.shift) >= real_bits(DEVELOP_BUCKETS))
+    ++result.shift;
+
+  result.buckets.resize((span >> result.shift) + 1);
+  unsigned level = 0;
+  for (std::size_t i = 0; i < result.buckets.size(); ++i) {
+    real_bits const least = first + (real_bits(i) << result.shift);
+    while (level < 255 && least >= bits_of(result.low[level + 1]))
+      ++level;
+    result.buckets[i] = level;
+  }
+  return result;
+}
+
+void
+oxatrace::develop_pixels(hdr_image const& hdr, std::size_t first,
+                         std::size_t count, develop_table const& table,
+                         ldr_image& ldr) {
+  assert(ldr.size() == hdr.size() && first + count <= hdr.size());
+
+  tone_lookup const lookup{table.curve.op, table.curve.param,
+                           table.curve.exponent, table.low.data(),
+                           table.high.data(), table.buckets.data(),
+                           table.shift};
+  kernels().develop_table(lanes(hdr) + first * hdr_color::LANES, count, lookup,
+                          &ldr.data()[first][0]);
+}
+
+double
+oxatrace::psnr(ldr_image const& reference, ldr_image const& image) {
+  if (reference.width() != image.width() || reference.size() != image.size())
+    throw std::invalid_argument{"psnr: Image sizes differ"};
+
+  double const peak =
+    std::numeric_limits<ldr_image::pixel_type::channel>::max();
+
+  double sum{};
+  for (auto r = reference.begin(), i = image.begin(); r != reference.end();
+       ++r, ++i)
+    for (std::size_t c = 0; c < ldr_color::CHANNELS; ++c) {
+      double const d = double((*r)[c]) - double((*i)[c]);
+      sum += d * d;
+    }
+
+  double const mse = sum / (reference.size() * ldr_color::CHANNELS);
+  return 10.0 * std::log10(peak * peak / mse);
+}
+
+// Write image as a binary PPM.
+static void
+save_ppm(ldr_image const& image, std::string const& filename) {
+  ppm_writer{filename, image.width(), image.height()}.write(image);
+}
+
+static bool
+is_png(std::string const& filename) {
+  std::string const extension = ".png";
+  return filename.size() >= extension.size()
+         && filename.compare(filename.size() - extension.size(),
+                             extension.size(), extension) == 0;
+}
+
+static void
+save_png(ldr_image const& image, std::string const& filename,
+         thread_pool* pool) {
+  std::vector<unsigned char> const data = encode_png(image, pool);
+
+  std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+  out.exceptions(std::ios::badbit | std::ios::failbit);
+  out.write(reinterpret_cast<char const*>(data.data()), data.size());
+}
+
 void
 oxatrace::save(ldr_image const& image, std::string const& filename) {
+  if (is_png(filename))
+    save_png(image, filename, nullptr);
+  else
+    save_ppm(image, filename);
+}
+
+void
+oxatrace::save(ldr_image const& image, std::string const& filename,
+               thread_pool& pool) {
+  if (is_png(filename))
+    save_png(image, filename, &pool);
+  else
+    save_ppm(image, filename);
+}
+
+ppm_writer::ppm_writer(std::string const& filename, std::uint64_t width,
+                       std::uint64_t height)
+  : out_{filename.c_str(), std::ios::out | std::ios::binary}
+  , width_{width}
+  , rows_left_{height}
+{
   std::string const BINARY_PPM_MAGIC = "P6";
   unsigned const    MAX_PIXEL_VALUE  =
     std::numeric_limits<ldr_image::pixel_type::channel>::max();
 
-  std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
-  out.exceptions(std::ios::badbit | std::ios::failbit);
+  out_.exceptions(std::ios::badbit | std::ios::failbit);
+  out_ << BINARY_PPM_MAGIC << '\n'
+       << width << ' ' << height << '\n'
+       << MAX_PIXEL_VALUE << '\n';
+}
+
+void
+ppm_writer::write(ldr_image const& band) {
+  std::size_t const BLOCK_BYTES = 1 << 20;
 
-  // Header:
-  out << BINARY_PPM_MAGIC << '\n'
-      << image.width() << ' ' << image.height() << '\n'
-      << MAX_PIXEL_VALUE << '\n';
+  if (band.width() != width_ || band.height() > rows_left_)
+    throw std::invalid_argument{"ppm_writer::write: Band doesn't fit"};
+  rows_left_ -= band.height();
 
-  // Data:
-  for (auto const& pixel : image)
-    for (auto const& channel : pixel)
-      out.put(channel);
+  // Packed into RGB triples and written a block of rows at a time.
+  std::size_t const row_bytes = band.width() * ldr_color::CHANNELS;
+  std::size_t const block_rows =
+    std::max<std::size_t>(1, BLOCK_BYTES / row_bytes);
+  std::vector<char> block(std::min(block_rows, band.height()) * row_bytes);
+  for (std::size_t first = 0; first < band.height(); first += block_rows) {
+    std::size_t const rows = std::min(block_rows, band.height() - first);
+    char* p = block.data();
+    for (auto pixel = band.begin() + first * band.width(),
+              end = pixel + rows * band.width();
+         pixel != end; ++pixel)
+      for (std::size_t c = 0; c < ldr_color::CHANNELS; ++c)
+        *p++ = (*pixel)[c];
+    out_.write(block.data(), rows * row_bytes);
+  }
 }
@@ -2,11 +2,15 @@
 #define OXATRACE_IMAGE_HPP
 
 #include "color.hpp"
+#include "kernels.hpp"
+#include "memory.hpp"
 
 #include <boost/iterator/transform_iterator.hpp>
 
 #include <algorithm>
+#include <array>
 #include <cstddef>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
@@ -15,12 +19,15 @@
 
 namespace oxatrace {
 
+class thread_pool;
+
 // Stores pixels and provides interface for their direct manipulation.
 //
-// This is essentially a fixed-size random-access container.
+// This is essentially a fixed-size random-access container. Pixels are
+// allocated through buffer_allocator, so that large images may use huge pages.
 template <typename PixelT>
 class basic_image {
-  using pixel_list = std::vector<PixelT>;
+  using pixel_list = std::vector<PixelT, buffer_allocator<PixelT>>;
 
 public:
   using pixel_type            = PixelT;
@@ -56,6 +63,12 @@ public:
   const_pixel_iterator
   cend() const noexcept     { return pixels_.end(); }
 
+  // Pixels in row-major order.
+  pixel_type*
+  data() noexcept           { return pixels_.data(); }
+  pixel_type const*
+  data() const noexcept     { return pixels_.data(); }
+
   // Get pixel at given coordinates.
   //
   // These functions are thread-safe provided all threads access different
@@ -94,9 +107,31 @@ using ldr_image = basic_image<ldr_color>;
 // - L(x, y) is the luminance of the pixel at (x,y).
 //
 // L_avg is the geometric mean of luminances.
+//
+// The logarithms are summed in blocks of LUMINANCE_BLOCK pixels, and the sums
+// of the blocks then added up in order. This keeps the rounding error low, and
+// lets the blocks be summed in parallel with the same result; see
+// log_luminance_block.
 double
 log_avg_luminance(hdr_image const& image);
 
+constexpr std::size_t LUMINANCE_BLOCK = 4096;
+
+// Number of blocks of log_avg_luminance in image.
+inline std::size_t
+luminance_blocks(hdr_image const& image) {
+  return (image.size() + LUMINANCE_BLOCK - 1) / LUMINANCE_BLOCK;
+}
+
+// Sum of log(delta + L(x, y)) over the pixels of block n of image.
+double
+log_luminance_block(hdr_image const& image, std::size_t n);
+
+// L_avg of image, given the sum of each of its blocks.
+double
+log_avg_luminance(hdr_image const& image,
+                  std::vector<double> const& block_sums);
+
 // HDR → LDR transform.
 //
 // Input pixels in range [0, 1] are linearly mapped and rounded to byte
@@ -141,11 +176,99 @@ apply_reinhard(hdr_image image, double key = 0.18);
 hdr_image
 correct_gamma(hdr_image image, double gamma = 2.2);
 
-// Save an LDR image into a PPM file.
+// Get the peak signal-to-noise ratio of an image relative to a reference, in
+// decibels. Identical images give positive infinity.
+//
+// Throws std::invalid_argument: The images differ in size.
+double
+psnr(ldr_image const& reference, ldr_image const& image);
+
+// What develop_pixels does to each channel: tone-map it by op, with param as
+// the exposure of expose or as key / L_avg of apply_reinhard, then raise it to
+// exponent, unless that is 0.
+struct tone_curve {
+  tone_operator op       = tone_operator::none;
+  double        param    = 1.0;
+  double        exponent = 0.0;
+};
+
+// Apply curve to count pixels of hdr from first on, in row-major order, and
+// quantise them into the same pixels of ldr. This is one pass over the pixels,
+// with the same result as expose or apply_reinhard, correct_gamma and
+// ldr_from_hdr one after the other.
+//
+// Thread-safe as long as the threads develop different pixels.
+void
+develop_pixels(hdr_image const& hdr, std::size_t first, std::size_t count,
+               tone_curve const& curve, ldr_image& ldr);
+
+// A tone_curve as the channel values at which develop_pixels develops into
+// each of 1, ..., 255 instead of one level less.
+//
+// Developing a channel is non-decreasing in it but for rounding, which makes it
+// go back and forth between two levels over a few ulps where it steps from one
+// to the next. Channels below low[k] develop into less than k, those from
+// high[k] on into k or more, and the few in between are developed by the
+// curve. Channels between the first and the last threshold are sorted into
+// buckets by their leading bits, each bucket knowing the level of its least
+// channel, so that a channel's level takes a lookup and a comparison or two,
+// where the curve takes an exp or a pow or both. The thresholds are found by
+// searching the develop kernel itself, so developing by the table gives the
+// same result as by the curve, for channels in [0, +oo] and NaN alike.
+struct develop_table {
+  tone_curve                curve;
+  std::array<real, 256>     low;         // low[0] and high[0] are 0.
+  std::array<real, 256>     high;
+  std::vector<std::uint8_t> buckets;     // At most DEVELOP_BUCKETS.
+  unsigned                  shift;       // Bits of a channel not looked at.
+};
+
+constexpr std::size_t DEVELOP_BUCKETS = 1 << 16;
+
+develop_table
+make_develop_table(tone_curve const& curve);
+
+// Like the above, with the curve the table was made of.
+void
+develop_pixels(hdr_image const& hdr, std::size_t first, std::size_t count,
+               develop_table const& table, ldr_image& ldr);
+
+// Save an LDR image into a PNG file if filename ends in .png, and into a binary
+// PPM file otherwise.
 // Throws std::ios_base::failure on I/O error.
+//        std::runtime_error: PNG compression failed.
 void
 save(ldr_image const& image, std::string const& filename);
 
+// Like the above, but PNGs are compressed by the workers of pool; see
+// encode_png.
+void
+save(ldr_image const& image, std::string const& filename, thread_pool& pool);
+
+// Writes a binary PPM a band of rows at a time, for images too large to be held
+// in memory whole.
+class ppm_writer {
+public:
+  // Create filename and write the header of an image of given size.
+  //
+  // Throws std::ios_base::failure: I/O error.
+  ppm_writer(std::string const& filename, std::uint64_t width,
+             std::uint64_t height);
+
+  // Append the rows of band, which must be as wide as the image.
+  //
+  // Throws std::invalid_argument: Wrong width, or more rows than the image
+  //                               has left.
+  //        std::ios_base::failure: I/O error.
+  void
+  write(ldr_image const& band);
+
+private:
+  std::ofstream out_;
+  std::uint64_t width_;
+  std::uint64_t rows_left_;
+};
+
 //
 // basic_image implementation
 //
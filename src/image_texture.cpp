@@ -0,0 +1,144 @@
+#include "image_texture.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <functional>
+
+using namespace oxatrace;
+
+std::size_t
+texture_cache::key_hash::operator () (key const& k) const noexcept {
+  return std::hash<mipmap_file const*>{}(k.first)
+    ^ std::hash<std::uint64_t>{}(k.second) * 0x9e3779b97f4a7c15u;
+}
+
+texture_cache::texture_cache(std::size_t capacity)
+  : capacity_{capacity}
+{ }
+
+std::shared_ptr<hdr_image const>
+texture_cache::get(mipmap_file const& file, std::uint64_t index) {
+  key const k{&file, index};
+  // Neighbouring tiles go to different shards.
+  shard& s = shards_[index % SHARDS];
+
+  {
+    std::lock_guard<std::mutex> lock{s.mutex};
+    ++s.stats.lookups;
+    auto const found = s.index.find(k);
+    if (found != s.index.end()) {
+      ++s.stats.hits;
+      s.tiles.splice(s.tiles.begin(), s.tiles, found->second);
+      return found->second->second;
+    }
+  }
+
+  auto tile = std::make_shared<hdr_image>(file.tile_side(), file.tile_side());
+  file.read_tile(index, tile->data());
+  std::size_t const bytes = tile->size() * sizeof(hdr_color);
+
+  std::lock_guard<std::mutex> lock{s.mutex};
+  s.stats.bytes_read += file.tile_bytes();
+
+  // Another thread may have read the same tile meanwhile.
+  auto const found = s.index.find(k);
+  if (found != s.index.end())
+    return found->second->second;
+
+  s.tiles.emplace_front(k, std::move(tile));
+  s.index.emplace(k, s.tiles.begin());
+  s.bytes += bytes;
+  while (s.bytes > capacity_ / SHARDS && s.tiles.size() > 1) {
+    entry const& last = s.tiles.back();
+    s.bytes -= last.second->size() * sizeof(hdr_color);
+    s.index.erase(last.first);
+    s.tiles.pop_back();
+  }
+
+  return s.tiles.front().second;
+}
+
+auto
+texture_cache::stats() const -> statistics {
+  statistics result;
+  for (shard const& s : shards_) {
+    std::lock_guard<std::mutex> lock{s.mutex};
+    result.lookups    += s.stats.lookups;
+    result.hits       += s.stats.hits;
+    result.bytes_read += s.stats.bytes_read;
+  }
+  return result;
+}
+
+image_texture::image_texture(std::string const& filename,
+                             std::shared_ptr<texture_cache> const& cache)
+  : file_{filename}
+  , cache_{cache}
+{
+  assert(cache_);
+}
+
+hdr_color
+image_texture::get(real u, real v) const {
+  tile_ref tile;
+  return bilinear(0, u, v, tile);
+}
+
+hdr_color
+image_texture::get_filtered(real u, real v, real footprint) const {
+  // Level l has pixels 2^l times the size of those of level 0, so the level
+  // whose pixels span footprint is the binary logarithm of the number of
+  // pixels of level 0 it spans.
+  real const pixels =
+    footprint * real(std::max(file_.width(), file_.height()));
+  real const last = file_.levels() - 1;
+  real const level =
+    pixels > 1 ? std::min(real(std::log2(pixels)), last) : real(0);
+
+  tile_ref tile;
+  unsigned const lower = unsigned(level);
+  real const t = level - lower;
+  hdr_color result = bilinear(lower, u, v, tile);
+  if (t > 0)
+    result = result * (1 - t) + bilinear(lower + 1, u, v, tile) * t;
+  return result;
+}
+
+hdr_color
+image_texture::pixel(unsigned level, std::int64_t x, std::int64_t y,
+                     tile_ref& tile) const {
+  std::int64_t const width = file_.width(level);
+  std::int64_t const height = file_.height(level);
+  x = (x % width + width) % width;
+  y = (y % height + height) % height;
+
+  std::uint64_t const index = file_.tile_at(level, x, y);
+  if (index != tile.index) {
+    tile.pixels = cache_->get(file_, index);
+    tile.index = index;
+  }
+
+  std::size_t const side = file_.tile_side();
+  return tile.pixels->pixel_at(x % side, y % side);
+}
+
+hdr_color
+image_texture::bilinear(unsigned level, real u, real v, tile_ref& tile) const {
+  // Pixel centres lie at half-integer coordinates.
+  real const x = u * real(file_.width(level)) - real(0.5);
+  real const y = v * real(file_.height(level)) - real(0.5);
+  real const x0 = std::floor(x);
+  real const y0 = std::floor(y);
+  real const tx = x - x0;
+  real const ty = y - y0;
+  std::int64_t const px = std::int64_t(x0);
+  std::int64_t const py = std::int64_t(y0);
+
+  hdr_color const top =
+    pixel(level, px, py, tile) * (1 - tx) + pixel(level, px + 1, py, tile) * tx;
+  hdr_color const bottom =
+    pixel(level, px, py + 1, tile) * (1 - tx)
+    + pixel(level, px + 1, py + 1, tile) * tx;
+  return top * (1 - ty) + bottom * ty;
+}
@@ -0,0 +1,130 @@
+#ifndef OXATRACE_IMAGE_TEXTURE_HPP
+#define OXATRACE_IMAGE_TEXTURE_HPP
+
+#include "image.hpp"
+#include "mipmap.hpp"
+#include "solids.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace oxatrace {
+
+// Tiles of mipmap files kept in memory, shared by any number of textures and
+// threads. Once the tiles held take up more than the capacity, the least
+// recently used ones are dropped.
+//
+// The cache is split into shards by tile, each with a lock and a share of the
+// capacity of its own, so that threads rarely wait on each other. Tiles are
+// read from the file with no lock held.
+class texture_cache {
+public:
+  struct statistics {
+    std::uint64_t lookups    = 0;
+    std::uint64_t hits       = 0;
+    std::uint64_t bytes_read = 0;  // From the files.
+  };
+
+  // capacity is in bytes of tiles in memory. Each shard holds at least one
+  // tile whatever the capacity.
+  explicit
+  texture_cache(std::size_t capacity);
+
+  texture_cache(texture_cache const&) = delete;
+  texture_cache& operator = (texture_cache const&) = delete;
+
+  // Get tile number index of file, reading it if it isn't held. The tile stays
+  // valid for as long as it is referenced, even once dropped from the cache.
+  // file must outlive the cache. Thread-safe.
+  //
+  // Throws what mipmap_file::read_tile throws.
+  std::shared_ptr<hdr_image const>
+  get(mipmap_file const& file, std::uint64_t index);
+
+  // Totals over the life of the cache so far. Thread-safe.
+  statistics
+  stats() const;
+
+  std::size_t
+  capacity() const noexcept { return capacity_; }
+
+private:
+  using key = std::pair<mipmap_file const*, std::uint64_t>;
+
+  struct key_hash {
+    std::size_t
+    operator () (key const& k) const noexcept;
+  };
+
+  using entry = std::pair<key, std::shared_ptr<hdr_image const>>;
+
+  struct shard {
+    mutable std::mutex mutex;
+    std::list<entry>   tiles;  // Most recently used first.
+    std::unordered_map<key, std::list<entry>::iterator, key_hash> index;
+    std::size_t        bytes = 0;
+    statistics         stats;
+  };
+
+  static constexpr std::size_t SHARDS = 16;
+
+  std::size_t                 capacity_;
+  std::array<shard, SHARDS>   shards_;
+};
+
+// Texture given by an image in a file saved by save_mipmap, read through a
+// texture_cache a tile at a time as it is sampled, so that the image needn't
+// fit in memory. The image repeats beyond [0, 1]^2, and is filtered
+// bilinearly within a mip level and linearly between levels.
+class image_texture final : public texture {
+public:
+  // Throws what mipmap_file's constructor throws.
+  image_texture(std::string const& filename,
+                std::shared_ptr<texture_cache> const& cache);
+
+  // The full-size image, filtered bilinearly.
+  //
+  // Throws what texture_cache::get throws.
+  hdr_color
+  get(real u, real v) const override;
+
+  // The two levels whose pixels are nearest footprint in size.
+  //
+  // Throws what texture_cache::get throws.
+  hdr_color
+  get_filtered(real u, real v, real footprint) const override;
+
+  bool
+  filtered() const override { return true; }
+
+  mipmap_file const&
+  file() const noexcept { return file_; }
+
+private:
+  // The tile last fetched by a lookup, kept so that neighbouring pixels in it
+  // don't go through the cache again.
+  struct tile_ref {
+    std::uint64_t                    index = std::uint64_t(-1);
+    std::shared_ptr<hdr_image const> pixels;
+  };
+
+  mipmap_file                    file_;
+  std::shared_ptr<texture_cache> cache_;
+
+  hdr_color
+  pixel(unsigned level, std::int64_t x, std::int64_t y, tile_ref& tile) const;
+
+  hdr_color
+  bilinear(unsigned level, real u, real v, tile_ref& tile) const;
+};
+
+}  // namespace oxatrace
+
+#endif
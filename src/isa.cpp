@@ -0,0 +1,92 @@
+#include "isa.hpp"
+
+#include <stdexcept>
+
+using namespace oxatrace;
+
+namespace {
+  struct selection {
+    oxatrace::isa isa;
+    kernel_table  kernels;
+  };
+}
+
+static selection&
+current() {
+  static selection instance{isa::sse42, make_sse42_kernels()};
+  return instance;
+}
+
+bool
+oxatrace::isa_supported(isa isa) {
+  __builtin_cpu_init();
+
+  switch (isa) {
+  case isa::sse42:
+    return __builtin_cpu_supports("sse4.2");
+  case isa::avx2:
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  case isa::avx512:
+    return __builtin_cpu_supports("avx512f")
+        && __builtin_cpu_supports("avx512vl")
+        && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512dq")
+        && isa_supported(isa::avx2);
+  }
+
+  return false;
+}
+
+isa
+oxatrace::detect_isa() {
+  if (isa_supported(isa::avx512))    return isa::avx512;
+  else if (isa_supported(isa::avx2)) return isa::avx2;
+  else                               return isa::sse42;
+}
+
+std::string
+oxatrace::isa_name(isa isa) {
+  switch (isa) {
+  case isa::sse42:  return "sse4.2";
+  case isa::avx2:   return "avx2";
+  case isa::avx512: return "avx512";
+  }
+
+  return "unknown";
+}
+
+isa
+oxatrace::parse_isa(std::string const& name) {
+  if (name == "auto")
+    return detect_isa();
+
+  for (isa i : {isa::sse42, isa::avx2, isa::avx512})
+    if (name == isa_name(i))
+      return i;
+
+  throw std::invalid_argument{"parse_isa: Unknown instruction set " + name};
+}
+
+void
+oxatrace::select_kernels(isa isa) {
+  if (!isa_supported(isa))
+    throw std::invalid_argument{
+      "select_kernels: This CPU doesn't support " + isa_name(isa)
+    };
+
+  switch (isa) {
+  case isa::sse42:  current() = {isa, make_sse42_kernels()};  break;
+  case isa::avx2:   current() = {isa, make_avx2_kernels()};   break;
+  case isa::avx512: current() = {isa, make_avx512_kernels()}; break;
+  }
+}
+
+kernel_table const&
+oxatrace::kernels() {
+  return current().kernels;
+}
+
+isa
+oxatrace::selected_isa() {
+  return current().isa;
+}
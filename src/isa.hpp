@@ -0,0 +1,53 @@
+#ifndef OXATRACE_ISA_HPP
+#define OXATRACE_ISA_HPP
+
+#include "kernels.hpp"
+
+#include <string>
+
+namespace oxatrace {
+
+// Instruction set extensions the kernels are compiled for, narrowest first.
+enum class isa {
+  sse42,
+  avx2,    // Along with FMA.
+  avx512   // F, VL, BW and DQ.
+};
+
+// Does the running CPU, and the OS, support given ISA?
+bool
+isa_supported(isa isa);
+
+// Get the widest ISA supported by the running CPU.
+isa
+detect_isa();
+
+// Name of an ISA as used on the command line: "sse4.2", "avx2" or "avx512".
+std::string
+isa_name(isa isa);
+
+// Get the ISA of given name, or detect_isa() for "auto".
+//
+// Throws std::invalid_argument: Unknown name.
+isa
+parse_isa(std::string const& name);
+
+// Make kernels() return the kernels compiled for given ISA. This is meant to
+// be called once at startup, before any rendering threads are started.
+//
+// Throws std::invalid_argument: The ISA isn't supported by this CPU.
+void
+select_kernels(isa isa);
+
+// Get the currently selected kernels. Until select_kernels is called, these
+// are the SSE4.2 ones, which any CPU the program runs on supports.
+kernel_table const&
+kernels();
+
+// ISA of the currently selected kernels.
+isa
+selected_isa();
+
+}  // namespace oxatrace
+
+#endif
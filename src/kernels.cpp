@@ -0,0 +1,228 @@
+// Compiled once per ISA; see kernels.hpp for what may be included here.
+#include "kernels.hpp"
+
+#include <math.h>
+
+#ifndef OXATRACE_KERNELS_FACTORY
+#error "OXATRACE_KERNELS_FACTORY must name the factory to be defined"
+#endif
+
+using namespace oxatrace;
+
+namespace {
+
+// Overloads resolving directly to the C library, so that no inline function
+// of <cmath> is instantiated here.
+double c_sqrt(double x) { return ::sqrt(x); }
+
+double c_log(double x) { return ::log(x); }
+
+double c_exp(double x) { return ::exp(x); }
+
+double c_pow(double x, double y) { return ::pow(x, y); }
+
+constexpr std::size_t LANES = 4;
+
+// Dot product of two padded vectors, summed pairwise.
+double
+dot4(real const* u, real const* v) {
+  double p[LANES];
+  for (std::size_t i = 0; i < LANES; ++i)
+    p[i] = double(u[i]) * double(v[i]);
+  return (p[0] + p[2]) + (p[1] + p[3]);
+}
+
+real
+dot3(real const* u, real const* v) {
+  return u[0] * v[0] + u[1] * v[1] + u[2] * v[2];
+}
+
+// See sphere::intersect for the derivation. The discriminant suffers from
+// catastrophic cancellation for rays starting far away from the sphere, so
+// this is always solved in double precision.
+unsigned
+intersect_sphere(real const* origin, real const* direction, real epsilon,
+                 real* t) {
+  double const od  = dot4(origin, direction);
+  double const d_2 = dot4(direction, direction);
+  double const o_2 = dot4(origin, origin);
+
+  double const D = od * od - d_2 * (o_2 - 1);
+  if (D < 0.0) return 0;
+
+  double const sqrt_D = c_sqrt(D);
+  real const   t_1    = (-od - sqrt_D) / d_2;
+  real const   t_2    = (-od + sqrt_D) / d_2;
+
+  unsigned count = 0;
+  if (t_1 > epsilon) t[count++] = t_1;
+  if (t_2 > epsilon) t[count++] = t_2;
+  return count;
+}
+
+bool
+phong(real const* normal, real const* light_dir, unsigned exponent, bool fast,
+      real* cos_alpha, real* highlight) {
+  real const c = dot3(normal, light_dir) / c_sqrt(dot3(light_dir, light_dir));
+  if (c <= 0.0) return false;
+
+  if (fast) {
+    // pow_int, which lives in fast_math.hpp and so can't be used here.
+    double x = c, power = 1.0;
+    for (unsigned n = exponent; n; n >>= 1) {
+      if (n & 1) power *= x;
+      x *= x;
+    }
+    *highlight = power;
+  } else
+    *highlight = c_pow(c, exponent);
+
+  *cos_alpha = c;
+  return true;
+}
+
+void
+film_rays(real const* basis, real const* u, real const* v, std::size_t count,
+          real* rays) {
+  real const* position = basis;
+  real const* corner   = basis + 3;
+  real const* axis_u   = basis + 6;
+  real const* axis_v   = basis + 9;
+
+  // One coordinate at a time, so that each loop streams through two inputs
+  // and two outputs and vectorises.
+  for (std::size_t c = 0; c < 3; ++c) {
+    real* origin    = rays + c * count;
+    real* direction = rays + (3 + c) * count;
+    for (std::size_t i = 0; i < count; ++i) {
+      real const film = corner[c] + u[i] * axis_u[c] + v[i] * axis_v[c];
+      origin[i] = position[c] + film;
+      direction[i] = -film;
+    }
+  }
+}
+
+// The tone-mapping kernels process the padding lanes as well. These are zero
+// and stay zero under all of the operators, and the loops vectorise better
+// without skipping them.
+
+void
+expose(real* pixels, std::size_t count, double exposure) {
+  for (std::size_t i = 0; i < count * LANES; ++i)
+    pixels[i] = 1.0 - c_exp(pixels[i] * -exposure);
+}
+
+void
+reinhard(real* pixels, std::size_t count, double scale) {
+  real const s = scale;
+  for (std::size_t i = 0; i < count * LANES; ++i) {
+    real const c = pixels[i] * s;
+    pixels[i] = c / (1.0 + c);
+  }
+}
+
+void
+gamma(real* pixels, std::size_t count, double exponent) {
+  for (std::size_t i = 0; i < count * LANES; ++i)
+    pixels[i] = c_pow(pixels[i], exponent);
+}
+
+double
+log_luminance_sum(real const* pixels, std::size_t count, double delta) {
+  double sum = 0.0;
+  for (std::size_t i = 0; i < count; ++i) {
+    real const* p = pixels + i * LANES;
+    real const luminance = 0.2126 * p[0] + 0.7152 * p[1] + 0.0722 * p[2];
+    sum += c_log(delta + luminance);
+  }
+  return sum;
+}
+
+void
+quantize(real const* pixels, std::size_t count, std::uint8_t* out) {
+  for (std::size_t i = 0; i < count * LANES; ++i) {
+    real const clipped = pixels[i] <= 1.0 ? pixels[i] : real(1.0);
+    out[i] = static_cast<std::uint8_t>(double(clipped * 255) + 0.5);
+  }
+}
+
+// Pixels are developed in blocks this large, which stay in L1 while each of
+// the loops above runs over them, and so vectorise as well as on their own.
+constexpr std::size_t DEVELOP_BLOCK = 256;
+
+void
+develop(real const* pixels, std::size_t count, tone_operator op, double param,
+        double exponent, std::uint8_t* out) {
+  real block[DEVELOP_BLOCK * LANES];
+  for (std::size_t first = 0; first < count; first += DEVELOP_BLOCK) {
+    std::size_t const n =
+      count - first < DEVELOP_BLOCK ? count - first : DEVELOP_BLOCK;
+    for (std::size_t i = 0; i < n * LANES; ++i)
+      block[i] = pixels[first * LANES + i];
+
+    switch (op) {
+    case tone_operator::none:
+      break;
+    case tone_operator::exposure:
+      expose(block, n, param);
+      break;
+    case tone_operator::reinhard:
+      reinhard(block, n, param);
+      break;
+    }
+    if (exponent != 0.0)
+      gamma(block, n, exponent);
+    quantize(block, n, out + first * LANES);
+  }
+}
+
+// The bucket gives the level of the least channel it holds, and a bucket
+// rarely holds more than one threshold, so the scan after it is short.
+void
+develop_table(real const* pixels, std::size_t count, tone_lookup const& lookup,
+              std::uint8_t* out) {
+  real_bits const first = bits_of(lookup.low[1]);
+  real_bits const last = bits_of(lookup.high[255]);
+  for (std::size_t i = 0; i < count * LANES; ++i) {
+    real_bits const c = bits_of(pixels[i]);
+    unsigned level;
+    if (pixels[i] != pixels[i])
+      level = 255;
+    else if (c < first)
+      level = 0;
+    else if (c >= last)
+      level = 255;
+    else {
+      level = lookup.buckets[(c - first) >> lookup.shift];
+      while (level < 255 && c >= bits_of(lookup.low[level + 1]))
+        ++level;
+
+      if (c < bits_of(lookup.high[level])) {
+        real pixel[LANES] = {pixels[i]};
+        std::uint8_t developed[LANES];
+        develop(pixel, 1, lookup.op, lookup.param, lookup.exponent,
+                developed);
+        level = developed[0];
+      }
+    }
+    out[i] = std::uint8_t(level);
+  }
+}
+
+}  // anonymous namespace
+
+kernel_table
+oxatrace::OXATRACE_KERNELS_FACTORY() {
+  return {
+    intersect_sphere,
+    phong,
+    film_rays,
+    expose,
+    reinhard,
+    gamma,
+    log_luminance_sum,
+    quantize,
+    develop,
+    develop_table
+  };
+}
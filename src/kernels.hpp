@@ -0,0 +1,110 @@
+#ifndef OXATRACE_KERNELS_HPP
+#define OXATRACE_KERNELS_HPP
+
+#include "scalar.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace oxatrace {
+
+// Tone-mapping operator of kernel_table::develop.
+enum class tone_operator {
+  none,
+  exposure,
+  reinhard
+};
+
+// What kernel_table::develop_table develops by; see develop_table in
+// image.hpp.
+//
+// Channels below low[k] develop into less than k, and channels from high[k]
+// on into k or more, for k from 1 to 255; those in between are developed by
+// op, param and exponent as by kernel_table::develop. The search for a channel
+// c from low[1] to high[255] starts from the level in
+// buckets[(bits(c) - bits(low[1])) >> shift], bits being those of c as a
+// real_bits.
+struct tone_lookup {
+  tone_operator       op;
+  double              param;
+  double              exponent;
+  real const*         low;
+  real const*         high;
+  std::uint8_t const* buckets;
+  unsigned            shift;
+};
+
+// Inner loops compiled for several instruction set extensions.
+//
+// kernels.cpp is compiled once for each ISA in isa.hpp, each time with its own
+// -m flags, and each compilation provides one of the make_*_kernels functions
+// below. The program then calls the kernels through the table of whichever ISA
+// was selected at startup; see select_kernels.
+//
+// For that to be safe, kernels.cpp mustn't include anything that defines inline
+// functions or templates also used by the rest of the program -- Eigen and our
+// other headers in particular. The linker would otherwise be free to keep the
+// AVX copy of such a function and call it on a CPU without AVX. This is why the
+// kernels take plain pointers: Points and directions are passed as the four
+// lanes of a vector4 or the three of a vector3, as noted, and colours as the
+// four lanes of an hdr_color.
+//
+// All kernels give the same results on all ISAs.
+struct kernel_table {
+  // Intersect the ray given by origin and direction (vector4) with the unit
+  // sphere centred at the origin. Store the parameters greater than epsilon
+  // into t, in increasing order, and return how many there are (0 to 2).
+  unsigned (*intersect_sphere)(real const* origin, real const* direction,
+                               real epsilon, real* t);
+
+  // Factors of the Phong model for a light: cos(alpha) and
+  // cos(alpha)^exponent, alpha being the angle between the unit normal and
+  // light_dir (both vector3). If the light is behind the surface, returns
+  // false and leaves both alone. If fast is set, the power is evaluated by
+  // repeated squaring, like pow_int.
+  bool (*phong)(real const* normal, real const* light_dir, unsigned exponent,
+                bool fast, real* cos_alpha, real* highlight);
+
+  // Camera rays through count film positions (u[i], v[i]). basis holds four
+  // vector3s: the pinhole, the film corner, and the film's u and v axes, as in
+  // camera. The rays are stored into rays as six arrays of count
+  // coordinates each, like in ray_batch.
+  void (*film_rays)(real const* basis, real const* u, real const* v,
+                    std::size_t count, real* rays);
+
+  // Tone-mapping of count hdr_colors in place; see image.hpp.
+  void (*expose)(real* pixels, std::size_t count, double exposure);
+  void (*reinhard)(real* pixels, std::size_t count, double scale);
+  void (*gamma)(real* pixels, std::size_t count, double exponent);
+
+  // Sum of log(delta + luminance) over count hdr_colors.
+  double (*log_luminance_sum)(real const* pixels, std::size_t count,
+                              double delta);
+
+  // Clip count hdr_colors to 1 and convert them to ldr_colors.
+  void (*quantize)(real const* pixels, std::size_t count, std::uint8_t* out);
+
+  // Tone-map count hdr_colors by op, with param as the exposure or the scale
+  // of reinhard, then raise them to exponent unless it is 0, and quantize
+  // them into out. Gives the same results as the kernels above one after
+  // the other, without writing back the pixels in between.
+  void (*develop)(real const* pixels, std::size_t count, tone_operator op,
+                  double param, double exponent, std::uint8_t* out);
+
+  // Develop count hdr_colors into out like develop, by the lookup given.
+  void (*develop_table)(real const* pixels, std::size_t count,
+                        tone_lookup const& lookup, std::uint8_t* out);
+};
+
+kernel_table
+make_sse42_kernels();
+
+kernel_table
+make_avx2_kernels();
+
+kernel_table
+make_avx512_kernels();
+
+}  // namespace oxatrace
+
+#endif
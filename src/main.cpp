@@ -1,227 +1,1003 @@
 #include "camera.hpp"
+#include "counters.hpp"
+#include "daemon.hpp"
+#include "denoise.hpp"
+#include "fast_math.hpp"
+#include "framebuffer.hpp"
 #include "image.hpp"
-#include "lights.hpp"
+#include "image_texture.hpp"
+#include "isa.hpp"
+#include "memory.hpp"
+#include "mipmap.hpp"
+#include "partial.hpp"
+#include "pfm.hpp"
+#include "pixel_format.hpp"
 #include "scene.hpp"
+#include "scenes.hpp"
+#include "render_pass.hpp"
+#include "render_service.hpp"
 #include "renderer.hpp"
+#include "sampler.hpp"
 #include "text_interface.hpp"
+#include "thread_pool.hpp"
+#include "tile_stream.hpp"
+#include "tiles.hpp"
+#include "topology.hpp"
 
+#include <boost/optional.hpp>
 #include <boost/program_options.hpp>
 
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <cstdint>
 #include <cstddef>
+#include <fstream>
 #include <functional>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <stdexcept>
 #include <string>
 #include <sstream>
+#include <system_error>
 #include <thread>
 #include <vector>
 
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 using namespace oxatrace;
 
-scene_definition
-two_balls() {
-  scene_definition def;
-  auto sphere_shape = std::make_shared<oxatrace::sphere>();
-  auto plane_shape = std::make_shared<oxatrace::plane>();
+// Render the scene through the given camera into framebuffer, reporting
+// progress through the monitor. Each tile is rendered into an image of its own
+// and stored once done, so that only the tiles being rendered are held in
+// memory. Their pixels are the same as those of the whole image rendered at
+// once. The tiles are rendered in the framebuffer's order, row by row.
+static void
+trace(tiled_framebuffer& framebuffer, thread_pool& pool, scene const& sc,
+      camera const& cam, shading_policy const& policy,
+      std::string const& sampler_name, std::uint32_t seed,
+      progress_monitor& monitor) {
+  std::chrono::milliseconds const poll_interval{100};
+
+  std::vector<std::unique_ptr<sampler>> samplers;
+  for (unsigned i = 0; i < pool.size(); ++i)
+    samplers.push_back(make_sampler(sampler_name, seed));
+
+  std::uint64_t const tiles = framebuffer.tile_count();
+  std::atomic<std::uint64_t> tiles_done{0};
+
+  // Renders tiles [begin, end), giving away the back half of what's left
+  // whenever some worker is idle.
+  std::function<void(task_context&, std::uint64_t, std::uint64_t)> render;
+  render = [&] (task_context& context, std::uint64_t begin,
+                std::uint64_t end) {
+    while (begin < end) {
+      if (end - begin > 1 && context.idle_workers()) {
+        std::uint64_t const middle = begin + (end - begin) / 2;
+        context.spawn([&render, middle, end] (task_context& c) {
+          render(c, middle, end);
+        });
+        end = middle;
+      }
+
+      tile const t = framebuffer.tile_at(begin);
+      hdr_image pixels{t.width, t.height};
+      sample_tile(sc, cam, {0, 0, t.width, t.height}, policy,
+                  *samplers[context.worker()], 0,
+                  {framebuffer.width(), framebuffer.height(), t.x, t.y},
+                  pixels);
+      framebuffer.store(begin, pixels);
+      ++tiles_done;
+      ++begin;
+    }
+  };
 
-  auto plane_checker = std::make_shared<oxatrace::checkerboard>(
-    hdr_color{0.7, 0.7, 0.7}, hdr_color{0.8, 0.1, 0.1}
+  std::vector<task> tasks;
+  std::uint64_t const parts = std::min<std::uint64_t>(pool.size(), tiles);
+  for (std::uint64_t i = 0; i < parts; ++i)
+    tasks.push_back([&render, begin = tiles * i / parts,
+                     end = tiles * (i + 1) / parts] (task_context& c) {
+      render(c, begin, end);
+    });
+
+  monitor.change_phase(
+    "Tracing rays into " + std::to_string(tiles) + " tiles in "
+    + std::to_string(pool.size()) + " threads..."
   );
-  
-  hdr_color const sphere_color{0.4, 0.4, 0.6};
-  material const sphere_material{sphere_color, 0.4, 0.9, 200, 0.4};
+  task_group group;
+  pool.submit(group, std::move(tasks));
+  while (!pool.wait_for(group, poll_interval))
+    monitor.update_progress(double(tiles_done) / double(tiles));
+  monitor.update_progress(1.0);
+}
 
-  auto sphere1 = std::make_unique<solid>(sphere_shape, sphere_material);
-  (*sphere1)
-    .scale(3.0)
-    .translate({0, 3, -15})
-    ;
-  def.add_solid(std::move(sphere1));
+// Render the scene into a single image through the given camera.
+static hdr_image
+trace(std::size_t width, std::size_t height, thread_pool& pool,
+      scene const& sc, camera const& cam, shading_policy const& policy,
+      std::string const& sampler_name, std::uint32_t seed,
+      tiling const& tiling, progress_monitor& monitor) {
+  std::vector<render_view> views{{"", cam, {width, height}}};
+  trace(views, pool, sc, policy, sampler_name, seed, tiling, monitor);
+  return std::move(views.front().image);
+}
+
+// Render the scene through the given camera with each tile order, and with
+// cost-based scheduling, at a few tile sizes. Print a table of the times
+// taken, the cache misses incurred and the idle time of the threads.
+static void
+tile_report(std::size_t width, std::size_t height, unsigned threads,
+            scene const& sc, camera const& cam, shading_policy const& policy,
+            std::string const& sampler_name, std::uint32_t seed,
+            progress_monitor& monitor) {
+  // The counter only sees threads started after it, so this gets a pool of
+  // its own.
+  cache_miss_counter counter;
+  thread_pool pool{threads};
+
+  std::ostringstream table;
+  table << std::setw(10) << std::left << "Order" << std::right
+        << std::setw(6) << "Tile"
+        << std::setw(12) << "Time [s]"
+        << std::setw(16) << "Cache misses"
+        << std::setw(10) << "Idle [%]" << '\n';
+
+  std::vector<tiling> tilings;
+  for (tile_order order : {tile_order::rows, tile_order::morton,
+                           tile_order::hilbert})
+    for (std::size_t side : {8, 32, 128})
+      tilings.push_back({side, order, false});
+  for (std::size_t side : {8, 32, 128})
+    tilings.push_back({side, tile_order::hilbert, true});
+
+  for (tiling const& t : tilings) {
+    std::vector<render_view> views{{"", cam, {width, height}}};
+    counter.start();
+    trace_stats const stats =
+      trace(views, pool, sc, policy, sampler_name, seed, t, monitor);
+    std::uint64_t const misses = counter.stop();
+
+    table << std::setw(10) << std::left
+          << (t.longest_first ? "cost" : tile_order_name(t.order))
+          << std::right
+          << std::setw(6) << t.side
+          << std::setw(12) << std::fixed << std::setprecision(3)
+          << stats.prepass_seconds + stats.seconds
+          << std::setw(16)
+          << (counter.available() ? std::to_string(misses) : "n/a")
+          << std::setw(10) << std::setprecision(1) << stats.idle * 100
+          << '\n';
+  }
+
+  monitor.change_phase("Done");
+  std::cout << table.str();
+  if (!counter.available())
+    std::cout << "Cache miss counter not available on this system.\n";
+}
+
+// Render the scene through the given camera on the CPUs of the first node, the
+// first two nodes, and so on, and print a table of the times taken. With more
+// than one node, the scene is also rendered by a pool that ignores the nodes,
+// for comparison.
+static void
+numa_report(std::size_t width, std::size_t height,
+            std::vector<numa_node> const& topology,
+            scene const& sc, camera const& cam, shading_policy const& policy,
+            std::string const& sampler_name, std::uint32_t seed,
+            tiling const& tiling, progress_monitor& monitor) {
+  std::ostringstream table;
+  table << std::setw(7) << "Nodes"
+        << std::setw(9) << "Threads"
+        << std::setw(11) << "Placement"
+        << std::setw(12) << "Time [s]"
+        << std::setw(10) << "Speedup" << '\n';
+
+  double single_node = 0.0;
+  for (std::size_t k = 1; k <= topology.size(); ++k) {
+    std::vector<numa_node> const nodes(topology.begin(),
+                                       topology.begin() + k);
+    unsigned threads = 0;
+    for (numa_node const& node : nodes)
+      threads += node.cpus.size();
+
+    for (bool placed : {true, false}) {
+      if (!placed && k == 1)
+        continue;
+
+      auto const pool = placed
+        ? std::make_unique<thread_pool>(threads, nodes, true)
+        : std::make_unique<thread_pool>(threads);
+      std::vector<render_view> views{{"", cam, {width, height}}};
+      trace_stats const stats =
+        trace(views, *pool, sc, policy, sampler_name, seed, tiling, monitor);
+      double const seconds = stats.prepass_seconds + stats.seconds;
+      if (k == 1)
+        single_node = seconds;
+
+      table << std::setw(7) << k
+            << std::setw(9) << threads
+            << std::setw(11) << (placed ? "per-node" : "none")
+            << std::setw(12) << std::fixed << std::setprecision(3) << seconds
+            << std::setw(10) << std::setprecision(2) << single_node / seconds
+            << '\n';
+    }
+  }
+
+  monitor.change_phase("Done");
+  std::cout << "NUMA nodes:";
+  for (numa_node const& node : topology)
+    std::cout << ' ' << node.id << " (" << node.cpus.size() << " CPUs)";
+  std::cout << '\n' << table.str();
+}
+
+// Directory made in /tmp for the life of the object, removed together with the
+// files in it named by file() whether or not they were ever written.
+class temp_directory {
+public:
+  // prefix is the start of the directory's name.
+  //
+  // Throws std::system_error: The directory couldn't be made.
+  explicit
+  temp_directory(std::string const& prefix) {
+    std::string name = "/tmp/" + prefix + "-XXXXXX";
+    if (!mkdtemp(&name[0]))
+      throw std::system_error{errno, std::generic_category(), "mkdtemp"};
+    path_ = name;
+  }
+
+  temp_directory(temp_directory const&) = delete;
+  temp_directory& operator = (temp_directory const&) = delete;
+
+  ~temp_directory() {
+    for (std::string const& file : files_)
+      unlink(file.c_str());
+    rmdir(path_.c_str());
+  }
 
-  auto sphere2 = std::make_unique<solid>(sphere_shape, sphere_material);
-  (*sphere2)
-    .scale(3.0)
-    .translate({-8, 3, -15})
+  // Path of a file called name in the directory.
+  std::string
+  file(std::string const& name) {
+    files_.push_back(path_ + "/" + name);
+    return files_.back();
+  }
+
+private:
+  std::string              path_;
+  std::vector<std::string> files_;
+};
+
+// Render the scene into a view, then save the result as a PPM, and as a PNG
+// compressed by one thread and by all of the pool. Print a table of the times
+// taken, the best of a few runs each, and of the sizes of the files.
+static void
+encode_report(render_view view, thread_pool& pool, scene const& sc,
+              shading_policy const& policy,
+              std::string const& sampler_name, std::uint32_t seed,
+              tiling const& tiling, output_spec const& output,
+              progress_monitor& monitor) {
+  using clock = std::chrono::steady_clock;
+  unsigned const RUNS = 3;
+
+  std::vector<render_view> views{std::move(view)};
+  trace(views, pool, sc, policy, sampler_name, seed, tiling, monitor);
+  ldr_image const image = develop(views.front().image, output, pool);
+  std::size_t const width = image.width();
+  std::size_t const height = image.height();
+  views.clear();
+
+  temp_directory directory{"oxatrace-encode"};
+
+  std::ostringstream table;
+  table << std::setw(7) << "Format"
+        << std::setw(9) << "Threads"
+        << std::setw(12) << "Time [ms]"
+        << std::setw(12) << "Size [MB]"
+        << std::setw(9) << "Ratio" << '\n';
+
+  struct encoder {
+    char const* format;
+    char const* filename;
+    bool        parallel;
+  };
+  monitor.change_phase("Encoding...");
+  double ppm_size = 0.0;
+  for (encoder const& e : {encoder{"PPM", "image.ppm", false},
+                           encoder{"PNG", "image.png", false},
+                           encoder{"PNG", "image.png", true}}) {
+    std::string const file = directory.file(e.filename);
+    double best = std::numeric_limits<double>::infinity();
+    for (unsigned run = 0; run < RUNS; ++run) {
+      clock::time_point const start = clock::now();
+      if (e.parallel)
+        save(image, file, pool);
+      else
+        save(image, file);
+      best = std::min(
+        best,
+        std::chrono::duration<double, std::milli>(clock::now() - start).count()
+      );
+    }
+
+    double const size =
+      std::ifstream{file, std::ios::binary | std::ios::ate}.tellg();
+    if (ppm_size == 0.0)
+      ppm_size = size;
+
+    table << std::setw(7) << e.format
+          << std::setw(9) << (e.parallel ? pool.size() : 1)
+          << std::setw(12) << std::fixed << std::setprecision(1) << best
+          << std::setw(12) << std::setprecision(2) << size / 1e6
+          << std::setw(9) << std::setprecision(3) << size / ppm_size << '\n';
+  }
+
+  monitor.change_phase("Done");
+  std::cout << width << 'x' << height << ":\n" << table.str();
+}
+
+// Position the camera the scene is viewed from.
+static camera&
+place_camera(camera& cam) {
+  return cam
+    .rotate(angle_axis{-PI / 18, vector3::UnitX()})
+    .rotate(angle_axis{PI / 15, vector3::UnitY()})
+    .translate({0.0, 4.0, 0.0})
     ;
-  def.add_solid(std::move(sphere2));
+}
 
-  material const plane_material{hdr_color{0.5, 0.5, 0.5}, 0.5, 0.5, 1000, 0.2};
-  auto plane = std::make_unique<solid>(plane_shape, plane_material, plane_checker);
-  (*plane)
-    .scale(3.0)
-    .rotate(Eigen::AngleAxisd{PI / 2., vector3::UnitX()})
+// Make the views for --views: "single", "stereo" (a left and a right eye,
+// eye_separation apart) or "cubemap" (six square faces of side width, named
+// after the axis they look along).
+static std::vector<render_view>
+make_views(std::string const& kind, std::size_t width, std::size_t height,
+           real eye_separation) {
+  std::vector<render_view> views;
+  camera const cam{real(width) / real(height), real(PI / 2.0)};
+
+  if (kind == "single") {
+    camera c = cam;
+    views.push_back({"", place_camera(c), {width, height}});
+  } else if (kind == "stereo") {
+    for (int side : {-1, +1}) {
+      camera c = cam;
+      c.translate({side * eye_separation / 2, 0.0, 0.0});
+      views.push_back({side < 0 ? "left" : "right", place_camera(c),
+                       {width, height}});
+    }
+  } else if (kind == "cubemap") {
+    // The camera looks along -z by default.
+    struct face {
+      char const* name;
+      angle_axis  rotation;
+    };
+    std::array<face, 6> const faces{{
+      {"px", angle_axis{-PI / 2, vector3::UnitY()}},
+      {"nx", angle_axis{PI / 2, vector3::UnitY()}},
+      {"py", angle_axis{PI / 2, vector3::UnitX()}},
+      {"ny", angle_axis{-PI / 2, vector3::UnitX()}},
+      {"pz", angle_axis{PI, vector3::UnitY()}},
+      {"nz", angle_axis{0, vector3::UnitY()}}
+    }};
+
+    for (face const& f : faces) {
+      camera c = camera::cube_face();
+      c.rotate(f.rotation).translate({0.0, 4.0, 0.0});
+      views.push_back({f.name, c, {width, width}});
+    }
+  } else
+    throw std::runtime_error{"Unknown kind of views: " + kind};
+
+  return views;
+}
+
+// Insert the name of a view before the extension of filename: out.ppm becomes
+// out-left.ppm.
+static std::string
+view_filename(std::string const& filename, std::string const& view) {
+  if (view.empty())
+    return filename;
+
+  std::string::size_type const dot = filename.rfind('.');
+  std::string::size_type const slash = filename.rfind('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    return filename + "-" + view;
+  else
+    return filename.substr(0, dot) + "-" + view + filename.substr(dot);
+}
+
+namespace opts = boost::program_options;
+
+static char const* const DEFAULT_SOCKET = "/tmp/oxatrace.sock";
+
+// Options for tone mapping and gamma correction, as read by
+// output_from_options.
+static opts::options_description
+tone_mapping_options() {
+  opts::options_description tone_mapping{"Tone mapping options"};
+  tone_mapping.add_options()
+    ("no-tone-mapping",
+      opts::bool_switch(),
+      "Disable tone-mapping entirely")
+    ("reinhard,r",
+      opts::value<double>()->implicit_value(0.18, "0.18")->value_name("key"),
+      "Tone-map the image using Reinhard's operator (this is the default).")
+    ("exposure,e",
+      opts::value<double>(),
+      "Use the exposure operator. The argument corresponds to the exposition "
+      "time")
+    ("gamma,g",
+      opts::value<double>()->default_value(2.2, "2.2"),
+      "Use this value of gamma for gamma-correction. Value of 0 or 1 disables "
+      "gamma-correction.")
     ;
-  
-  def.add_solid(std::move(plane));
+  return tone_mapping;
+}
 
-  def.add_light(
-    std::make_unique<point_light>(vector3{-6.0, 10.0, 8.0},
-                                  hdr_color{1.0, 1.0, 1.0})
-  );
+static output_spec
+output_from_options(opts::variables_map const& values) {
+  if (values.count("reinhard") && values.count("exposure"))
+    throw std::runtime_error{"Cannot specify both --reinhard and --exposure"};
 
-  return def;
+  output_spec output;
+  output.gamma = values["gamma"].as<double>();
+  if (values["no-tone-mapping"].as<bool>())
+    output.tone_map = output_spec::tone_mapping::none;
+  else if (values.count("exposure")) {
+    output.tone_map = output_spec::tone_mapping::exposure;
+    output.exposure = values["exposure"].as<double>();
+  } else {
+    // Default to Reinhard.
+    output.tone_map = output_spec::tone_mapping::reinhard;
+    if (values.count("reinhard"))
+      output.key = values["reinhard"].as<double>();
+  }
+  return output;
 }
 
-scene_definition
-textured_ball() {
-  scene_definition def;
-  auto sphere_shape = std::make_shared<sphere>();
-  auto checker = std::make_shared<checkerboard>(
-    hdr_color{0.9, 0.9, 0.9}, hdr_color{0.1, 0.1, 0.9}, 8
-  );
-  material const sphere_mat{{0.0, 0.0, 0.0}, 0.6, 0.2, 20, 0.05};
+// Build the scene, and render what clients ask for, until one of them asks for
+// a shutdown.
+static int
+daemon_main(int argc, char** argv) {
+  std::string socket_path;
+  unsigned threads;
+  std::string isa_option;
 
-  auto sphere = std::make_unique<solid>(sphere_shape, sphere_mat, checker);
-  (*sphere)
-    .scale(3.0)
-    .translate({0, 3, -15})
+  opts::options_description options{"Daemon options"};
+  options.add_options()
+    ("help", "this cruft")
+    ("socket",
+     opts::value<std::string>(&socket_path)->default_value(DEFAULT_SOCKET),
+     "Unix domain socket to listen on.")
+    ("threads",
+     opts::value<unsigned>(&threads)
+       ->default_value(std::thread::hardware_concurrency()),
+     "Number of threads to use for rendering")
+    ("isa",
+     opts::value<std::string>(&isa_option)->default_value("auto"),
+     "Instruction set of the kernels: auto, sse4.2, avx2 or avx512.")
+    ("pin-threads", opts::bool_switch(),
+     "Keep each rendering thread on the CPUs of its NUMA node.")
+    ("huge-pages", opts::bool_switch(),
+     "Back large images with transparent huge pages.")
     ;
 
-  def.add_solid(std::move(sphere));
+  opts::variables_map values;
+  opts::store(opts::parse_command_line(argc, argv, options), values);
+  opts::notify(values);
 
-  def.add_light(
-    std::make_unique<point_light>(
-      vector3{-6.0, 10.0, 8.0},
-      hdr_color{1.0, 1.0, 1.0}
-    )
-  );
+  if (values.count("help")) {
+    std::cout << "Usage: oxatrace daemon [options]\n\n" << options << '\n';
+    return EXIT_SUCCESS;
+  }
 
-  return def;
+  select_kernels(parse_isa(isa_option));
+  set_huge_pages(values["huge-pages"].as<bool>());
+  thread_pool pool{threads, detect_numa_nodes(),
+                   values["pin-threads"].as<bool>()};
+
+  progress_monitor monitor;
+  monitor.change_phase("Using " + isa_name(selected_isa()) + " kernels");
+  run_daemon(socket_path, pool, monitor);
+  monitor.change_phase("Shut down");
+  return EXIT_SUCCESS;
 }
 
-class renderer_pool {
-public:
-  renderer_pool(unsigned threads, hdr_image& destination, scene const& scene,
-                camera const& camera, shading_policy const& sp)
-    : num_threads_(threads)
-    , current_job_index_{0}
-    , destination_(destination)
-    , scene_(scene)
-    , camera_(camera)
-    , shading_policy_(sp)
-  {
-    if (num_threads_ == 0)
-      throw std::out_of_range{"renderer_pool: Can't do 0 threads"};
+// Start the command line renderer as a new process with given arguments, its
+// standard output discarded.
+static pid_t
+spawn_renderer(std::vector<std::string> const& args) {
+  std::vector<char*> argv;
+  for (std::string const& arg : args)
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  argv.push_back(nullptr);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+
+  pid_t pid;
+  int const error = posix_spawn(&pid, "/proc/self/exe", &actions, nullptr,
+                                argv.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if (error != 0)
+    throw std::system_error{error, std::generic_category(), "posix_spawn"};
+  return pid;
+}
+
+// Wait for a process started by spawn_renderer. Returns whether it succeeded.
+static bool
+wait_for_renderer(pid_t pid) {
+  int status;
+  while (waitpid(pid, &status, 0) < 0)
+    if (errno != EINTR)
+      return false;
+  return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+// Run the renderer with given arguments and wait for it. Returns the
+// wall-clock seconds taken.
+static double
+time_process(std::vector<std::string> const& args) {
+  using clock = std::chrono::steady_clock;
+
+  clock::time_point const start = clock::now();
+  if (!wait_for_renderer(spawn_renderer(args)))
+    throw std::runtime_error{"Renderer process failed"};
+  return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+// Format x so that it reads back as the same number.
+static std::string
+exact(double x) {
+  std::ostringstream out;
+  out << std::setprecision(std::numeric_limits<double>::max_digits10) << x;
+  return out.str();
+}
+
+// Render a request n times each as a new process (cold) and through the
+// daemon (warm), and print a table of the latencies. The processes use the
+// command line's camera.
+static void
+latency_report(std::string const& socket_path, render_request const& request,
+               unsigned n, progress_monitor& monitor) {
+  using clock = std::chrono::steady_clock;
+
+  // The command line equivalent of the request.
+  char temp_name[] = "/tmp/oxatrace-latency-XXXXXX";
+  int const temp = mkstemp(temp_name);
+  if (temp < 0)
+    throw std::system_error{errno, std::generic_category(), "mkstemp"};
+  close(temp);
+
+  std::vector<std::string> args{
+    "oxatrace", "--output", std::string{temp_name},
+    "--width", std::to_string(request.width),
+    "--height", std::to_string(request.height),
+    "--supersampling", std::to_string(request.supersampling),
+    "--sampler", request.sampler,
+    "--seed", std::to_string(request.seed),
+    "--scene", request.scene,
+    "--gamma", exact(request.output.gamma)
+  };
+  if (!request.jitter)
+    args.push_back("--no-jitter");
+  if (request.fast_math)
+    args.push_back("--fast-math");
+  switch (request.output.tone_map) {
+  case output_spec::tone_mapping::none:
+    args.push_back("--no-tone-mapping");
+    break;
+  case output_spec::tone_mapping::reinhard:
+    args.push_back("--reinhard=" + exact(request.output.key));
+    break;
+  case output_spec::tone_mapping::exposure:
+    args.push_back("--exposure=" + exact(request.output.exposure));
+    break;
   }
 
-  renderer_pool(renderer_pool const&) = delete;
+  struct latencies {
+    std::string         mode;
+    std::vector<double> seconds;
+  };
+  std::vector<latencies> rows{{"process", {}}, {"daemon, scene built", {}},
+                              {"daemon, scene cached", {}}};
 
-  ~renderer_pool() { finish(); }
+  for (unsigned i = 0; i < n; ++i) {
+    monitor.change_phase("Running process " + std::to_string(i + 1) + "...");
+    rows[0].seconds.push_back(time_process(args));
+  }
+  unlink(temp_name);
 
-  void
-  run() {
-    for (unsigned i = 0; i < num_threads_; ++i)
-      threads_.push_back(std::thread([this] { worker(); }));
+  for (unsigned i = 0; i < n; ++i) {
+    monitor.change_phase("Sending request " + std::to_string(i + 1) + "...");
+    clock::time_point const start = clock::now();
+    remote_result const result = render_remotely(socket_path, request);
+    rows[result.scene_built ? 1 : 2].seconds.push_back(
+      std::chrono::duration<double>(clock::now() - start).count()
+    );
   }
 
-  void
-  finish() {
-    for (auto& thread : threads_)
-      thread.join();
-    threads_.clear();
+  monitor.change_phase("Done");
+  std::cout << std::setw(22) << std::left << "Mode" << std::right
+            << std::setw(10) << "Requests"
+            << std::setw(12) << "Mean [ms]"
+            << std::setw(12) << "Min [ms]" << '\n';
+  for (latencies const& row : rows) {
+    if (row.seconds.empty())
+      continue;
+    double sum = 0.0;
+    for (double s : row.seconds)
+      sum += s;
+    std::cout << std::setw(22) << std::left << row.mode << std::right
+              << std::setw(10) << row.seconds.size()
+              << std::fixed << std::setprecision(1)
+              << std::setw(12) << 1000 * sum / row.seconds.size()
+              << std::setw(12)
+              << 1000 * *std::min_element(row.seconds.begin(),
+                                          row.seconds.end())
+              << '\n';
   }
+}
 
-  double
-  percent_complete() const {
-    unsigned const total = total_pixels();
-    unsigned const done  = current_job_index_ * job_size;
+// Send a request to a daemon and save the image it sends back.
+static int
+client_main(int argc, char** argv) {
+  std::string socket_path;
+  std::string filename;
+  render_request request;
+  unsigned latency_requests = 0;
 
-    if (done <= total)  // It may go over because threads.
-      return double(done) / double(total);
-    else
-      return 1.0;
+  opts::options_description general{"Client options"};
+  general.add_options()
+    ("help", "this cruft")
+    ("socket",
+     opts::value<std::string>(&socket_path)->default_value(DEFAULT_SOCKET),
+     "Unix domain socket the daemon listens on.")
+    ("output,o",
+     opts::value<std::string>(&filename),
+     "filename of the output")
+    ("shutdown", opts::bool_switch(),
+     "Ask the daemon to stop instead.")
+    ("latency-report",
+     opts::value<unsigned>(&latency_requests)->value_name("n"),
+     "Render the request n times as a new process each, then n times "
+     "through the daemon, and compare the latencies.")
+    ;
+
+  opts::options_description render{"Rendering options"};
+  render.add_options()
+    ("width,w",
+     opts::value<std::size_t>(&request.width)->default_value(request.width),
+     "width of the result image")
+    ("height,h",
+     opts::value<std::size_t>(&request.height)->default_value(request.height),
+     "height of the result image")
+    ("scene",
+     opts::value<std::string>(&request.scene)->default_value(request.scene),
+     "Scene to render: two_balls or textured_ball.")
+    ("no-jitter", opts::bool_switch(), "Disable jittering.")
+    ("supersampling,s",
+     opts::value<unsigned>(&request.supersampling)
+       ->default_value(request.supersampling),
+     "Supersampling level. Must be a power of 2.")
+    ("sampler",
+     opts::value<std::string>(&request.sampler)
+       ->default_value(request.sampler),
+     "Source of sample points: sobol or random.")
+    ("seed",
+     opts::value<std::uint32_t>(&request.seed)->default_value(request.seed),
+     "Seed for the sampler.")
+    ("fast-math", opts::bool_switch(),
+     "Use cheaper approximations of transcendental functions while shading.")
+    ("yaw",
+     opts::value<double>(&request.yaw)->default_value(request.yaw, "12"),
+     "Rotation of the camera around the vertical axis, in degrees.")
+    ("pitch",
+     opts::value<double>(&request.pitch)->default_value(request.pitch, "-10"),
+     "Rotation of the camera around the horizontal axis, in degrees.")
+    ("fov",
+     opts::value<double>(&request.fov)->default_value(request.fov, "90"),
+     "Horizontal field of view, in degrees.")
+    ("priority",
+     opts::value<int>(&request.priority)->default_value(request.priority),
+     "Requests of a higher priority are rendered first.")
+    ("deadline",
+     opts::value<unsigned>(&request.deadline_ms)->value_name("ms"),
+     "Give up unless done within this many milliseconds.")
+    ;
+
+  opts::options_description all_options{"Allowed options"};
+  all_options.add(general).add(render).add(tone_mapping_options());
+
+  opts::variables_map values;
+  opts::store(opts::parse_command_line(argc, argv, all_options), values);
+  opts::notify(values);
+
+  if (values.count("help")) {
+    std::cout << "Usage: oxatrace client [options]\n\n" << all_options
+              << '\n';
+    return EXIT_SUCCESS;
   }
 
-  bool
-  done() const {
-    return current_job_index_ * job_size >= total_pixels();
+  if (values["shutdown"].as<bool>()) {
+    shut_down_daemon(socket_path);
+    return EXIT_SUCCESS;
   }
 
-  unsigned
-  concurrency() const { return num_threads_; }
+  request.jitter = !values["no-jitter"].as<bool>();
+  request.fast_math = values["fast-math"].as<bool>();
+  request.output = output_from_options(values);
 
-private:
-  static unsigned constexpr job_size = 1024;
-
-  using job = hdr_image::index;
-
-  unsigned                    num_threads_;
-  std::vector<std::thread>    threads_;
-  std::atomic<unsigned>       current_job_index_;
-  hdr_image&                  destination_;
-  scene const&                scene_;
-  camera const&               camera_;
-  shading_policy              shading_policy_;
-
-  hdr_image::index
-  total_pixels() const {
-    return destination_.width() * destination_.height();
-  }
-
-  bool
-  get_job(job& j) {
-    if (current_job_index_ * job_size < total_pixels()) {
-      std::size_t const index = std::atomic_fetch_add(&current_job_index_, 1u);
-      if (index * job_size < total_pixels()) {
-        j = index * job_size;
-        return true;
-      }
-    }
+  // Checks the request the way the daemon will.
+  parse_request(format_request(request));
 
-    return false;
+  progress_monitor monitor;
+  if (latency_requests > 0) {
+    latency_report(socket_path, request, latency_requests, monitor);
+    return EXIT_SUCCESS;
   }
 
-  void
-  worker() {
-    std::hash<std::thread::id> hasher;
-    sampler_prng_engine prng{hasher(std::this_thread::get_id())};
-    double const pixel_width  = 1.0 / destination_.width();
-    double const pixel_height = 1.0 / destination_.height();
+  if (filename.empty())
+    throw std::runtime_error{"Output filename must be specified"};
 
-    unsigned const total_size = total_pixels();
+  monitor.change_phase("Rendering on " + socket_path + "...");
+  remote_result const result =
+    render_remotely(socket_path, request, [&] (double progress) {
+      monitor.update_progress(progress);
+    });
+  monitor.change_phase("Saving result image...");
+  save(result.image, filename);
+  monitor.change_phase("Done");
+  return EXIT_SUCCESS;
+}
 
-    while (true) {
-      job begin;
-      bool const have_job = get_job(begin);
-      if (!have_job)
-        break;  // And thus end the thread.
+// Merge partials rendered by shards, and tone-map and save the result.
+static int
+merge_main(int argc, char** argv) {
+  std::string filename;
+  std::vector<std::string> inputs;
 
-      for (hdr_image::index index = begin;
-           index < begin + job_size && index < total_size;
-           ++index)
-      {
-        hdr_image::index const x = index % destination_.width();
-        hdr_image::index const y = index / destination_.width();
+  opts::options_description general{"Merge options"};
+  general.add_options()
+    ("help", "this cruft")
+    ("output,o",
+     opts::value<std::string>(&filename),
+     "filename of the output")
+    ("partial",
+     opts::value<std::vector<std::string>>(&inputs),
+     "Partial to merge; may also be given as positional arguments.")
+    ;
 
-        double const top_left_x = double(x) / double(destination_.width());
-        double const top_left_y = double(y) / double(destination_.height());
+  opts::options_description all_options{"Allowed options"};
+  all_options.add(general).add(tone_mapping_options());
 
-        assert(0.0 <= top_left_x && top_left_x <= 1.0);
-        assert(0.0 <= top_left_y && top_left_y <= 1.0);
+  opts::positional_options_description positional;
+  positional.add("partial", -1);
 
-        destination_.pixel_at(x, y) = sample(
-          scene_, camera_, {top_left_x, top_left_y, pixel_width, pixel_height},
-          shading_policy_, prng
-        );
-      }
+  opts::variables_map values;
+  opts::store(opts::command_line_parser(argc, argv)
+                .options(all_options).positional(positional).run(),
+              values);
+  opts::notify(values);
+
+  if (values.count("help")) {
+    std::cout << "Usage: oxatrace merge [options] partial...\n\n"
+              << all_options << '\n';
+    return EXIT_SUCCESS;
+  }
+
+  if (filename.empty())
+    throw std::runtime_error{"Output filename must be specified"};
+  output_spec const output = output_from_options(values);
+
+  progress_monitor monitor;
+  monitor.change_phase("Loading partials...");
+  std::vector<partial_image> partials;
+  for (std::string const& input : inputs)
+    partials.push_back(load_partial(input));
+
+  monitor.change_phase("Merging...");
+  hdr_image merged = merge_partials(partials);
+
+  monitor.change_phase("Saving result image...");
+  save(develop(merged, output), filename);
+  monitor.change_phase("Done");
+  return EXIT_SUCCESS;
+}
+
+// Build the mip levels of a PFM image and save them as a mipmap for
+// --texture.
+static int
+mipmap_main(int argc, char** argv) {
+  std::string input;
+  std::string filename;
+  std::size_t tile_side;
+  std::string format_option;
+
+  opts::options_description general{"Mipmap options"};
+  general.add_options()
+    ("help", "this cruft")
+    ("input",
+     opts::value<std::string>(&input),
+     "PFM image to build the mipmap of; may also be given as the first "
+     "positional argument.")
+    ("output,o",
+     opts::value<std::string>(&filename),
+     "filename of the mipmap; may also be given as the second positional "
+     "argument.")
+    ("tile-size",
+     opts::value<std::size_t>(&tile_side)->default_value(64),
+     "Side of the square tiles the mipmap is read in, in pixels.")
+    ("storage",
+     opts::value<std::string>(&format_option)->default_value("half"),
+     "Pixel format of the mipmap: native, float, half or rgb9e5.")
+    ;
+
+  opts::positional_options_description positional;
+  positional.add("input", 1).add("output", 1);
+
+  opts::variables_map values;
+  opts::store(opts::command_line_parser(argc, argv)
+                .options(general).positional(positional).run(),
+              values);
+  opts::notify(values);
+
+  if (values.count("help")) {
+    std::cout << "Usage: oxatrace mipmap [options] input.pfm output\n\n"
+              << general << '\n';
+    return EXIT_SUCCESS;
+  }
+
+  if (input.empty() || filename.empty())
+    throw std::runtime_error{"Input and output filenames must be specified"};
+  if (tile_side == 0)
+    throw std::runtime_error{"Tile size must be positive"};
+  pixel_format const format = parse_pixel_format(format_option);
+
+  progress_monitor monitor;
+  monitor.change_phase("Loading " + input + "...");
+  mapped_pfm const pfm{input};
+  hdr_image image{pfm.width(), pfm.height()};
+  pfm.read(0, image.size(), image.data());
+
+  monitor.change_phase("Building and saving mipmap...");
+  save_mipmap(image, filename, tile_side, format);
+  monitor.change_phase("Done");
+  return EXIT_SUCCESS;
+}
+
+// One line on how well the texture cache did.
+static std::string
+texture_cache_summary(texture_cache const& cache) {
+  texture_cache::statistics const stats = cache.stats();
+  std::ostringstream result;
+  result << std::fixed << std::setprecision(1) << "Texture cache: "
+         << stats.lookups << " lookups, "
+         << (stats.lookups > 0 ? 100.0 * stats.hits / stats.lookups : 0.0)
+         << "% hits, " << stats.bytes_read / 1e6 << " MB read from disk";
+  return result.str();
+}
+
+// Parse a crop window given as x,y,width,height.
+static tile
+parse_crop(std::string const& text) {
+  std::istringstream in{text};
+  tile result;
+  char c1, c2, c3;
+  if (!(in >> result.x >> c1 >> result.y >> c2 >> result.width >> c3
+           >> result.height)
+      || c1 != ',' || c2 != ',' || c3 != ','
+      || in.peek() != std::char_traits<char>::eof())
+    throw std::runtime_error{"Malformed crop window: " + text};
+  return result;
+}
+
+// Render the frame in shards, each in a process of its own, and merge them.
+//
+// Shards by region render horizontal bands of the frame, and shards by passes
+// all of it, each with its own seed. The shards are run with the options given
+// in forwarded, and write partials into a temporary directory.
+static hdr_image
+render_shards(unsigned shards, bool by_region,
+              std::vector<std::string> const& forwarded,
+              std::size_t width, std::size_t height, std::uint32_t seed,
+              unsigned threads, progress_monitor& monitor) {
+  temp_directory directory{"oxatrace-shards"};
+
+  std::vector<std::string> files;
+  std::vector<pid_t> processes;
+  bool failed = false;
+  for (unsigned i = 0; i < shards; ++i) {
+    files.push_back(directory.file("shard-" + std::to_string(i) + ".partial"));
+
+    std::vector<std::string> args{"oxatrace"};
+    args.insert(args.end(), forwarded.begin(), forwarded.end());
+    args.insert(args.end(), {
+      "--partial", "--output", files.back(),
+      "--threads", std::to_string(std::max(1u, threads / shards))
+    });
+    if (by_region) {
+      std::size_t const first = height * i / shards;
+      std::size_t const last = height * (i + 1) / shards;
+      args.insert(args.end(), {
+        "--seed", std::to_string(seed),
+        "--crop", "0," + std::to_string(first) + ","
+                  + std::to_string(width) + ","
+                  + std::to_string(last - first)
+      });
+    } else
+      args.insert(args.end(), {"--seed", std::to_string(seed + i)});
+
+    try {
+      processes.push_back(spawn_renderer(args));
+    } catch (std::exception const&) {
+      failed = true;
+      break;
     }
   }
-};
+
+  monitor.change_phase("Rendering " + std::to_string(shards) + " shards in "
+                       + "separate processes...");
+  for (pid_t p : processes)
+    failed = !wait_for_renderer(p) || failed;
+
+  std::vector<partial_image> partials;
+  if (!failed) {
+    monitor.change_phase("Merging shards...");
+    for (std::string const& file : files)
+      partials.push_back(load_partial(file));
+  }
+
+  if (failed)
+    throw std::runtime_error{"A shard failed"};
+  return merge_partials(partials);
+}
 
 int
 main(int argc, char** argv) try {
-  namespace opts = boost::program_options;
+  // Subcommands.
+  if (argc > 1 && argv[1] == std::string{"daemon"})
+    return daemon_main(argc - 1, argv + 1);
+  if (argc > 1 && argv[1] == std::string{"client"})
+    return client_main(argc - 1, argv + 1);
+  if (argc > 1 && argv[1] == std::string{"merge"})
+    return merge_main(argc - 1, argv + 1);
+  if (argc > 1 && argv[1] == std::string{"mipmap"})
+    return mipmap_main(argc - 1, argv + 1);
 
   std::size_t width, height;
   std::string filename;
-  double gamma;
   unsigned supersampling;
   unsigned threads;
+  std::string sampler_name;
+  std::uint32_t seed;
+  std::string isa_option;
+  std::string scene_name;
+  std::string views_kind;
+  real eye_separation;
+  denoise_params denoise_pol;
+  tiling tiles;
+  std::string tile_order_option;
+  std::string schedule;
+  std::string crop_option;
+  unsigned shards;
+  std::string shard_by;
+  unsigned checkpoint_seconds;
+  std::string framebuffer_file;
+  std::string storage_option;
+  std::string hdr_filename;
+  std::string from_hdr;
+  std::string stream_file;
+  std::string stream_pixels_option;
+  std::string texture_file;
+  std::size_t texture_cache_mb;
 
   opts::options_description general{"General options"};
   general.add_options()
@@ -239,6 +1015,68 @@ main(int argc, char** argv) try {
      opts::value<unsigned>(&threads)
        ->default_value(std::thread::hardware_concurrency()),
      "Number of threads to use for rendering")
+    ("isa",
+     opts::value<std::string>(&isa_option)->default_value("auto"),
+     "Instruction set of the kernels: auto (the widest one this CPU "
+     "supports), sse4.2, avx2 or avx512.")
+    ("pin-threads", opts::bool_switch(),
+     "Keep each rendering thread on the CPUs of its NUMA node.")
+    ("huge-pages", opts::bool_switch(),
+     "Back large images with transparent huge pages.")
+    ("shards",
+     opts::value<unsigned>(&shards)->default_value(1),
+     "Render in this many processes, each with its share of the threads, "
+     "and merge their results.")
+    ("shard-by",
+     opts::value<std::string>(&shard_by)->default_value("regions"),
+     "How the image is split among the --shards: regions (each renders a "
+     "horizontal band of it) or passes (each renders all of it with a seed "
+     "of its own).")
+    ("crop",
+     opts::value<std::string>(&crop_option),
+     "Render only this window of the image, given as x,y,width,height.")
+    ("partial", opts::bool_switch(),
+     "Save the traced image, along with the number of samples of each pixel, "
+     "as a partial for oxatrace merge instead of a tone-mapped one.")
+    ("checkpoint",
+     opts::value<unsigned>(&checkpoint_seconds)->default_value(0),
+     "Every this many seconds, append the tiles finished since to the "
+     "output filename with .checkpoint appended, to --resume from if the "
+     "render is interrupted. 0 disables checkpoints.")
+    ("resume", opts::bool_switch(),
+     "Continue the render from its last checkpoint. The other options must "
+     "be those of the interrupted render.")
+    ("framebuffer",
+     opts::value<std::string>(&framebuffer_file),
+     "Render into this file, mapped into memory a tile at a time, rather "
+     "than into memory, and develop it from there a row of tiles at a time. "
+     "For images too large for memory; the output must be a PPM. The tiles "
+     "are rendered row by row, so --tile-order, --schedule and --pin-threads "
+     "can't be given.")
+    ("storage",
+     opts::value<std::string>(&storage_option)->default_value("native"),
+     "Pixel format the traced image is stored in: native, float, half "
+     "(three 16-bit floats) or rgb9e5 (shared exponent). Other than native, "
+     "the image is rendered and developed a tile at a time like with "
+     "--framebuffer, in memory unless that is given.")
+    ("hdr-output",
+     opts::value<std::string>(&hdr_filename),
+     "Also save the traced image, before tone mapping, into this PFM file, "
+     "to be developed again with --from-hdr.")
+    ("from-hdr",
+     opts::value<std::string>(&from_hdr),
+     "Don't render anything, but develop the image in this PFM file with "
+     "the tone mapping options given, and save it as the output.")
+    ("stream",
+     opts::value<std::string>(&stream_file),
+     "Also write each tile to this file or pipe as soon as it is rendered, "
+     "as framed by tile_stream.hpp. - is the standard output; progress then "
+     "goes to the standard error.")
+    ("stream-pixels",
+     opts::value<std::string>(&stream_pixels_option)->default_value("hdr"),
+     "Pixels of --stream: hdr (floats, before tone mapping) or ldr (bytes, "
+     "developed; not with Reinhard's operator, which depends on the whole "
+     "image).")
     ;
 
   opts::options_description render{"Rendering options"};
@@ -248,115 +1086,450 @@ main(int argc, char** argv) try {
      opts::value<unsigned>(&supersampling)->default_value(4),
      "Supersampling level. Value of 1 disables supersampling. Must be a"
      "power of 2.")
+    ("sampler",
+     opts::value<std::string>(&sampler_name)->default_value("sobol"),
+     "Source of sample points: sobol (scrambled low-discrepancy sequence) or "
+     "random (independent uniform numbers).")
+    ("seed",
+     opts::value<std::uint32_t>(&seed)->default_value(0),
+     "Seed for the sampler.")
+    ("scene",
+     opts::value<std::string>(&scene_name)->default_value("two_balls"),
+     "Scene to render: two_balls or textured_ball.")
+    ("texture",
+     opts::value<std::string>(&texture_file),
+     "Texture the scene with the image in this mipmap, made by oxatrace "
+     "mipmap, in place of its checkerboard. The image is read a tile at a "
+     "time, from the mip level that matches the size of each pixel.")
+    ("texture-cache",
+     opts::value<std::size_t>(&texture_cache_mb)->default_value(64),
+     "Megabytes of --texture tiles kept in memory.")
+    ("views",
+     opts::value<std::string>(&views_kind)->default_value("single"),
+     "Views to render in one pass: single, stereo (written as -left and "
+     "-right images) or cubemap (six width x width faces, written as -px, "
+     "-nx, -py, -ny, -pz and -nz images).")
+    ("eye-separation",
+     opts::value<real>(&eye_separation)->default_value(0.5, "0.5"),
+     "Distance between the cameras of --views stereo.")
+    ("denoise", opts::bool_switch(),
+     "Filter noise out of the rendered image before tone mapping, guided by "
+     "the auxiliary buffers.")
+    ("denoise-iterations",
+     opts::value<unsigned>(&denoise_pol.iterations)->default_value(2),
+     "Number of iterations of the denoiser. Each one doubles the radius.")
+    ("aux", opts::bool_switch(),
+     "Also save the auxiliary buffers: first-hit normal, depth, albedo and "
+     "solid, as -normal, -depth, -albedo and -solid images.")
+    ("fast-math", opts::bool_switch(),
+     "Use cheaper approximations of transcendental functions while shading.")
+    ("tile-size",
+     opts::value<std::size_t>(&tiles.side)->default_value(tiles.side),
+     "Side of the square tiles the image is rendered in, in pixels.")
+    ("tile-order",
+     opts::value<std::string>(&tile_order_option)->default_value("hilbert"),
+     "Order in which the tiles are rendered: rows, morton (Z-order curve) or "
+     "hilbert (Hilbert curve).")
+    ("schedule",
+     opts::value<std::string>(&schedule)->default_value("cost"),
+     "How tiles are handed out to the threads: cost (most expensive first, "
+     "as estimated by a quick pass at a lower resolution) or order (in "
+     "--tile-order).")
+    ("tile-report", opts::bool_switch(),
+     "Render the scene with each tile order and several tile sizes, and "
+     "compare the times taken and the cache misses.")
+    ("numa-report", opts::bool_switch(),
+     "Render the scene on the CPUs of one NUMA node, then of two and so on, "
+     "and compare the times taken.")
+    ("encode-report", opts::bool_switch(),
+     "Render the scene, then save it as a PPM and as a PNG compressed by one "
+     "and by all threads, and compare the times taken and the file sizes.")
+    ("fast-math-report", opts::bool_switch(),
+     "Measure the accuracy of the fast-math approximations, then render the "
+     "scene both with and without --fast-math and compare the results.")
     ;
   
-  opts::options_description tone_mapping{"Tone mapping options"};
-  tone_mapping.add_options()
-    ("no-tone-mapping",
-      opts::bool_switch(),
-      "Disable tone-mapping entirely")
-    ("reinhard,r",
-      opts::value<double>()->implicit_value(0.18, "0.18")->value_name("key"),
-      "Tone-map the image using Reinhard's operator (this is the default).")
-    ("exposure,e",
-      opts::value<double>(),
-      "Use the exposure operator. The argument corresponds to the exposition "
-      "time")
-    ("gamma,g",
-      opts::value<double>(&gamma)->default_value(2.2, "2.2"),
-      "Use this value of gamma for gamma-correction. Value of 0 or 1 disables "
-      "gamma-correction.")
-    ;
+  opts::options_description const tone_mapping = tone_mapping_options();
 
   opts::options_description all_options{"Allowed options"};
   all_options.add(general).add(render).add(tone_mapping);
 
   opts::variables_map values;
-  opts::store(opts::parse_command_line(argc, argv, all_options), values);
+  opts::parsed_options const parsed =
+    opts::parse_command_line(argc, argv, all_options);
+  opts::store(parsed, values);
   opts::notify(values);
 
   if (values.count("help")) {
-    std::cout << all_options << '\n';
+    std::cout << "Usage: oxatrace [options]\n"
+              << "       oxatrace daemon [options]  "
+              << "(render requests sent over a socket)\n"
+              << "       oxatrace client [options]  "
+              << "(send a request to the daemon)\n"
+              << "       oxatrace merge [options] partial...  "
+              << "(merge partials saved with --partial)\n"
+              << "       oxatrace mipmap [options] input.pfm output  "
+              << "(make a mipmap for --texture)\n\n"
+              << all_options << '\n';
     return EXIT_SUCCESS;
   }
 
-  if (filename.empty())
-    throw std::runtime_error{"Output filename must be specified"};
+  bool const report = values["fast-math-report"].as<bool>();
+  bool const tiles_report = values["tile-report"].as<bool>();
+  bool const nodes_report = values["numa-report"].as<bool>();
+  bool const encoders_report = values["encode-report"].as<bool>();
 
-  if (values.count("reinhard") && values.count("exposure"))
-    throw std::runtime_error{"Cannot specify both --reinhard and --exposure"};
+  if (filename.empty() && !report && !tiles_report && !nodes_report
+      && !encoders_report)
+    throw std::runtime_error{"Output filename must be specified"};
 
   if (!is_power2(supersampling))
     throw std::runtime_error{"Supersampling value not a power of 2"};
 
-  std::function<hdr_image(hdr_image)> tone_mapper;
-  if (!values["no-tone-mapping"].as<bool>()) {
-    if (values.count("exposure")) {
-      double e = values["exposure"].as<double>();
-      tone_mapper = [e] (hdr_image in) {
-        return expose(std::move(in), e);
-      };
-    } else {
-      // Default to Reinhard.
-      double r =
-        values.count("reinhard") ? values["reinhard"].as<double>() : 0.18;
-      tone_mapper = [r] (hdr_image in) {
-        return apply_reinhard(std::move(in), r);
-      };
-    }
+  if (sampler_name != "sobol" && sampler_name != "random")
+    throw std::runtime_error{"Unknown sampler: " + sampler_name};
+
+  if (tiles.side == 0)
+    throw std::runtime_error{"Tile size must be positive"};
+  tiles.order = parse_tile_order(tile_order_option);
+
+  if (schedule != "cost" && schedule != "order")
+    throw std::runtime_error{"Unknown schedule: " + schedule};
+  tiles.longest_first = schedule == "cost";
+
+  bool const partial = values["partial"].as<bool>();
+  bool const denoising = values["denoise"].as<bool>();
+  bool const aux = values["aux"].as<bool>();
+  bool const cropped = !crop_option.empty();
+  tile const crop =
+    cropped ? parse_crop(crop_option) : tile{0, 0, width, height};
+  if (crop.width == 0 || crop.height == 0
+      || crop.x + crop.width > width || crop.y + crop.height > height)
+    throw std::runtime_error{"Crop window not inside the image"};
+
+  // The reports time one image of the first view's camera.
+  if (views_kind != "single"
+      && (report || tiles_report || nodes_report || encoders_report))
+    throw std::runtime_error{"Reports only work with a single view"};
+
+  if (shards == 0)
+    throw std::runtime_error{"Number of shards must be positive"};
+  if (shard_by != "regions" && shard_by != "passes")
+    throw std::runtime_error{"Unknown kind of shards: " + shard_by};
+  if ((shards > 1 || partial || cropped)
+      && (views_kind != "single" || denoising || aux || report
+          || tiles_report || nodes_report || encoders_report))
+    throw std::runtime_error{"--shards, --crop and --partial only work with "
+                             "a single view, without denoising, auxiliary "
+                             "buffers or reports"};
+  if (shards > 1 && (partial || cropped))
+    throw std::runtime_error{"--shards can't be combined with --crop or "
+                             "--partial"};
+  // Each shard must get at least a row, and saves only a partial.
+  if (shards > 1 && shard_by == "regions" && shards > height)
+    throw std::runtime_error{"--shard-by regions needs no more --shards than "
+                             "rows of the image"};
+  if (shards > 1 && !hdr_filename.empty())
+    throw std::runtime_error{"--hdr-output can't be combined with --shards"};
+
+  bool const resume = values["resume"].as<bool>();
+  if ((checkpoint_seconds > 0 || resume)
+      && (shards > 1 || report || tiles_report || nodes_report
+          || encoders_report))
+    throw std::runtime_error{"--checkpoint and --resume don't work with "
+                             "--shards or reports"};
+
+  pixel_format const storage = parse_pixel_format(storage_option);
+  bool const tiled =
+    !framebuffer_file.empty() || storage != pixel_format::native;
+  if (tiled
+      && (views_kind != "single" || denoising || aux || partial || cropped
+          || shards > 1 || checkpoint_seconds > 0 || resume || report
+          || tiles_report || nodes_report || encoders_report))
+    throw std::runtime_error{"--framebuffer and --storage only work with a "
+                             "single view, without denoising, auxiliary "
+                             "buffers, cropping, shards, checkpoints or "
+                             "reports"};
+  // The tiles are rendered in rows, with no placement on NUMA nodes.
+  if (tiled
+      && (!values["tile-order"].defaulted() || !values["schedule"].defaulted()
+          || values["pin-threads"].as<bool>()))
+    throw std::runtime_error{"--framebuffer and --storage render tiles row "
+                             "by row, and can't be combined with "
+                             "--tile-order, --schedule or --pin-threads"};
+  if (tiled && filename.size() >= 4
+      && filename.compare(filename.size() - 4, 4, ".png") == 0)
+    throw std::runtime_error{"--framebuffer and --storage can only be saved "
+                             "as a PPM"};
+
+  if (!hdr_filename.empty() && (tiled || partial))
+    throw std::runtime_error{"--hdr-output can't be combined with "
+                             "--framebuffer, --storage or --partial"};
+  if (!from_hdr.empty()
+      && (views_kind != "single" || denoising || aux || partial || cropped
+          || shards > 1 || checkpoint_seconds > 0 || resume || tiled
+          || !hdr_filename.empty() || report || tiles_report || nodes_report
+          || encoders_report))
+    throw std::runtime_error{"--from-hdr only develops an image, and can't "
+                             "be combined with options of rendering"};
+
+  output_spec const output = output_from_options(values);
+
+  stream_pixels const streamed = parse_stream_pixels(stream_pixels_option);
+  if (!stream_file.empty()
+      && (denoising || shards > 1 || tiled || !from_hdr.empty() || report
+          || tiles_report || nodes_report || encoders_report))
+    throw std::runtime_error{"--stream only works with images rendered in "
+                             "memory, without denoising, shards or reports"};
+  if (!stream_file.empty() && streamed == stream_pixels::ldr
+      && output.tone_map == output_spec::tone_mapping::reinhard)
+    throw std::runtime_error{"--stream-pixels ldr needs --exposure or "
+                             "--no-tone-mapping, as Reinhard's operator "
+                             "depends on the whole image"};
+
+  if (shards > 1) {
+    // Forward all options but those the coordinator sets for each shard.
+    std::vector<std::string> forwarded;
+    for (opts::option const& option : parsed.options)
+      if (option.string_key != "output" && option.string_key != "threads"
+          && option.string_key != "shards" && option.string_key != "shard-by"
+          && option.string_key != "seed")
+        forwarded.insert(forwarded.end(), option.original_tokens.begin(),
+                         option.original_tokens.end());
+
+    progress_monitor monitor;
+    using clock = std::chrono::steady_clock;
+    clock::time_point const start = clock::now();
+    hdr_image merged = render_shards(shards, shard_by == "regions", forwarded,
+                                     width, height, seed, threads, monitor);
+    std::ostringstream summary;
+    summary << std::fixed << std::setprecision(1) << "Rendered "
+            << shards << " shards in "
+            << std::chrono::duration<double>(clock::now() - start).count()
+            << " s";
+    monitor.change_phase(summary.str());
+
+    monitor.change_phase("Saving result image...");
+    save(develop(merged, output), filename);
+    monitor.change_phase("Done");
+    return EXIT_SUCCESS;
+  }
+
+  select_kernels(parse_isa(isa_option));
+
+  set_huge_pages(values["huge-pages"].as<bool>());
+
+  // Started once and used for all of the work below.
+  std::vector<numa_node> const topology = detect_numa_nodes();
+  thread_pool pool{threads, topology, values["pin-threads"].as<bool>()};
+
+  progress_monitor monitor{stream_file == "-" ? std::cerr : std::cout};
+  monitor.change_phase("Using " + isa_name(selected_isa()) + " kernels");
+
+  if (!from_hdr.empty()) {
+    monitor.change_phase("Developing " + from_hdr + "...");
+    mapped_pfm const image{from_hdr};
+    ldr_image const out = develop(image, output, pool);
+    monitor.change_phase("Saving result image...");
+    save(out, filename, pool);
+    monitor.change_phase("Done");
+    return EXIT_SUCCESS;
   }
 
-  progress_monitor monitor;
   monitor.change_phase("Building scene...");
 
-  auto scene_def = &two_balls;
-  std::unique_ptr<scene> sc{simple_scene::make(scene_def())};
+  std::shared_ptr<texture_cache> cache;
+  std::shared_ptr<image_texture> image_tex;
+  if (!texture_file.empty()) {
+    cache = std::make_shared<texture_cache>(texture_cache_mb << 20);
+    image_tex = std::make_shared<image_texture>(texture_file, cache);
+  }
 
-  camera cam{double(width) / double(height), PI / 2.0};
-  cam
-    .rotate(Eigen::AngleAxisd{-PI / 18, vector3::UnitX()})
-    .rotate(Eigen::AngleAxisd{PI / 15, vector3::UnitY()})
-    .translate({0.0, 4.0, 0.0})
-    ;
-  
-  hdr_image result{width, height};
-  hdr_color const background{0.05, 0.05, 0.2};
+  std::unique_ptr<scene> sc{
+    simple_scene::make(make_scene_definition(scene_name, image_tex))
+  };
 
-  shading_policy shading_pol;
-  shading_pol.background = background;
+  shading_policy shading_pol = default_shading_policy();
   shading_pol.jitter = !values["no-jitter"].as<bool>();
   shading_pol.supersampling = supersampling;
-  shading_pol.min_importance = 0.01;
+  shading_pol.math =
+    values["fast-math"].as<bool>() ? math_mode::fast : math_mode::exact;
 
-  std::chrono::milliseconds const poll_interval{100};
+  if (tiled) {
+    using clock = std::chrono::steady_clock;
+    clock::time_point const start = clock::now();
 
-  {
-    // Scope is necessary to make sure all threads are joined before moving
-    // on.
-    
-    renderer_pool pool{threads, result, *sc, cam, shading_pol};
-    monitor.change_phase(
-      std::string{"Tracing rays in "}
-      + std::to_string(pool.concurrency()) + " threads..."
-    );
-    pool.run();
-    while (!pool.done()) {
-      monitor.update_progress(pool.percent_complete());
-      std::this_thread::sleep_for(poll_interval);
+    camera cam{real(width) / real(height), real(PI / 2.0)};
+    place_camera(cam);
+    tiled_framebuffer framebuffer{framebuffer_file, width, height, tiles.side,
+                                  storage};
+    trace(framebuffer, pool, *sc, cam, shading_pol, sampler_name, seed,
+          monitor);
+
+    std::ostringstream summary;
+    summary << std::fixed << std::setprecision(1) << "Traced in "
+            << std::chrono::duration<double>(clock::now() - start).count()
+            << " s";
+    monitor.change_phase(summary.str());
+    if (cache)
+      monitor.change_phase(texture_cache_summary(*cache));
+
+    monitor.change_phase("Developing and saving result image...");
+    develop(framebuffer, output, filename, pool);
+    framebuffer.sync();
+    monitor.change_phase("Done");
+    return EXIT_SUCCESS;
+  }
+
+  std::vector<render_view> views =
+    make_views(views_kind, width, height, eye_separation);
+  if (cropped) {
+    views.front().image = hdr_image{crop.width, crop.height};
+    views.front().crop = film_crop{width, height, crop.x, crop.y};
+  }
+
+  if (report) {
+    monitor.change_phase("Measuring approximation errors...");
+    fast_math_report(std::cout);
+
+    using clock = std::chrono::steady_clock;
+    std::array<ldr_image, 2> images{{{width, height}, {width, height}}};
+    std::array<double, 2> seconds;
+    for (math_mode mode : {math_mode::exact, math_mode::fast}) {
+      shading_pol.math = mode;
+      clock::time_point const start = clock::now();
+      hdr_image traced = trace(width, height, pool, *sc,
+                               views.front().camera, shading_pol,
+                               sampler_name, seed, tiles, monitor);
+      seconds[int(mode)] =
+        std::chrono::duration<double>(clock::now() - start).count();
+      images[int(mode)] = develop(traced, output, pool);
     }
 
-    monitor.update_progress(pool.percent_complete());
+    monitor.change_phase("Done");
+    std::cout << "Exact: " << seconds[0] << " s, fast: " << seconds[1]
+              << " s, PSNR: " << psnr(images[0], images[1]) << " dB\n";
+    return EXIT_SUCCESS;
   }
 
-  monitor.change_phase("Saving result image...");
+  if (tiles_report) {
+    tile_report(width, height, threads, *sc, views.front().camera,
+                shading_pol, sampler_name, seed, monitor);
+    return EXIT_SUCCESS;
+  }
+
+  if (nodes_report) {
+    numa_report(width, height, topology, *sc, views.front().camera,
+                shading_pol, sampler_name, seed, tiles, monitor);
+    return EXIT_SUCCESS;
+  }
+
+  if (encoders_report) {
+    encode_report(std::move(views.front()), pool, *sc, shading_pol,
+                  sampler_name, seed, tiles, output, monitor);
+    return EXIT_SUCCESS;
+  }
 
-  if (tone_mapper)
-    result = tone_mapper(std::move(result));
-  if (gamma > EPSILON)
-    result = correct_gamma(std::move(result), gamma);
+  if (denoising || aux)
+    for (render_view& view : views)
+      view.features = feature_image{view.image.width(), view.image.height()};
+
+  // Everything the pixels depend on, so that a checkpoint is only resumed by
+  // the same render.
+  checkpointing cp;
+  if (checkpoint_seconds > 0 || resume) {
+    cp.filename = filename + ".checkpoint";
+    cp.interval = std::chrono::seconds{checkpoint_seconds};
+    cp.resume = resume;
+    cp.fingerprint =
+      "scene=" + scene_name + " texture=" + texture_file
+      + " width=" + std::to_string(width)
+      + " height=" + std::to_string(height) + " crop=" + crop_option
+      + " views=" + views_kind + " eye-separation=" + exact(eye_separation)
+      + " supersampling=" + std::to_string(supersampling)
+      + " jitter=" + std::to_string(shading_pol.jitter)
+      + " fast-math=" + std::to_string(shading_pol.math == math_mode::fast)
+      + " sampler=" + sampler_name + " seed=" + std::to_string(seed)
+      + " tile-size=" + std::to_string(tiles.side)
+      + " tile-order=" + tile_order_option
+      + " isa=" + isa_name(selected_isa());
+  }
+
+  std::unique_ptr<tile_stream> stream;
+  if (!stream_file.empty()) {
+    std::vector<stream_image> images;
+    std::size_t tile_count = 0;
+    for (render_view const& view : views) {
+      images.push_back({view.name, &view.image});
+      tile_count +=
+        make_tiles(view.image.width(), view.image.height(), tiles).size();
+    }
+    stream = std::make_unique<tile_stream>(
+      stream_file, std::move(images), tile_count, streamed,
+      streamed == stream_pixels::ldr ? fixed_tone_curve(output) : tone_curve{}
+    );
+  }
+
+  trace_stats const stats = trace(views, pool, *sc, shading_pol,
+                                  sampler_name, seed, tiles, monitor, cp,
+                                  stream.get());
+  if (stream)
+    stream->finish();
+  std::ostringstream summary;
+  summary << std::fixed << std::setprecision(1);
+  if (resume)
+    summary << "Resumed " << stats.resumed << " tiles; ";
+  summary << "Traced in " << stats.prepass_seconds + stats.seconds << " s";
+  if (tiles.longest_first)
+    summary << ", estimating tile costs took " << stats.prepass_seconds << " s";
+  summary << "; threads were idle for " << stats.idle * 100
+          << "% of the time";
+  monitor.change_phase(summary.str());
+  if (cache)
+    monitor.change_phase(texture_cache_summary(*cache));
+
+  if (denoising) {
+    monitor.change_phase("Denoising...");
+    for (render_view& view : views)
+      view.image = denoise(view.image, *view.features, denoise_pol, pool);
+  }
+
+  monitor.change_phase("Saving result images...");
+
+  if (partial) {
+    // Sampling is adaptive, so this counts the sample slots of each pixel
+    // rather than the samples actually taken.
+    render_view& view = views.front();
+    basic_image<std::uint32_t> weights{view.image.width(),
+                                       view.image.height()};
+    std::fill(weights.begin(), weights.end(), supersampling * supersampling);
+    save_partial({view.film(), std::move(view.image), std::move(weights)},
+                 filename);
+    if (!cp.filename.empty())
+      unlink(cp.filename.c_str());
+    monitor.change_phase("Done");
+    return EXIT_SUCCESS;
+  }
+
+  for (render_view& view : views) {
+    if (!hdr_filename.empty())
+      save_pfm(view.image, view_filename(hdr_filename, view.name));
+
+    ldr_image const out = develop(view.image, output, pool);
+    save(out, view_filename(filename, view.name), pool);
+
+    if (aux)
+      for (char const* feature : {"normal", "depth", "albedo", "solid"}) {
+        std::string const name =
+          view.name.empty() ? feature : view.name + "-" + feature;
+        save(visualise(*view.features, feature),
+             view_filename(filename, name), pool);
+      }
+  }
 
-  ldr_image const out = ldr_from_hdr(std::move(result));
-  save(out, filename);
+  // The result is saved, so the checkpoint is no longer needed.
+  if (!cp.filename.empty())
+    unlink(cp.filename.c_str());
 
   monitor.change_phase("Done");
 } catch (std::exception& e) {
@@ -1,5 +1,7 @@
 #include "math.hpp"
 
+#include "fast_math.hpp"
+
 #include <cmath>
 #include <stdexcept>
 
@@ -27,16 +29,16 @@ oxatrace::get_any_orthogonal(unit3 const& input) {
 
   vector3 const v = input.get();
 
-  double const x = std::abs(v.x());
-  double const y = std::abs(v.y());
-  double const z = std::abs(v.z());
+  real const x = std::abs(v.x());
+  real const y = std::abs(v.y());
+  real const z = std::abs(v.z());
 
   if (x >= y && x >= z)
-    return {(-v.y() - v.z()) / v.x(), 1.0, 1.0};
+    return {(-v.y() - v.z()) / v.x(), real(1), real(1)};
   else if (y >= x && y >= z)
-    return {1.0, (-v.x() - v.z()) / v.y(), 1.0};
+    return {real(1), (-v.x() - v.z()) / v.y(), real(1)};
   else
-    return {1.0, 1.0, (-v.x() - v.y()) / v.z()};
+    return {real(1), real(1), (-v.x() - v.y()) / v.z()};
 }
 
 unit3
@@ -45,7 +47,8 @@ oxatrace::reflect(unit3 const& v, unit3 const& normal) {
 }
 
 unit3
-oxatrace::cos_lobe_perturb(unit3 const& v, unsigned n, random_eng& prng) {
+oxatrace::cos_lobe_perturb(unit3 const& v, unsigned n, vector2 const& u,
+                           math_mode mode) {
   // We'll use the formulas from Philip Dutré's Total Compendium[1] to generate
   // a random vector on a hemisphere.
   //
@@ -64,19 +67,27 @@ oxatrace::cos_lobe_perturb(unit3 const& v, unsigned n, random_eng& prng) {
   vector3 const x = get_any_orthogonal(z);
   vector3 const y = x.cross(z);
   
-  std::uniform_real_distribution<> phi_distrib(0, 2 * PI);
-  std::uniform_real_distribution<> u_distrib;
-  
-  double const phi = phi_distrib(prng);
-  double const r   = u_distrib(prng);  // r_2 in [1].
-  
-  double const p = std::pow(r, 2.0 / (n + 1.0));
-  double const q = std::sqrt(1.0 - p);
+  real const phi = 2 * PI * u.x();
+  real const r   = u.y();  // r_2 in [1].
   
-  return unit3{unit3::assume_norm{},
-               x * std::cos(phi) * q
-                 + y * std::sin(phi) * q
-                 + z * std::pow(r, 1.0 / (n + 1.0))};
+  // cos(theta) = r^(1 / (n + 1)), and r^(2 / (n + 1)) is its square.
+  real const e = 1.0 / (n + 1.0);
+  real const cos_theta =
+    mode == math_mode::fast ? fast_pow(r, e) : std::pow(r, e);
+  real const q = std::sqrt(1.0 - cos_theta * cos_theta);
+
+  real const cos_phi =
+    mode == math_mode::fast ? fast_cos(phi) : std::cos(phi);
+  real const sin_phi =
+    mode == math_mode::fast ? fast_sin(phi) : std::sin(phi);
+
+  vector3 const result = x * cos_phi * q + y * sin_phi * q + z * cos_theta;
+
+  // The approximations are too coarse for the result to pass as unit-length.
+  if (mode == math_mode::fast)
+    return result;
+  else
+    return unit3{unit3::assume_norm{}, result};
 }
 
 std::ostream&
@@ -87,30 +98,35 @@ oxatrace::operator << (std::ostream& out, ray const& ray) {
 }
 
 oxatrace::ray
-oxatrace::transform(ray const& ray, Eigen::Affine3d const& tr)
-{ return {tr * ray.origin().homogeneous(), tr.linear() * ray.direction()}; }
+oxatrace::transform(ray const& ray, affine3 const& tr) {
+  // Multiplying the padded vectors by the full 4x4 matrix, column by column,
+  // measured slower than Eigen's own affine kernel on three lanes, so the
+  // product is done unpadded and only the result is padded.
+  return {oxatrace::ray::padded{},
+          pad(tr * ray.origin()), pad(tr.linear() * ray.direction())};
+}
 
-Eigen::Vector3d
-oxatrace::point_at(ray const& r, double t) {
+vector3
+oxatrace::point_at(ray const& r, real t) {
   assert(t >= 0.0);
-  return r.origin() + t * r.direction();
+  return (r.origin4() + t * r.direction4()).head<3>();
 }
 
-ray_point::ray_point(oxatrace::ray const& ray, double param)
+ray_point::ray_point(oxatrace::ray const& ray, real param)
   : ray_{ray}
   , param_{param}
 {
   assert(param >= 0.0);
 }
 
-Eigen::Vector3d
+vector3
 ray_point::point() const {
   if (!point_)
     point_ = point_at(ray_, param_);
   return *point_;
 }
 
-oxatrace::rectangle::rectangle(double x, double y, double width, double height)
+oxatrace::rectangle::rectangle(real x, real y, real width, real height)
   : x_{x}
   , y_{y}
   , width_{width}
@@ -120,19 +136,19 @@ oxatrace::rectangle::rectangle(double x, double y, double width, double height)
 }
 
 void
-oxatrace::rectangle::width(double new_width) {
+oxatrace::rectangle::width(real new_width) {
   assert(new_width > 0.0);
   width_ = new_width;
 }
 
 void
-oxatrace::rectangle::height(double new_height) {
+oxatrace::rectangle::height(real new_height) {
   assert(new_height > 0.0);
   height_ = new_height;
 }
 
 oxatrace::rectangle
-oxatrace::rect_from_center(vector2 center, double width, double height) {
+oxatrace::rect_from_center(vector2 center, real width, real height) {
   return {
     center[0] - width / 2, center[1] - height / 2,
     width, height
@@ -1,6 +1,8 @@
 #ifndef OXATRACE_MATH_HPP
 #define OXATRACE_MATH_HPP
 
+#include "scalar.hpp"
+
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 
@@ -17,8 +19,15 @@ namespace oxatrace {
 using random_eng = std::default_random_engine;
 
 constexpr double PI{3.141592};
-constexpr double EPSILON{1e-8};  // Minimal difference between numbers before
-                                 // they are considered equal.
+
+// Minimal difference between numbers before they are considered equal. This
+// is also the minimal distance a ray has to travel before it may hit
+// anything, so it needs to be well above the precision of real.
+#ifdef OXATRACE_SINGLE_PRECISION
+constexpr real EPSILON{1e-4f};
+#else
+constexpr real EPSILON{1e-8};
+#endif
 
 // Compare doubles for near-equality.
 // Returns true iff the two numbers differ by less than EPSILON.
@@ -39,6 +48,10 @@ template <typename Integer>
 Integer
 round(double d) noexcept { return static_cast<Integer>(d + 0.5); }
 
+// How to evaluate transcendental functions: Either exactly, through the
+// standard library, or using the cheaper approximations from fast_math.hpp.
+enum class math_mode { exact, fast };
+
 inline bool
 is_power2(unsigned n) {
   return n > 0 && (n & (n - 1)) == 0;
@@ -88,8 +101,18 @@ private:
   MatrixT vector_;
 };
 
-using vector3 = Eigen::Vector3d;
-using vector2 = Eigen::Vector2d;
+using vector3    = Eigen::Matrix<real, 3, 1>;
+using vector2    = Eigen::Matrix<real, 2, 1>;
+using affine3    = Eigen::Transform<real, 3, Eigen::Affine>;
+using angle_axis = Eigen::AngleAxis<real>;
+
+// 3D vector padded to four lanes. The fourth lane is kept at zero, so dot
+// products and norms may be taken over all four lanes; the padding only
+// serves to let Eigen use whole SIMD registers.
+using vector4    = Eigen::Matrix<real, 4, 1>;
+
+inline vector4
+pad(vector3 const& v) noexcept { return {v.x(), v.y(), v.z(), real(0)}; }
 using unit3   = unit<vector3>;
 using unit2   = unit<vector2>;
 
@@ -136,29 +159,51 @@ reflect(unit3 const& v, unit3 const& normal);
 //             n + 1
 // PDF: p(t) = ----- * cos(t)^n = probability that angle(result, v) = t.
 //              2pi
+//
+// The randomness is given by u, which must be in [0, 1)^2. For uniformly
+// distributed u, the result is distributed according to the PDF above.
 unit3
-cos_lobe_perturb(unit3 const& v, unsigned n, random_eng& prng);
+cos_lobe_perturb(unit3 const& v, unsigned n, vector2 const& u,
+                 math_mode mode = math_mode::exact);
 
 // A ray is defined by its origin and direction; it is immutable.
 //
 // Direction isn't required to be a unit vector in order to allow for
 // transformations of rays: A point on ray -- as given by point_at -- depends on
 // the length of the direction vector.
+//
+// Internally, both vectors are stored padded; the padded forms are available
+// for code that wants to operate on them directly.
 class ray {
 public:
+  struct padded { };
+
   ray(vector3 const& origin, vector3 const& dir)
+    : origin_{pad(origin)}
+    , direction_{pad(dir)} { }
+
+  // The fourth lanes of origin and dir must be zero.
+  ray(padded, vector4 const& origin, vector4 const& dir)
     : origin_{origin}
-    , direction_{dir} { }
+    , direction_{dir} {
+    assert(origin[3] == 0 && dir[3] == 0);
+  }
 
   vector3
-  origin() const noexcept       { return origin_; }
+  origin() const noexcept       { return origin_.head<3>(); }
 
   vector3
-  direction() const noexcept    { return direction_; }
+  direction() const noexcept    { return direction_.head<3>(); }
+
+  vector4 const&
+  origin4() const noexcept      { return origin_; }
+
+  vector4 const&
+  direction4() const noexcept   { return direction_; }
 
 private:
-  vector3 origin_;
-  vector3 direction_;
+  vector4 origin_;
+  vector4 direction_;
 };
 
 std::ostream&
@@ -166,13 +211,13 @@ operator << (std::ostream& out, ray const& ray);
 
 // Transform a ray by an affine matrix.
 oxatrace::ray
-transform(ray const& ray, Eigen::Affine3d const& tr);
+transform(ray const& ray, affine3 const& tr);
 
 // Get a point on ray.
 //
 // t must be non-negative.
 vector3
-point_at(ray const& r, double t);
+point_at(ray const& r, real t);
 
 // Lazily evaluated point on ray.
 //
@@ -181,12 +226,12 @@ point_at(ray const& r, double t);
 class ray_point {
 public:
   // param must be non-negative.
-  ray_point(oxatrace::ray const& ray, double param);
+  ray_point(oxatrace::ray const& ray, real param);
 
   oxatrace::ray
   ray() const noexcept      { return ray_; }
 
-  double
+  real
   param() const noexcept    { return param_; }
 
   // Compute the point on ray or fetch the cached one.
@@ -195,7 +240,7 @@ public:
 
 private:
   oxatrace::ray ray_;
-  double        param_;
+  real          param_;
   mutable boost::optional<vector3> point_;
 };
 
@@ -207,30 +252,30 @@ public:
   rectangle() { }
 
   // width and height must be positive.
-  rectangle(double x, double y, double width, double height);
+  rectangle(real x, real y, real width, real height);
 
-  double x() const noexcept { return x_; }
-  double y() const noexcept { return y_; }
-  void   x(double new_x) { x_ = new_x; }
-  void   y(double new_y) { y_ = new_y; }
+  real x() const noexcept { return x_; }
+  real y() const noexcept { return y_; }
+  void x(real new_x) { x_ = new_x; }
+  void y(real new_y) { y_ = new_y; }
 
   vector2 top_left() const noexcept { return {x(), y()}; }
 
-  double width() const noexcept  { return width_; }
-  double height() const noexcept { return height_; }
+  real width() const noexcept  { return width_; }
+  real height() const noexcept { return height_; }
 
-  void   width(double new_width);
-  void   height(double new_height);
+  void width(real new_width);
+  void height(real new_height);
 
 private:
-  double x_, y_;           // Coordinates of the top-left corner.
-  double width_, height_;  // Dimensions of the rectangle.
+  real x_, y_;           // Coordinates of the top-left corner.
+  real width_, height_;  // Dimensions of the rectangle.
 };
 
 // Construct a rectangle given coordinates of its centre point and its
 // dimensions.
 rectangle
-rect_from_center(vector2 center, double width, double height);
+rect_from_center(vector2 center, real width, real height);
 
 // Get the point in the centre of a rectangle.
 vector2
@@ -0,0 +1,47 @@
+#include "memory.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+
+#include <sys/mman.h>
+
+using namespace oxatrace;
+
+static std::atomic<bool> huge_pages_enabled{false};
+
+void
+oxatrace::set_huge_pages(bool enabled) noexcept {
+  huge_pages_enabled = enabled;
+}
+
+bool
+oxatrace::huge_pages() noexcept {
+  return huge_pages_enabled;
+}
+
+void*
+oxatrace::allocate_buffer(std::size_t bytes) {
+  constexpr std::size_t CACHE_LINE = 64;
+
+  bool const huge = huge_pages_enabled && bytes >= HUGE_PAGE_SIZE;
+  std::size_t const alignment = huge ? HUGE_PAGE_SIZE : CACHE_LINE;
+
+  // Rounded up, so that the last huge page isn't shared with anything else.
+  std::size_t const size =
+    (std::max<std::size_t>(bytes, 1) + alignment - 1) / alignment * alignment;
+  void* result;
+  if (posix_memalign(&result, alignment, size) != 0)
+    throw std::bad_alloc{};
+
+  // Only a hint: It fails harmlessly if the kernel has huge pages disabled.
+  if (huge)
+    madvise(result, size, MADV_HUGEPAGE);
+
+  return result;
+}
+
+void
+oxatrace::free_buffer(void* buffer) noexcept {
+  std::free(buffer);
+}
@@ -0,0 +1,69 @@
+#ifndef OXATRACE_MEMORY_HPP
+#define OXATRACE_MEMORY_HPP
+
+#include <cstddef>
+#include <new>
+
+namespace oxatrace {
+
+// Size of a transparent huge page on x86-64.
+constexpr std::size_t HUGE_PAGE_SIZE = std::size_t{2} << 20;
+
+// Whether large buffers allocated from now on should be backed by transparent
+// huge pages. Off by default. Framebuffers of a few megabytes then need a
+// handful of TLB entries instead of a thousand, which matters when every
+// thread writes rows far apart from each other's.
+void
+set_huge_pages(bool enabled) noexcept;
+
+bool
+huge_pages() noexcept;
+
+// Allocate bytes aligned to a cache line, or to a huge page if huge pages are
+// enabled and the buffer is at least one huge page large; the kernel is then
+// asked to back it with huge pages. Memory must be released through
+// free_buffer.
+//
+// Throws std::bad_alloc: Out of memory.
+void*
+allocate_buffer(std::size_t bytes);
+
+void
+free_buffer(void* buffer) noexcept;
+
+// Allocator for the pixels of images, going through allocate_buffer.
+template <typename T>
+struct buffer_allocator {
+  using value_type = T;
+
+  buffer_allocator() = default;
+
+  template <typename U>
+  buffer_allocator(buffer_allocator<U> const&) noexcept { }
+
+  T*
+  allocate(std::size_t n) {
+    if (n > std::size_t(-1) / sizeof(T))
+      throw std::bad_alloc{};
+    return static_cast<T*>(allocate_buffer(n * sizeof(T)));
+  }
+
+  void
+  deallocate(T* p, std::size_t) noexcept { free_buffer(p); }
+};
+
+template <typename T, typename U>
+bool
+operator == (buffer_allocator<T> const&, buffer_allocator<U> const&) noexcept {
+  return true;
+}
+
+template <typename T, typename U>
+bool
+operator != (buffer_allocator<T> const&, buffer_allocator<U> const&) noexcept {
+  return false;
+}
+
+}  // namespace oxatrace
+
+#endif
@@ -0,0 +1,178 @@
+#include "mipmap.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace oxatrace;
+
+static char const* const MAGIC = "OXATRACE-MIPMAP 1";
+
+static std::uint64_t
+tiles_across(std::uint64_t pixels, std::size_t tile_side) {
+  return (pixels + tile_side - 1) / tile_side;
+}
+
+// The level after image: half its size, rounded up, each pixel the mean of
+// 2 x 2 pixels of image, wrapping around.
+static hdr_image
+next_level(hdr_image const& image) {
+  std::size_t const width = image.width();
+  std::size_t const height = image.height();
+  hdr_image result{(width + 1) / 2, (height + 1) / 2};
+  for (std::size_t y = 0; y < result.height(); ++y)
+    for (std::size_t x = 0; x < result.width(); ++x) {
+      std::size_t const x0 = 2 * x % width, x1 = (2 * x + 1) % width;
+      std::size_t const y0 = 2 * y % height, y1 = (2 * y + 1) % height;
+      result.pixel_at(x, y) =
+        (image.pixel_at(x0, y0) + image.pixel_at(x1, y0)
+         + image.pixel_at(x0, y1) + image.pixel_at(x1, y1)) * real(0.25);
+    }
+  return result;
+}
+
+void
+oxatrace::save_mipmap(hdr_image const& image, std::string const& filename,
+                      std::size_t tile_side, pixel_format format) {
+  if (tile_side == 0)
+    throw std::invalid_argument{"save_mipmap: Tile side is 0"};
+
+  unsigned levels = 1;
+  for (std::size_t w = image.width(), h = image.height(); w > 1 || h > 1;
+       w = (w + 1) / 2, h = (h + 1) / 2)
+    ++levels;
+
+  std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+  out.exceptions(std::ios::badbit | std::ios::failbit);
+
+  std::ostringstream header;
+  header << MAGIC << '\n'
+         << image.width() << ' ' << image.height() << ' ' << levels << ' '
+         << tile_side << ' ' << pixel_format_name(format) << '\n';
+  std::string text = header.str();
+  assert(text.size() <= MIPMAP_HEADER_BYTES);
+  text.resize(MIPMAP_HEADER_BYTES, '\0');
+  out.write(text.data(), text.size());
+
+  hdr_image tile{tile_side, tile_side};
+  std::vector<unsigned char> packed(tile.size() * pixel_bytes(format));
+  hdr_image level = image;
+  for (unsigned l = 0; l < levels; ++l) {
+    if (l > 0)
+      level = next_level(level);
+
+    for (std::size_t ty = 0; ty < tiles_across(level.height(), tile_side);
+         ++ty)
+      for (std::size_t tx = 0; tx < tiles_across(level.width(), tile_side);
+           ++tx) {
+        std::fill(tile.begin(), tile.end(), hdr_color{0.0, 0.0, 0.0});
+        std::size_t const x0 = tx * tile_side, y0 = ty * tile_side;
+        std::size_t const width = std::min(tile_side, level.width() - x0);
+        std::size_t const height = std::min(tile_side, level.height() - y0);
+        for (std::size_t y = 0; y < height; ++y)
+          std::copy(&level.pixel_at(x0, y0 + y),
+                    &level.pixel_at(x0, y0 + y) + width,
+                    &tile.pixel_at(0, y));
+
+        pack_pixels(format, tile.data(), tile.size(), packed.data());
+        out.write(reinterpret_cast<char const*>(packed.data()),
+                  packed.size());
+      }
+  }
+}
+
+mipmap_file::mipmap_file(std::string const& filename) {
+  fd_ = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0)
+    throw std::system_error{errno, std::generic_category(),
+                            "mipmap_file: Can't open " + filename};
+
+  try {
+    std::string text(MIPMAP_HEADER_BYTES, '\0');
+    ssize_t const got = pread(fd_, &text[0], text.size(), 0);
+    if (got < 0)
+      throw std::system_error{errno, std::generic_category(),
+                              "mipmap_file: Can't read " + filename};
+    text.resize(got);
+
+    std::istringstream header{text};
+    std::string magic, format_name;
+    std::uint64_t width, height;
+    unsigned levels;
+    if (!std::getline(header, magic) || magic != MAGIC)
+      throw std::runtime_error{"mipmap_file: Not a mipmap: " + filename};
+    if (!(header >> width >> height >> levels >> tile_side_ >> format_name)
+        || width == 0 || height == 0 || tile_side_ == 0
+        || tile_side_ > (1 << 16) || levels == 0 || levels > 64)
+      throw std::runtime_error{"mipmap_file: Malformed mipmap " + filename};
+    format_ = parse_pixel_format(format_name);
+
+    std::uint64_t tiles = 0;
+    for (unsigned l = 0; l < levels; ++l) {
+      std::uint64_t const columns = tiles_across(width, tile_side_);
+      levels_.push_back({width, height, columns, tiles});
+      tiles += columns * tiles_across(height, tile_side_);
+      width = (width + 1) / 2;
+      height = (height + 1) / 2;
+    }
+
+    struct stat status;
+    if (fstat(fd_, &status) != 0)
+      throw std::system_error{errno, std::generic_category(),
+                              "mipmap_file: Can't stat " + filename};
+    if (tiles > (std::numeric_limits<std::uint64_t>::max()
+                 - MIPMAP_HEADER_BYTES) / tile_bytes()
+        || std::uint64_t(status.st_size)
+           < MIPMAP_HEADER_BYTES + tiles * tile_bytes())
+      throw std::runtime_error{"mipmap_file: Truncated mipmap " + filename};
+  } catch (...) {
+    close(fd_);
+    throw;
+  }
+}
+
+mipmap_file::~mipmap_file() {
+  close(fd_);
+}
+
+std::size_t
+mipmap_file::tile_bytes() const noexcept {
+  return tile_side_ * tile_side_ * pixel_bytes(format_);
+}
+
+std::uint64_t
+mipmap_file::tile_at(unsigned level, std::uint64_t x, std::uint64_t y) const {
+  struct level const& l = levels_.at(level);
+  assert(x < l.width && y < l.height);
+  return l.first_tile + y / tile_side_ * l.columns + x / tile_side_;
+}
+
+void
+mipmap_file::read_tile(std::uint64_t index, hdr_color* pixels) const {
+  std::vector<unsigned char> packed(tile_bytes());
+  std::uint64_t const offset = MIPMAP_HEADER_BYTES + index * tile_bytes();
+  std::size_t done = 0;
+  while (done < packed.size()) {
+    ssize_t const got = pread(fd_, packed.data() + done, packed.size() - done,
+                              offset + done);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got < 0)
+      throw std::system_error{errno, std::generic_category(),
+                              "mipmap_file::read_tile"};
+    if (got == 0)
+      throw std::runtime_error{"mipmap_file::read_tile: Truncated mipmap"};
+    done += got;
+  }
+
+  unpack_pixels(format_, packed.data(), tile_side_ * tile_side_, pixels);
+}
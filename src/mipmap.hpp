@@ -0,0 +1,98 @@
+#ifndef OXATRACE_MIPMAP_HPP
+#define OXATRACE_MIPMAP_HPP
+
+#include "image.hpp"
+#include "pixel_format.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace oxatrace {
+
+// Save image along with all its mip levels into a file, for image_texture to
+// read a tile at a time rather than load whole: a text header
+//
+//   OXATRACE-MIPMAP 1
+//   <width> <height> <levels> <tile side> <pixel format>
+//
+// padded with zeros to MIPMAP_HEADER_BYTES, followed by the tiles of level 0,
+// then of level 1 and so on. Level 0 is the image, and each level after it is
+// half the size of the one before, rounded up, down to 1 x 1, each pixel being
+// the mean of 2 x 2 pixels of the level before, which wrap around at the
+// edges. The tiles of a level are stored in row-major order, each one tile
+// side x tile side pixels in the pixel format, row by row; pixels of edge
+// tiles beyond the level are 0.
+//
+// Throws std::ios_base::failure: I/O error.
+//        std::invalid_argument: tile_side is 0.
+void
+save_mipmap(hdr_image const& image, std::string const& filename,
+            std::size_t tile_side = 64,
+            pixel_format format = pixel_format::half);
+
+constexpr std::size_t MIPMAP_HEADER_BYTES = 4096;
+
+// A file saved by save_mipmap, whose tiles are read one at a time. Only the
+// header is kept in memory.
+class mipmap_file {
+public:
+  // Throws std::system_error: Can't open the file.
+  //        std::runtime_error: Not a mipmap file, or a truncated one.
+  explicit
+  mipmap_file(std::string const& filename);
+
+  mipmap_file(mipmap_file const&) = delete;
+  mipmap_file& operator = (mipmap_file const&) = delete;
+
+  ~mipmap_file();
+
+  unsigned
+  levels() const noexcept { return levels_.size(); }
+
+  std::uint64_t
+  width(unsigned level = 0) const { return levels_.at(level).width; }
+
+  std::uint64_t
+  height(unsigned level = 0) const { return levels_.at(level).height; }
+
+  std::size_t
+  tile_side() const noexcept { return tile_side_; }
+
+  pixel_format
+  format() const noexcept { return format_; }
+
+  // Bytes of a tile in the file.
+  std::size_t
+  tile_bytes() const noexcept;
+
+  // Index, among the tiles of all levels, of the tile holding pixel (x, y) of
+  // a level.
+  std::uint64_t
+  tile_at(unsigned level, std::uint64_t x, std::uint64_t y) const;
+
+  // Read tile number index into pixels, which must have room for tile_side()
+  // squared pixels. Thread-safe.
+  //
+  // Throws std::system_error: I/O error.
+  //        std::runtime_error: The file is shorter than its header says.
+  void
+  read_tile(std::uint64_t index, hdr_color* pixels) const;
+
+private:
+  struct level {
+    std::uint64_t width, height;
+    std::uint64_t columns;     // Of tiles.
+    std::uint64_t first_tile;  // Index of its first tile.
+  };
+
+  std::vector<level> levels_;
+  std::size_t        tile_side_;
+  pixel_format       format_;
+  int                fd_;
+};
+
+}  // namespace oxatrace
+
+#endif
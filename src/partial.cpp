@@ -0,0 +1,127 @@
+#include "partial.hpp"
+
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+using namespace oxatrace;
+
+static char const* const MAGIC = "OXATRACE-PARTIAL 1";
+
+// Does an image of width x height pixels at crop lie within a frame small
+// enough to merge? Checked without overflow, as crop may come from a file.
+static bool
+fits(film_crop const& crop, std::size_t width, std::size_t height) {
+  // Merging takes three channels and a weight as doubles per frame pixel.
+  std::size_t const max = std::numeric_limits<std::size_t>::max();
+  return crop.frame_width > 0 && crop.frame_height > 0
+    && crop.frame_width <= max / crop.frame_height / 32
+    && crop.x <= crop.frame_width && width <= crop.frame_width - crop.x
+    && crop.y <= crop.frame_height && height <= crop.frame_height - crop.y;
+}
+
+void
+oxatrace::save_partial(partial_image const& partial,
+                       std::string const& filename) {
+  std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+  out.exceptions(std::ios::badbit | std::ios::failbit);
+
+  out << MAGIC << '\n'
+      << partial.crop.frame_width << ' ' << partial.crop.frame_height << ' '
+      << partial.crop.x << ' ' << partial.crop.y << ' '
+      << partial.image.width() << ' ' << partial.image.height() << '\n';
+
+  std::vector<double> channels;
+  channels.reserve(partial.image.size() * hdr_color::CHANNELS);
+  for (hdr_color const& pixel : partial.image)
+    channels.insert(channels.end(), pixel.begin(), pixel.end());
+  out.write(reinterpret_cast<char const*>(channels.data()),
+            channels.size() * sizeof(double));
+  out.write(reinterpret_cast<char const*>(partial.weights.data()),
+            partial.weights.size() * sizeof(std::uint32_t));
+}
+
+partial_image
+oxatrace::load_partial(std::string const& filename) {
+  std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+  in.exceptions(std::ios::badbit);
+  if (!in)
+    throw std::ios_base::failure{"load_partial: Can't open " + filename};
+
+  auto malformed = [&] {
+    return std::runtime_error{"load_partial: Malformed partial " + filename};
+  };
+
+  std::string magic;
+  film_crop crop;
+  std::size_t width, height;
+  if (!std::getline(in, magic) || magic != MAGIC)
+    throw std::runtime_error{"load_partial: Not a partial: " + filename};
+  if (!(in >> crop.frame_width >> crop.frame_height >> crop.x >> crop.y
+           >> width >> height)
+      || in.get() != '\n' || width == 0 || height == 0
+      || !fits(crop, width, height))
+    throw malformed();
+
+  partial_image result{crop, {width, height}, {width, height}};
+
+  std::vector<double> channels(width * height * hdr_color::CHANNELS);
+  in.read(reinterpret_cast<char*>(channels.data()),
+          channels.size() * sizeof(double));
+  in.read(reinterpret_cast<char*>(result.weights.data()),
+          result.weights.size() * sizeof(std::uint32_t));
+  if (!in || in.peek() != std::ifstream::traits_type::eof())
+    throw malformed();
+
+  auto channel = channels.begin();
+  for (hdr_color& pixel : result.image)
+    for (real& c : pixel)
+      c = real(*channel++);
+
+  return result;
+}
+
+hdr_image
+oxatrace::merge_partials(std::vector<partial_image> const& partials) {
+  if (partials.empty())
+    throw std::invalid_argument{"merge_partials: Nothing to merge"};
+
+  std::size_t const width = partials.front().crop.frame_width;
+  std::size_t const height = partials.front().crop.frame_height;
+  for (partial_image const& p : partials) {
+    if (p.crop.frame_width != width || p.crop.frame_height != height)
+      throw std::invalid_argument{"merge_partials: Frames differ in size"};
+    if (!fits(p.crop, p.image.width(), p.image.height())
+        || p.weights.width() != p.image.width()
+        || p.weights.height() != p.image.height())
+      throw std::invalid_argument{"merge_partials: Partial outside its frame"};
+  }
+
+  // Weighted sums, in double precision whatever the precision of hdr_color.
+  std::vector<double> sums(width * height * hdr_color::CHANNELS, 0.0);
+  std::vector<double> weights(width * height, 0.0);
+
+  for (partial_image const& p : partials)
+    for (std::size_t y = 0; y < p.image.height(); ++y)
+      for (std::size_t x = 0; x < p.image.width(); ++x) {
+        std::size_t const i = (y + p.crop.y) * width + x + p.crop.x;
+        double const w = p.weights.pixel_at(x, y);
+        hdr_color const& pixel = p.image.pixel_at(x, y);
+        for (std::size_t c = 0; c < hdr_color::CHANNELS; ++c)
+          sums[i * hdr_color::CHANNELS + c] += w * pixel[c];
+        weights[i] += w;
+      }
+
+  hdr_image result{width, height};
+  auto sum = sums.begin();
+  auto weight = weights.begin();
+  for (hdr_color& pixel : result) {
+    if (*weight == 0.0)
+      throw std::invalid_argument{"merge_partials: Pixels left uncovered"};
+    for (real& c : pixel)
+      c = real(*sum++ / *weight);
+    ++weight;
+  }
+
+  return result;
+}
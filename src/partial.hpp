@@ -0,0 +1,54 @@
+#ifndef OXATRACE_PARTIAL_HPP
+#define OXATRACE_PARTIAL_HPP
+
+#include "image.hpp"
+#include "renderer.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace oxatrace {
+
+// Part of a frame rendered by one shard, before tone mapping.
+//
+// A frame may be sharded by region, each shard rendering a crop of it, and by
+// samples, each shard rendering it with a different seed. The merged frame is
+// then the weighted mean of all shards' pixels, each weighted by the number of
+// samples behind it.
+struct partial_image {
+  film_crop                  crop;     // Where the image lies in the frame.
+  hdr_image                  image;    // Mean of each pixel's samples.
+  basic_image<std::uint32_t> weights;  // Number of samples of each pixel.
+};
+
+// Save a partial into a raw binary file: a text header
+//
+//   OXATRACE-PARTIAL 1
+//   <frame width> <frame height> <x> <y> <width> <height>
+//
+// followed by the red, green and blue channels of each pixel as doubles, then
+// the weight of each pixel as a 32-bit unsigned integer, all in the byte order
+// of this machine.
+//
+// Throws std::ios_base::failure: I/O error.
+void
+save_partial(partial_image const& partial, std::string const& filename);
+
+// Throws std::ios_base::failure: I/O error.
+//        std::runtime_error: Not a partial, or a malformed one.
+partial_image
+load_partial(std::string const& filename);
+
+// Combine the partials of one frame into the whole of it.
+//
+// Throws std::invalid_argument: No partials, partials of frames of different
+//                               sizes, a partial not within its frame or
+//                               with weights of another size, or some pixel
+//                               of the frame isn't in any of them.
+hdr_image
+merge_partials(std::vector<partial_image> const& partials);
+
+}  // namespace oxatrace
+
+#endif
@@ -0,0 +1,137 @@
+#include "pfm.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace oxatrace;
+
+// Bytes of the floats of one pixel.
+static constexpr std::size_t PIXEL_BYTES = 3 * sizeof(float);
+
+static bool
+little_endian() {
+  std::uint16_t const one = 1;
+  unsigned char first;
+  std::memcpy(&first, &one, 1);
+  return first == 1;
+}
+
+void
+oxatrace::save_pfm(hdr_image const& image, std::string const& filename) {
+  std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+  out.exceptions(std::ios::badbit | std::ios::failbit);
+
+  out << "PF\n" << image.width() << ' ' << image.height() << '\n'
+      << (little_endian() ? "-1.0" : "1.0") << '\n';
+
+  std::vector<float> row(image.width() * hdr_color::CHANNELS);
+  for (std::size_t y = image.height(); y-- > 0; ) {
+    auto channel = row.begin();
+    for (std::size_t x = 0; x < image.width(); ++x)
+      for (real c : image.pixel_at(x, y))
+        *channel++ = float(c);
+    out.write(reinterpret_cast<char const*>(row.data()),
+              row.size() * sizeof(float));
+  }
+}
+
+mapped_pfm::mapped_pfm(std::string const& filename) {
+  int const fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw std::system_error{errno, std::generic_category(),
+                            "mapped_pfm: Can't open " + filename};
+
+  struct stat status;
+  void* mapping = MAP_FAILED;
+  int error = 0;
+  if (fstat(fd, &status) != 0)
+    error = errno;
+  else if (status.st_size == 0)
+    error = EINVAL;
+  else if ((mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE,
+                           fd, 0)) == MAP_FAILED)
+    error = errno;
+  close(fd);
+  if (mapping == MAP_FAILED)
+    throw std::system_error{error, std::generic_category(),
+                            "mapped_pfm: Can't map " + filename};
+  mapping_ = mapping;
+  mapping_bytes_ = status.st_size;
+
+  try {
+    // The header is short; whatever follows it is only looked at by tellg.
+    char const* const bytes = static_cast<char const*>(mapping_);
+    std::istringstream header{
+      std::string(bytes, std::min<std::size_t>(mapping_bytes_, 256))
+    };
+    std::string magic;
+    double scale;
+    if (!(header >> magic) || magic != "PF")
+      throw std::runtime_error{"mapped_pfm: Not a colour PFM: " + filename};
+    if (!(header >> width_ >> height_ >> scale)
+        || !std::isspace(header.get()) || width_ == 0 || height_ == 0
+        || scale == 0.0
+        || width_ > std::numeric_limits<std::uint64_t>::max() / height_
+                    / PIXEL_BYTES)
+      throw std::runtime_error{"mapped_pfm: Malformed PFM " + filename};
+
+    std::size_t const start = header.tellg();
+    if (mapping_bytes_ - start != size() * PIXEL_BYTES)
+      throw std::runtime_error{"mapped_pfm: Truncated PFM " + filename};
+
+    swap_bytes_ = (scale < 0.0) != little_endian();
+    data_ = static_cast<unsigned char const*>(mapping_) + start;
+  } catch (...) {
+    munmap(mapping_, mapping_bytes_);
+    throw;
+  }
+
+  madvise(mapping_, mapping_bytes_, MADV_SEQUENTIAL);
+}
+
+mapped_pfm::~mapped_pfm() {
+  munmap(mapping_, mapping_bytes_);
+}
+
+void
+mapped_pfm::read(std::uint64_t first, std::size_t count,
+                 hdr_color* pixels) const {
+  assert(first + count <= size());
+
+  while (count > 0) {
+    std::uint64_t const y = first / width_;
+    std::uint64_t const x = first % width_;
+    std::size_t const run = std::min<std::uint64_t>(count, width_ - x);
+    unsigned char const* in =
+      data_ + ((height_ - 1 - y) * width_ + x) * PIXEL_BYTES;
+
+    for (std::size_t i = 0; i < run; ++i) {
+      float channels[3];
+      unsigned char raw[PIXEL_BYTES];
+      std::memcpy(raw, in + i * PIXEL_BYTES, PIXEL_BYTES);
+      if (swap_bytes_)
+        for (unsigned char* c = raw; c != raw + PIXEL_BYTES; c += sizeof(float))
+          std::reverse(c, c + sizeof(float));
+      std::memcpy(channels, raw, PIXEL_BYTES);
+      pixels[i] = {channels[0], channels[1], channels[2]};
+    }
+
+    first += run;
+    count -= run;
+    pixels += run;
+  }
+}
@@ -0,0 +1,61 @@
+#ifndef OXATRACE_PFM_HPP
+#define OXATRACE_PFM_HPP
+
+#include "image.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace oxatrace {
+
+// Save an HDR image into a colour PFM file: the text header
+//
+//   PF
+//   <width> <height>
+//   <scale>
+//
+// followed by the red, green and blue channels of each pixel as
+// single-precision floats, a row at a time from the bottom row up. The scale is
+// -1 on little-endian machines and 1 on big-endian ones, which is how PFM tells
+// the byte order of the floats.
+//
+// Throws std::ios_base::failure: I/O error.
+void
+save_pfm(hdr_image const& image, std::string const& filename);
+
+// A colour PFM file mapped into memory, to be read a few pixels at a time
+// rather than loaded whole. Floats of either byte order are read.
+class mapped_pfm {
+public:
+  // Throws std::system_error: Can't open or map the file.
+  //        std::runtime_error: Not a colour PFM, or a truncated one.
+  explicit
+  mapped_pfm(std::string const& filename);
+
+  mapped_pfm(mapped_pfm const&) = delete;
+  mapped_pfm& operator = (mapped_pfm const&) = delete;
+
+  ~mapped_pfm();
+
+  std::uint64_t width() const noexcept  { return width_; }
+  std::uint64_t height() const noexcept { return height_; }
+  std::uint64_t size() const noexcept   { return width_ * height_; }
+
+  // Read count pixels, from pixel first on in row-major order from the top
+  // row, into pixels. Thread-safe.
+  void
+  read(std::uint64_t first, std::size_t count, hdr_color* pixels) const;
+
+private:
+  std::uint64_t        width_;
+  std::uint64_t        height_;
+  bool                 swap_bytes_;  // The floats are of the other order.
+  unsigned char const* data_;        // The bottom row.
+  void*                mapping_;
+  std::size_t          mapping_bytes_;
+};
+
+}  // namespace oxatrace
+
+#endif
@@ -0,0 +1,209 @@
+#include "pixel_format.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+using namespace oxatrace;
+
+// Round f to the nearest half, ties to even.
+static std::uint16_t
+half_from_float(float f) {
+  std::uint32_t x = bit_cast<std::uint32_t>(f);
+  std::uint32_t const sign = (x >> 16) & 0x8000;
+  x &= 0x7fffffff;
+
+  if (x >= 0x7f800000)  // Infinity stays so, NaN stays quiet NaN.
+    return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);
+  if (x >= 0x477ff000)  // 65520, which rounds to infinity.
+    return sign | 0x7c00;
+
+  if (x < 0x38800000) {
+    // Subnormal, below 2^-14. Adding 0.5 brings the half's last bit, 2^-24,
+    // to the float's, so that the FPU does the rounding.
+    float const shifted = bit_cast<float>(x) + 0.5f;
+    return sign
+      | (bit_cast<std::uint32_t>(shifted) - bit_cast<std::uint32_t>(0.5f));
+  }
+
+  // Rebias the exponent from 127 to 15 and round the 13 bits dropped from the
+  // mantissa.
+  std::uint32_t const odd = (x >> 13) & 1;
+  x += (std::uint32_t(15 - 127) << 23) + 0xfff + odd;
+  return sign | (x >> 13);
+}
+
+static float
+float_from_half(std::uint16_t h) {
+  std::uint32_t const sign = std::uint32_t(h & 0x8000) << 16;
+  std::uint32_t const exponent = (h >> 10) & 0x1f;
+  std::uint32_t const mantissa = h & 0x3ff;
+
+  if (exponent == 0) {
+    float const magnitude = std::ldexp(float(mantissa), -24);
+    return sign ? -magnitude : magnitude;
+  }
+  if (exponent == 0x1f)
+    return bit_cast<float>(sign | 0x7f800000 | (mantissa << 13));
+  return bit_cast<float>(sign | ((exponent + 127 - 15) << 23)
+                         | (mantissa << 13));
+}
+
+namespace {
+
+// Parameters of RGB9E5.
+constexpr int MANTISSA_BITS = 9;
+constexpr int EXPONENT_BIAS = 15;
+constexpr int MAX_EXPONENT = 31;
+constexpr double MAX_CHANNEL =
+  double((1 << MANTISSA_BITS) - 1) / (1 << MANTISSA_BITS)
+  * double(1 << (MAX_EXPONENT - EXPONENT_BIAS));
+
+}  // anonymous namespace
+
+static std::uint32_t
+rgb9e5_from_color(hdr_color const& color) {
+  double channels[3];
+  for (std::size_t c = 0; c < 3; ++c)
+    // Written so that NaN becomes 0.
+    channels[c] =
+      color[c] > 0 ? std::min(double(color[c]), MAX_CHANNEL) : 0.0;
+  double const brightest = std::max({channels[0], channels[1], channels[2]});
+
+  // The shared exponent makes the brightest channel's mantissa at least 2^8,
+  // unless it is too dim for that.
+  int exponent = 0;
+  if (brightest > 0) {
+    int e;
+    std::frexp(brightest, &e);
+    exponent = std::max(0, e + EXPONENT_BIAS);
+  }
+  double step = std::ldexp(1.0, exponent - EXPONENT_BIAS - MANTISSA_BITS);
+  if (std::floor(brightest / step + 0.5) >= (1 << MANTISSA_BITS)) {
+    ++exponent;
+    step *= 2;
+  }
+
+  std::uint32_t result = std::uint32_t(exponent) << (3 * MANTISSA_BITS);
+  for (std::size_t c = 0; c < 3; ++c)
+    result |= std::uint32_t(std::floor(channels[c] / step + 0.5))
+              << (c * MANTISSA_BITS);
+  return result;
+}
+
+static hdr_color
+color_from_rgb9e5(std::uint32_t x) {
+  int const exponent = x >> (3 * MANTISSA_BITS);
+  double const step =
+    std::ldexp(1.0, exponent - EXPONENT_BIAS - MANTISSA_BITS);
+  std::uint32_t const mask = (1 << MANTISSA_BITS) - 1;
+  return {real(step * (x & mask)),
+          real(step * ((x >> MANTISSA_BITS) & mask)),
+          real(step * ((x >> (2 * MANTISSA_BITS)) & mask))};
+}
+
+std::string
+oxatrace::pixel_format_name(pixel_format format) {
+  switch (format) {
+  case pixel_format::native:  return "native";
+  case pixel_format::float32: return "float";
+  case pixel_format::half:    return "half";
+  case pixel_format::rgb9e5:  return "rgb9e5";
+  }
+
+  return "unknown";
+}
+
+pixel_format
+oxatrace::parse_pixel_format(std::string const& name) {
+  for (pixel_format f : {pixel_format::native, pixel_format::float32,
+                         pixel_format::half, pixel_format::rgb9e5})
+    if (name == pixel_format_name(f))
+      return f;
+
+  throw std::invalid_argument{"parse_pixel_format: Unknown pixel format "
+                              + name};
+}
+
+std::size_t
+oxatrace::pixel_bytes(pixel_format format) {
+  switch (format) {
+  case pixel_format::native:  return sizeof(hdr_color);
+  case pixel_format::float32: return 3 * sizeof(float);
+  case pixel_format::half:    return 3 * sizeof(std::uint16_t);
+  case pixel_format::rgb9e5:  return sizeof(std::uint32_t);
+  }
+
+  return 0;
+}
+
+void
+oxatrace::pack_pixels(pixel_format format, hdr_color const* pixels,
+                      std::size_t count, unsigned char* out) {
+  switch (format) {
+  case pixel_format::native:
+    std::memcpy(out, pixels, count * sizeof(hdr_color));
+    break;
+
+  case pixel_format::float32:
+    for (std::size_t i = 0; i < count; ++i) {
+      float const channels[3] = {float(pixels[i][0]), float(pixels[i][1]),
+                                 float(pixels[i][2])};
+      std::memcpy(out + i * sizeof(channels), channels, sizeof(channels));
+    }
+    break;
+
+  case pixel_format::half:
+    for (std::size_t i = 0; i < count; ++i) {
+      std::uint16_t const channels[3] = {half_from_float(pixels[i][0]),
+                                         half_from_float(pixels[i][1]),
+                                         half_from_float(pixels[i][2])};
+      std::memcpy(out + i * sizeof(channels), channels, sizeof(channels));
+    }
+    break;
+
+  case pixel_format::rgb9e5:
+    for (std::size_t i = 0; i < count; ++i) {
+      std::uint32_t const packed = rgb9e5_from_color(pixels[i]);
+      std::memcpy(out + i * sizeof(packed), &packed, sizeof(packed));
+    }
+    break;
+  }
+}
+
+void
+oxatrace::unpack_pixels(pixel_format format, unsigned char const* in,
+                        std::size_t count, hdr_color* pixels) {
+  switch (format) {
+  case pixel_format::native:
+    std::memcpy(pixels, in, count * sizeof(hdr_color));
+    break;
+
+  case pixel_format::float32:
+    for (std::size_t i = 0; i < count; ++i) {
+      float channels[3];
+      std::memcpy(channels, in + i * sizeof(channels), sizeof(channels));
+      pixels[i] = {channels[0], channels[1], channels[2]};
+    }
+    break;
+
+  case pixel_format::half:
+    for (std::size_t i = 0; i < count; ++i) {
+      std::uint16_t channels[3];
+      std::memcpy(channels, in + i * sizeof(channels), sizeof(channels));
+      pixels[i] = {float_from_half(channels[0]), float_from_half(channels[1]),
+                   float_from_half(channels[2])};
+    }
+    break;
+
+  case pixel_format::rgb9e5:
+    for (std::size_t i = 0; i < count; ++i) {
+      std::uint32_t packed;
+      std::memcpy(&packed, in + i * sizeof(packed), sizeof(packed));
+      pixels[i] = color_from_rgb9e5(packed);
+    }
+    break;
+  }
+}
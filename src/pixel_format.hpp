@@ -0,0 +1,73 @@
+#ifndef OXATRACE_PIXEL_FORMAT_HPP
+#define OXATRACE_PIXEL_FORMAT_HPP
+
+#include "color.hpp"
+
+#include <cstddef>
+#include <string>
+
+namespace oxatrace {
+
+// How the pixels of an HDR image may be stored when memory matters more than
+// their last bits. Pixels are converted when stored and when read back; they
+// are always hdr_colors while being rendered or developed.
+//
+// HDR channels are non-negative, so the bits of a sign are spared where the
+// format allows. Relative errors are those of rounding to nearest, and are
+// well below the 1/255 step of 8-bit output after tone mapping, except where
+// noted.
+enum class pixel_format {
+  // hdr_color as it is in memory: 32 bytes per pixel in double precision, 16
+  // in single precision, including the padding lane. Exact.
+  native,
+
+  // Three IEEE single-precision floats, 12 bytes. Relative error at most
+  // 2^-24, about 6e-8, over the whole range of float. Exact in single
+  // precision.
+  float32,
+
+  // Three IEEE half-precision floats, 6 bytes. Relative error at most 2^-11,
+  // about 4.9e-4, between 2^-14 (6.1e-5) and 65504. Smaller values lose
+  // relative precision, and those below 2^-25 (3e-8) become 0; values of
+  // 65520 and above become infinite.
+  half,
+
+  // RGB9E5: three 9-bit mantissas sharing a 5-bit exponent, 4 bytes, as in
+  // OpenGL's EXT_texture_shared_exponent. The brightest channel is kept to a
+  // relative error of at most 2^-9, about 2e-3; the other two to the same
+  // absolute error, so a channel much dimmer than the brightest of its pixel
+  // loses most of its precision. Channels above 65408 are clamped to it, and
+  // those below 2^-25 (3e-8) become 0.
+  rgb9e5
+};
+
+// Name of a format as used on the command line: "native", "float", "half" or
+// "rgb9e5".
+std::string
+pixel_format_name(pixel_format format);
+
+// Get the format of given name.
+//
+// Throws std::invalid_argument: Unknown name.
+pixel_format
+parse_pixel_format(std::string const& name);
+
+// Bytes taken by one pixel stored in format.
+std::size_t
+pixel_bytes(pixel_format format);
+
+// Store count pixels in format into out, which must have room for count *
+// pixel_bytes(format) bytes. Negative and NaN channels are stored as 0 by
+// rgb9e5, and as they are by the other formats.
+void
+pack_pixels(pixel_format format, hdr_color const* pixels, std::size_t count,
+            unsigned char* out);
+
+// Read count pixels stored in format from in.
+void
+unpack_pixels(pixel_format format, unsigned char const* in, std::size_t count,
+              hdr_color* pixels);
+
+}  // namespace oxatrace
+
+#endif
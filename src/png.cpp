@@ -0,0 +1,225 @@
+#include "png.hpp"
+
+#include "thread_pool.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+using namespace oxatrace;
+
+namespace {
+
+// Bytes per pixel: red, green and blue.
+constexpr std::size_t PIXEL_BYTES = 3;
+
+enum filter_type : unsigned char {
+  filter_none,
+  filter_sub,
+  filter_up,
+  filter_average,
+  filter_paeth
+};
+
+// Some rows of the image, filtered and deflated.
+struct deflated_chunk {
+  std::vector<unsigned char> data;
+  uLong                      adler;   // Of the filtered rows.
+  std::size_t                length;  // Of the filtered rows.
+};
+
+}  // anonymous namespace
+
+static unsigned char
+paeth_predictor(int a, int b, int c) {
+  int const p = a + b - c;
+  int const pa = std::abs(p - a);
+  int const pb = std::abs(p - b);
+  int const pc = std::abs(p - c);
+  if (pa <= pb && pa <= pc)
+    return a;
+  return pb <= pc ? b : c;
+}
+
+// Store the RGB bytes of row y of image into out.
+static void
+pack_row(ldr_image const& image, std::size_t y, unsigned char* out) {
+  for (std::size_t x = 0; x < image.width(); ++x) {
+    ldr_color const& pixel = image.pixel_at(x, y);
+    for (std::size_t c = 0; c < PIXEL_BYTES; ++c)
+      *out++ = pixel[c];
+  }
+}
+
+// Filter row by filter, given the row above it, into out. Returns the sum of
+// the filtered bytes taken as signed, in absolute value.
+static unsigned long
+apply_filter(filter_type filter, std::vector<unsigned char> const& row,
+             std::vector<unsigned char> const& above, unsigned char* out) {
+  unsigned long cost = 0;
+  for (std::size_t i = 0; i < row.size(); ++i) {
+    int const a = i >= PIXEL_BYTES ? row[i - PIXEL_BYTES] : 0;
+    int const b = above[i];
+    int const c = i >= PIXEL_BYTES ? above[i - PIXEL_BYTES] : 0;
+
+    int predicted = 0;
+    switch (filter) {
+    case filter_none:
+      break;
+    case filter_sub:
+      predicted = a;
+      break;
+    case filter_up:
+      predicted = b;
+      break;
+    case filter_average:
+      predicted = (a + b) / 2;
+      break;
+    case filter_paeth:
+      predicted = paeth_predictor(a, b, c);
+      break;
+    }
+
+    unsigned char const filtered = row[i] - predicted;
+    out[i] = filtered;
+    cost += std::abs(int(static_cast<signed char>(filtered)));
+  }
+  return cost;
+}
+
+// Filter and deflate rows [first, last) of image. The deflate stream ends on a
+// sync flush, or is finished if final is set.
+static deflated_chunk
+deflate_rows(ldr_image const& image, std::size_t first, std::size_t last,
+             bool final, int level) {
+  std::size_t const row_bytes = image.width() * PIXEL_BYTES;
+  std::vector<unsigned char> filtered((last - first) * (row_bytes + 1));
+  std::vector<unsigned char> row(row_bytes);
+  std::vector<unsigned char> above(row_bytes, 0);
+  std::vector<unsigned char> candidate(row_bytes);
+  if (first > 0)
+    pack_row(image, first - 1, above.data());
+
+  for (std::size_t y = first; y < last; ++y) {
+    pack_row(image, y, row.data());
+    unsigned char* out = &filtered[(y - first) * (row_bytes + 1)];
+
+    unsigned long best_cost = apply_filter(filter_none, row, above, out + 1);
+    out[0] = filter_none;
+    for (filter_type f : {filter_sub, filter_up, filter_average,
+                          filter_paeth}) {
+      unsigned long const cost =
+        apply_filter(f, row, above, candidate.data());
+      if (cost < best_cost) {
+        best_cost = cost;
+        out[0] = f;
+        std::copy(candidate.begin(), candidate.end(), out + 1);
+      }
+    }
+
+    std::swap(row, above);
+  }
+
+  z_stream stream{};
+  if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    throw std::runtime_error{"encode_png: Can't initialise zlib"};
+
+  // Room for a sync flush marker besides the bound for a finished stream.
+  deflated_chunk result;
+  result.data.resize(deflateBound(&stream, filtered.size()) + 16);
+  stream.next_in = filtered.data();
+  stream.avail_in = uInt(filtered.size());
+  stream.next_out = result.data.data();
+  stream.avail_out = uInt(result.data.size());
+
+  int const status = deflate(&stream, final ? Z_FINISH : Z_SYNC_FLUSH);
+  deflateEnd(&stream);
+  if (status != (final ? Z_STREAM_END : Z_OK) || stream.avail_in != 0
+      || stream.avail_out == 0)
+    throw std::runtime_error{"encode_png: Deflate failed"};
+
+  result.data.resize(stream.total_out);
+  result.adler = adler32(adler32(0, Z_NULL, 0), filtered.data(),
+                         uInt(filtered.size()));
+  result.length = filtered.size();
+  return result;
+}
+
+static void
+put_uint32(std::vector<unsigned char>& out, std::uint32_t x) {
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out.push_back((x >> shift) & 0xff);
+}
+
+// Append a PNG chunk of given type, whose data is prefix and then data.
+static void
+put_chunk(std::vector<unsigned char>& out, char const* type,
+          std::vector<unsigned char> const& prefix,
+          std::vector<unsigned char> const& data = {}) {
+  put_uint32(out, prefix.size() + data.size());
+  std::size_t const start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), prefix.begin(), prefix.end());
+  out.insert(out.end(), data.begin(), data.end());
+  put_uint32(out, crc32(0, &out[start], uInt(out.size() - start)));
+}
+
+std::vector<unsigned char>
+oxatrace::encode_png(ldr_image const& image, thread_pool* pool, int level) {
+  std::size_t const row_bytes = image.width() * PIXEL_BYTES + 1;
+  std::size_t const chunk_rows =
+    std::max<std::size_t>(1, PNG_CHUNK_BYTES / row_bytes);
+  std::size_t const chunk_count =
+    (image.height() + chunk_rows - 1) / chunk_rows;
+
+  std::vector<deflated_chunk> chunks(chunk_count);
+  auto deflate_chunks = [&] (std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i)
+      chunks[i] = deflate_rows(image, i * chunk_rows,
+                               std::min(image.height(), (i + 1) * chunk_rows),
+                               i + 1 == chunk_count, level);
+  };
+  if (pool)
+    pool->parallel_for(0, chunk_count, 1, deflate_chunks);
+  else
+    deflate_chunks(0, chunk_count);
+
+  std::vector<unsigned char> out{137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+
+  std::vector<unsigned char> header;
+  put_uint32(header, image.width());
+  put_uint32(header, image.height());
+  header.insert(header.end(), {
+    8,  // Bits per channel.
+    2,  // RGB.
+    0,  // Deflate.
+    0,  // Adaptive filtering.
+    0   // Not interlaced.
+  });
+  put_chunk(out, "IHDR", header);
+
+  // The zlib stream is spread over one IDAT chunk per deflated chunk: its
+  // header goes in front of the first, and its checksum after the last.
+  unsigned const method = 0x78;  // Deflate with a 32 KiB window.
+  unsigned flags = (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6;
+  flags += 31 - (method * 256 + flags) % 31;
+  std::vector<unsigned char> prefix{(unsigned char)method,
+                                    (unsigned char)flags};
+  uLong adler = adler32(0, Z_NULL, 0);
+  for (deflated_chunk& chunk : chunks) {
+    adler = adler32_combine(adler, chunk.adler, chunk.length);
+    if (&chunk == &chunks.back())
+      put_uint32(chunk.data, adler);
+    put_chunk(out, "IDAT", prefix, chunk.data);
+    prefix.clear();
+    std::vector<unsigned char>{}.swap(chunk.data);
+  }
+
+  put_chunk(out, "IEND", {});
+  return out;
+}
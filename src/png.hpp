@@ -0,0 +1,39 @@
+#ifndef OXATRACE_PNG_HPP
+#define OXATRACE_PNG_HPP
+
+#include "image.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace oxatrace {
+
+class thread_pool;
+
+// Rows of a PNG image are filtered and deflated in chunks of about this many
+// bytes each.
+constexpr std::size_t PNG_CHUNK_BYTES = 256 * 1024;
+
+// Encode an image as an 8-bit RGB PNG.
+//
+// Each row is filtered by whichever of the five PNG filters gives the least sum
+// of absolute values, the usual heuristic. The rows are then cut into chunks,
+// and each chunk is deflated on its own, as pigz does: every chunk but the last
+// ends on a sync flush, so that their deflate streams can simply be
+// concatenated, and their Adler-32 checksums are combined. Chunks don't share
+// their history, which costs a little compression.
+//
+// With a pool, the chunks are filtered and deflated by its workers. The result
+// is the same either way. This waits for the pool, so it must not be called
+// from its workers.
+//
+// level is zlib's compression level, from 0 (none) to 9 (best).
+//
+// Throws std::runtime_error: zlib failed.
+std::vector<unsigned char>
+encode_png(ldr_image const& image, thread_pool* pool = nullptr,
+           int level = 6);
+
+}  // namespace oxatrace
+
+#endif
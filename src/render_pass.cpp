@@ -0,0 +1,297 @@
+#include "render_pass.hpp"
+
+#include "scene.hpp"
+#include "text_interface.hpp"
+#include "tile_stream.hpp"
+#include "topology.hpp"
+
+#include <algorithm>
+
+using namespace oxatrace;
+
+constexpr std::size_t render_pass::PREPASS_SCALE;
+
+render_pass::render_pass(thread_pool& pool, std::vector<render_view>& views,
+                         scene const& scene, shading_policy const& sp,
+                         std::string const& sampler_name, std::uint32_t seed,
+                         tiling const& tiling, checkpointing const& cp,
+                         tile_stream* stream)
+  : pool_(pool)
+  , views_(views)
+  , tiling_(tiling)
+  , checkpointing_(cp)
+  , stream_{stream}
+  , scene_(scene)
+  , shading_policy_(sp)
+  , sampler_name_(sampler_name)
+  , seed_(seed)
+  , busy_(pool.size())
+{
+  // first_pixel_[v] is the number of pixels in the frames of the views
+  // before view v.
+  std::uint64_t pixels = 0;
+  total_pixels_ = 0;
+  for (std::size_t v = 0; v < views_.size(); ++v) {
+    render_view const& view = views_[v];
+    film_crop const film = view.film();
+    first_pixel_.push_back(pixels);
+    pixels += std::uint64_t(film.frame_width) * film.frame_height;
+    total_pixels_ += view.image.size();
+
+    for (tile const& t : make_tiles(view.image.width(), view.image.height(),
+                                    tiling_)) {
+      tiles_.push_back(t);
+      tile_views_.push_back(v);
+    }
+  }
+
+  for (unsigned i = 0; i < pool_.size(); ++i)
+    samplers_.push_back(make_sampler(sampler_name, seed));
+}
+
+render_pass::~render_pass() {
+  // The tasks refer to this.
+  if (started_)
+    try {
+      wait();
+    } catch (...) { }
+}
+
+void
+render_pass::start() {
+  std::vector<job> jobs;
+  for (std::size_t i = 0; i < tiles_.size(); ++i)
+    jobs.push_back({tile_views_[i], tiles_[i], 0.0, i});
+
+  if (!checkpointing_.filename.empty()) {
+    std::vector<checkpoint_view> views;
+    for (render_view& view : views_)
+      views.push_back({&view.image, view.features.get_ptr()});
+    std::vector<checkpoint_tile> tiles;
+    for (job const& j : jobs)
+      tiles.push_back({j.view, j.tile});
+    checkpoint_ = std::make_unique<checkpoint>(
+      checkpointing_.fingerprint, std::move(views), std::move(tiles)
+    );
+
+    if (checkpointing_.resume) {
+      stats_.resumed = checkpoint_->load(checkpointing_.filename);
+      jobs.erase(std::remove_if(jobs.begin(), jobs.end(),
+                                [&] (job const& j) {
+                                  if (!checkpoint_->finished(j.index))
+                                    return false;
+                                  pixels_done_ += j.tile.width
+                                                  * j.tile.height;
+                                  if (stream_)
+                                    stream_->push(j.view, j.tile);
+                                  return true;
+                                }),
+                 jobs.end());
+    }
+  }
+
+  if (checkpoint_ || stream_) {
+    rows_left_.reset(new std::atomic<std::size_t>[tiles_.size()]);
+    for (job const& j : jobs)
+      rows_left_[j.index] = j.tile.height;
+  }
+
+  thread_pool::dealing deal = thread_pool::dealing::runs;
+  if (tiling_.longest_first) {
+    clock::time_point const prepass_start = clock::now();
+    estimate_costs(jobs);
+    stats_.prepass_seconds = seconds_since(prepass_start);
+
+    std::stable_sort(jobs.begin(), jobs.end(),
+                     [] (job const& a, job const& b) {
+                       return a.cost > b.cost;
+                     });
+    deal = thread_pool::dealing::round_robin;
+  }
+
+  std::vector<task> tasks;
+  std::vector<unsigned> placement;
+  for (job const& j : jobs) {
+    tasks.push_back([this, j] (task_context& context) {
+      render(context, j.view, j.index, j.tile, true);
+    });
+    placement.push_back(stripe(views_[j.view].image, j.tile));
+  }
+
+  if (pool_.nodes() > 1)
+    for (render_view& view : views_) {
+      bind_stripes(view.image);
+      if (view.features)
+        bind_stripes(*view.features);
+    }
+
+  started_ = true;
+  start_ = clock::now();
+  pool_.submit(group_, std::move(tasks), placement, deal);
+}
+
+void
+render_pass::render_tile(task_context& context, std::size_t index) {
+  render(context, tile_views_.at(index), index, tiles_[index], false);
+}
+
+void
+render_pass::save_checkpoint() {
+  if (checkpoint_)
+    checkpoint_->save(checkpointing_.filename);
+}
+
+trace_stats
+render_pass::stats() {
+  stats_.seconds = seconds_since(start_);
+
+  double busy = 0.0;
+  for (double b : busy_)
+    busy += b;
+  stats_.idle =
+    std::max(0.0, 1.0 - busy / (stats_.seconds * pool_.size()));
+  return stats_;
+}
+
+double
+render_pass::seconds_since(clock::time_point start) {
+  return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+void
+render_pass::estimate_costs(std::vector<job>& jobs) {
+  std::size_t const scale = PREPASS_SCALE;
+  std::vector<hdr_image> previews;
+  std::vector<film_crop> crops;
+  for (render_view const& view : views_) {
+    previews.emplace_back(
+      std::max<std::size_t>(1, view.image.width() / scale),
+      std::max<std::size_t>(1, view.image.height() / scale)
+    );
+
+    film_crop const film = view.film();
+    crops.push_back({std::max<std::size_t>(1, film.frame_width / scale),
+                     std::max<std::size_t>(1, film.frame_height / scale),
+                     film.x / scale, film.y / scale});
+  }
+
+  pool_.parallel_for(
+    0, jobs.size(), 1,
+    [&] (std::size_t begin, std::size_t end) {
+      std::unique_ptr<sampler> const sampler =
+        make_sampler(sampler_name_, seed_);
+
+      for (std::size_t i = begin; i < end; ++i) {
+        hdr_image& preview = previews[jobs[i].view];
+
+        // The tile scaled down, covering at least one pixel.
+        tile const& t = jobs[i].tile;
+        std::size_t const x = std::min(t.x / scale, preview.width() - 1);
+        std::size_t const y = std::min(t.y / scale, preview.height() - 1);
+        tile const small{
+          x, y,
+          std::max<std::size_t>(
+            1, std::min(t.width / scale, preview.width() - x)
+          ),
+          std::max<std::size_t>(
+            1, std::min(t.height / scale, preview.height() - y)
+          )
+        };
+
+        clock::time_point const start = clock::now();
+        sample_tile(scene_, views_[jobs[i].view].camera, small,
+                    shading_policy_, *sampler, 0, crops[jobs[i].view],
+                    preview);
+        jobs[i].cost = seconds_since(start);
+      }
+    }
+  );
+}
+
+std::size_t
+render_pass::stripe(hdr_image const& image, tile const& t) const {
+  return (t.y + t.height / 2) * pool_.nodes() / image.height();
+}
+
+template <typename Image>
+void
+render_pass::bind_stripes(Image& image) {
+  using pixel = typename Image::pixel_type;
+  std::size_t const row_bytes = image.width() * sizeof(pixel);
+  for (unsigned n = 0; n < pool_.nodes(); ++n) {
+    std::size_t const first = image.height() * n / pool_.nodes();
+    std::size_t const last = image.height() * (n + 1) / pool_.nodes();
+    bind_to_node(image.data() + first * image.width(),
+                 (last - first) * row_bytes, pool_.node(n).id);
+  }
+}
+
+void
+render_pass::render(task_context& context, std::size_t v, std::size_t index,
+                    tile t, bool split) {
+  clock::time_point const start = clock::now();
+  render_view& view = views_[v];
+  film_crop const film = view.film();
+  sampler& sampler = *samplers_[context.worker()];
+
+  while (t.height > 0) {
+    if (split && t.height > 1 && context.idle_workers()) {
+      tile back = t;
+      back.height = t.height / 2;
+      back.y = t.y + t.height - back.height;
+      t.height -= back.height;
+      context.spawn([this, v, index, back] (task_context& c) {
+        render(c, v, index, back, true);
+      });
+    }
+
+    // Pixels are numbered through all views, so that each view gets its
+    // own samples.
+    sample_tile(scene_, view.camera, {t.x, t.y, t.width, 1},
+                shading_policy_, sampler, first_pixel_[v], film, view.image,
+                view.features.get_ptr());
+    pixels_done_ += t.width;
+    if (rows_left_ && --rows_left_[index] == 0) {
+      if (checkpoint_)
+        checkpoint_->finish(index);
+      if (stream_)
+        stream_->push(v, tiles_[index]);
+    }
+    ++t.y;
+    --t.height;
+  }
+
+  busy_[context.worker()] += seconds_since(start);
+}
+
+trace_stats
+oxatrace::trace(std::vector<render_view>& views, thread_pool& pool,
+                scene const& sc, shading_policy const& policy,
+                std::string const& sampler_name, std::uint32_t seed,
+                tiling const& tiling, progress_monitor& monitor,
+                checkpointing const& cp, tile_stream* stream) {
+  using clock = std::chrono::steady_clock;
+  std::chrono::milliseconds const poll_interval{100};
+
+  render_pass pass{pool, views, sc, policy, sampler_name, seed, tiling, cp,
+                   stream};
+  monitor.change_phase(
+    std::string{"Tracing rays in "}
+    + std::to_string(pool.size()) + " threads..."
+  );
+  pass.start();
+
+  // Checkpoints are saved by this thread, while it would otherwise only be
+  // waiting for the workers.
+  clock::time_point next_checkpoint = clock::now() + cp.interval;
+  while (!pass.wait_for(poll_interval)) {
+    monitor.update_progress(pass.percent_complete());
+    if (cp.interval.count() > 0 && clock::now() >= next_checkpoint) {
+      pass.save_checkpoint();
+      next_checkpoint = clock::now() + cp.interval;
+    }
+  }
+
+  monitor.update_progress(pass.percent_complete());
+  return pass.stats();
+}
@@ -0,0 +1,227 @@
+#ifndef OXATRACE_RENDER_PASS_HPP
+#define OXATRACE_RENDER_PASS_HPP
+
+#include "camera.hpp"
+#include "checkpoint.hpp"
+#include "features.hpp"
+#include "image.hpp"
+#include "renderer.hpp"
+#include "sampler.hpp"
+#include "thread_pool.hpp"
+#include "tiles.hpp"
+
+#include <boost/optional.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace oxatrace {
+
+class progress_monitor;
+class scene;
+class tile_stream;
+
+// One image rendered by a render_pass: the camera it is seen through and the
+// image the result goes to.
+struct render_view {
+  std::string name;  // Appended to the output filename; empty for one view.
+  oxatrace::camera camera;
+  hdr_image        image;
+
+  // If set, the features of each pixel are stored here as well.
+  boost::optional<feature_image> features = boost::none;
+
+  // If set, the image holds only this crop of the camera's film; otherwise
+  // the whole of it.
+  boost::optional<film_crop> crop = boost::none;
+
+  film_crop
+  film() const {
+    return crop ? *crop : film_crop{image.width(), image.height()};
+  }
+};
+
+// How a render_pass went.
+struct trace_stats {
+  double      prepass_seconds = 0.0;  // Estimating the costs of tiles.
+  double      seconds         = 0.0;  // Rendering the tiles.
+  double      idle            = 0.0;  // Fraction of worker time spent idle.
+  std::size_t resumed         = 0;    // Tiles loaded from a checkpoint.
+};
+
+// Where a render_pass saves its checkpoints, and how often.
+struct checkpointing {
+  std::string          filename;     // Empty for no checkpoints.
+  std::string          fingerprint;  // Of checkpoint.
+  std::chrono::seconds interval{0};  // 0 to only resume, if resume is set.
+  bool                 resume = false;
+};
+
+// Renders a number of views of one scene on a thread pool.
+//
+// Every view is cut into tiles as given by a tiling, and the tiles of all views
+// are submitted to the pool together, so that rendering several views costs
+// about as much as one image of their combined size. Tiles are rendered row by
+// row; once workers run out of tiles, the rows left of a tile are halved and
+// the other half is handed to them.
+//
+// With tiling::longest_first, all views are first rendered at 1/PREPASS_SCALE
+// of their resolution, timing each tile's share of that. The tiles are then
+// dealt out from the most expensive one down, so that the frame doesn't end
+// waiting for an expensive tile started last, and the cheap ones at the end
+// are easy to share out by splitting.
+//
+// If the pool spans several NUMA nodes, each view is cut into as many
+// horizontal stripes, and the memory of the n-th stripe of its image and
+// features is moved to node n, whose workers are given the tiles within it.
+//
+// With checkpointing, the tiles of a checkpoint being resumed are loaded
+// rather than rendered, and the finished tiles are saved by save_checkpoint.
+//
+// If given a tile_stream, each tile is pushed to it once all its rows are
+// rendered, or at the start if resumed. Its images are the views', in order.
+//
+// Rather than start the pass, a caller scheduling tiles itself, such as a
+// render_service, may render them one at a time through render_tile.
+class render_pass {
+public:
+  // The views, scene and stream must outlive the pass.
+  render_pass(thread_pool& pool, std::vector<render_view>& views,
+              scene const& scene, shading_policy const& sp,
+              std::string const& sampler_name, std::uint32_t seed,
+              tiling const& tiling, checkpointing const& cp = {},
+              tile_stream* stream = nullptr);
+
+  render_pass(render_pass const&) = delete;
+  render_pass& operator = (render_pass const&) = delete;
+
+  // Waits for the tasks of the pass, if started.
+  ~render_pass();
+
+  // Submit the tiles to the pool, after resuming the checkpoint and estimating
+  // the costs of the tiles if asked to.
+  //
+  // Throws what checkpoint::load throws.
+  void
+  start();
+
+  // Wait until the tasks of the pass, and only those, are done.
+  //
+  // Throws what rendering the tiles threw.
+  void
+  wait() { pool_.wait(group_); }
+
+  // Like wait, but give up after timeout. Returns whether the pass is done.
+  bool
+  wait_for(std::chrono::milliseconds timeout) {
+    return pool_.wait_for(group_, timeout);
+  }
+
+  // Number of tiles of all views.
+  std::size_t
+  tiles() const noexcept { return tiles_.size(); }
+
+  // Render tile number index, in [0, tiles()), whole, on the calling worker of
+  // the pool, with no checkpoint or stream. For passes that aren't started.
+  void
+  render_tile(task_context& context, std::size_t index);
+
+  // Fraction of the pixels rendered so far, in [0, 1].
+  double
+  percent_complete() const {
+    return double(pixels_done_.load()) / double(total_pixels_);
+  }
+
+  // Save the tiles finished so far, if checkpointing. May be called while the
+  // pool renders the pass, but not by several threads at once.
+  //
+  // Throws what checkpoint::save throws.
+  void
+  save_checkpoint();
+
+  // Statistics of a started pass, once the pool is done with it.
+  trace_stats
+  stats();
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  static constexpr std::size_t PREPASS_SCALE = 8;
+
+  // A tile to be rendered, among the tiles of all views.
+  struct job {
+    std::size_t    view;
+    oxatrace::tile tile;
+    double         cost;
+    std::size_t    index;  // Into tiles_.
+  };
+
+  thread_pool&                           pool_;
+  task_group                             group_;
+  std::vector<render_view>&              views_;
+  tiling                                 tiling_;
+  checkpointing                          checkpointing_;
+  std::unique_ptr<checkpoint>            checkpoint_;
+  tile_stream*                           stream_;
+  std::vector<tile>                      tiles_;       // Of all views.
+  std::vector<std::size_t>               tile_views_;  // Of tiles_.
+  std::unique_ptr<std::atomic<std::size_t>[]>
+                                         rows_left_;   // Of tiles_.
+  std::vector<std::uint64_t>             first_pixel_;
+  std::uint64_t                          total_pixels_;
+  std::atomic<std::uint64_t>             pixels_done_{0};
+  scene const&                           scene_;
+  shading_policy                         shading_policy_;
+  std::string                            sampler_name_;
+  std::uint32_t                          seed_;
+  std::vector<std::unique_ptr<sampler>>  samplers_;  // One for each worker.
+  std::vector<double>                    busy_;      // Seconds, per worker.
+  bool                                   started_ = false;
+  clock::time_point                      start_;
+  trace_stats                            stats_;
+
+  static double
+  seconds_since(clock::time_point start);
+
+  // Set the cost of each job to the time taken to render the corresponding
+  // part of a scaled-down copy of its view.
+  void
+  estimate_costs(std::vector<job>& jobs);
+
+  // Index of the stripe containing most of tile t of an image.
+  std::size_t
+  stripe(hdr_image const& image, tile const& t) const;
+
+  // Move stripe n of image to pool node n.
+  template <typename Image>
+  void
+  bind_stripes(Image& image);
+
+  // Render t, part of tile number index of view v, a row at a time. If split
+  // is set, the rows left are halved whenever workers are idle.
+  void
+  render(task_context& context, std::size_t v, std::size_t index, tile t,
+         bool split);
+};
+
+// Render the scene into each of the views, reporting progress through the
+// monitor. With checkpointing, the checkpoint is saved by the calling thread
+// every cp.interval.
+//
+// Throws what render_pass::start and render_pass::save_checkpoint throw, and
+// what rendering threw.
+trace_stats
+trace(std::vector<render_view>& views, thread_pool& pool, scene const& sc,
+      shading_policy const& policy,
+      std::string const& sampler_name, std::uint32_t seed,
+      tiling const& tiling, progress_monitor& monitor,
+      checkpointing const& cp = {}, tile_stream* stream = nullptr);
+
+}  // namespace oxatrace
+
+#endif
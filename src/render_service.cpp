@@ -0,0 +1,396 @@
+#include "render_service.hpp"
+
+#include "framebuffer.hpp"
+#include "pfm.hpp"
+#include "render_pass.hpp"
+#include "sampler.hpp"
+#include "scene.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+
+using namespace oxatrace;
+
+// The curve spec develops image by, given a function returning its log-average
+// luminance. That is only called if needed.
+template <typename Luminance>
+static tone_curve
+curve_of(output_spec const& spec, Luminance luminance) {
+  tone_curve result;
+  switch (spec.tone_map) {
+  case output_spec::tone_mapping::none:
+    break;
+  case output_spec::tone_mapping::reinhard:
+    assert(spec.key > 0.0);
+    result.op = tone_operator::reinhard;
+    result.param = spec.key / luminance();
+    break;
+  case output_spec::tone_mapping::exposure:
+    assert(spec.exposure > 0.0);
+    result.op = tone_operator::exposure;
+    result.param = spec.exposure;
+    break;
+  }
+
+  if (spec.gamma > EPSILON)
+    result.exponent = 1 / spec.gamma;
+  return result;
+}
+
+tone_curve
+oxatrace::fixed_tone_curve(output_spec const& spec) {
+  return curve_of(spec, [] () -> double {
+    throw std::invalid_argument{"fixed_tone_curve: Reinhard's operator "
+                                "depends on the image"};
+  });
+}
+
+ldr_image
+oxatrace::develop(hdr_image const& image, output_spec const& spec) {
+  tone_curve const curve =
+    curve_of(spec, [&] { return log_avg_luminance(image); });
+
+  ldr_image result{image.width(), image.height()};
+  develop_pixels(image, 0, image.size(), curve, result);
+  return result;
+}
+
+ldr_image
+oxatrace::develop(hdr_image const& image, output_spec const& spec,
+                  thread_pool& pool) {
+  tone_curve const curve = curve_of(spec, [&] {
+    std::vector<double> block_sums(luminance_blocks(image));
+    pool.parallel_for(0, block_sums.size(), 1,
+                      [&] (std::size_t begin, std::size_t end) {
+                        for (std::size_t n = begin; n < end; ++n)
+                          block_sums[n] = log_luminance_block(image, n);
+                      });
+    return log_avg_luminance(image, block_sums);
+  });
+
+  // Bands of rows of about a luminance block each.
+  develop_table const table = make_develop_table(curve);
+  ldr_image result{image.width(), image.height()};
+  std::size_t const width = image.width();
+  pool.parallel_for(0, image.height(),
+                    std::max<std::size_t>(1, LUMINANCE_BLOCK / width),
+                    [&] (std::size_t begin, std::size_t end) {
+                      develop_pixels(image, begin * width,
+                                     (end - begin) * width, table, result);
+                    });
+  return result;
+}
+
+// Sum of log(delta + L(x, y)) over tile i of framebuffer, by blocks as in
+// log_avg_luminance.
+static double
+log_luminance_tile(tiled_framebuffer const& framebuffer, std::uint64_t i) {
+  hdr_image const pixels = framebuffer.load(i);
+  double sum = 0.0;
+  for (std::size_t n = 0; n < luminance_blocks(pixels); ++n)
+    sum += log_luminance_block(pixels, n);
+  return sum;
+}
+
+// Copy tile i of framebuffer into band, which holds its row of tiles.
+static void
+load_into_band(tiled_framebuffer const& framebuffer, std::uint64_t i,
+               hdr_image& band) {
+  hdr_image const pixels = framebuffer.load(i);
+  tile const t = framebuffer.tile_at(i);
+  for (std::size_t y = 0; y < t.height; ++y)
+    std::copy_n(&pixels.pixel_at(0, y), t.width, &band.pixel_at(t.x, y));
+}
+
+void
+oxatrace::develop(tiled_framebuffer const& framebuffer,
+                  output_spec const& spec, std::string const& filename,
+                  thread_pool& pool) {
+  std::uint64_t const columns = framebuffer.tile_columns();
+  std::vector<double> column_sums(columns);
+
+  tone_curve const curve = curve_of(spec, [&] {
+    // Summed within each tile, then along each row of tiles, then down the
+    // rows, always in the same order.
+    double sum = 0.0;
+    for (std::uint64_t row = 0; row < framebuffer.tile_rows(); ++row) {
+      pool.parallel_for(0, columns, 1,
+                        [&] (std::size_t begin, std::size_t end) {
+                          for (std::size_t c = begin; c < end; ++c)
+                            column_sums[c] =
+                              log_luminance_tile(framebuffer,
+                                                 row * columns + c);
+                        });
+      for (double s : column_sums)
+        sum += s;
+    }
+    return std::exp(sum / (double(framebuffer.width())
+                           * double(framebuffer.height())));
+  });
+
+  develop_table const table = make_develop_table(curve);
+  ppm_writer out{filename, framebuffer.width(), framebuffer.height()};
+  for (std::uint64_t row = 0; row < framebuffer.tile_rows(); ++row) {
+    hdr_image band{framebuffer.width(),
+                   framebuffer.tile_at(row * columns).height};
+    pool.parallel_for(0, columns, 1,
+                      [&] (std::size_t begin, std::size_t end) {
+                        for (std::size_t c = begin; c < end; ++c)
+                          load_into_band(framebuffer, row * columns + c,
+                                         band);
+                      });
+
+    ldr_image developed{band.width(), band.height()};
+    std::size_t const width = band.width();
+    pool.parallel_for(0, band.height(), 1,
+                      [&] (std::size_t begin, std::size_t end) {
+                        develop_pixels(band, begin * width,
+                                       (end - begin) * width, table,
+                                       developed);
+                      });
+    out.write(developed);
+  }
+}
+
+ldr_image
+oxatrace::develop(mapped_pfm const& image, output_spec const& spec,
+                  thread_pool& pool) {
+  std::uint64_t const size = image.size();
+  tone_curve const curve = curve_of(spec, [&] {
+    // The same blocks as those of log_avg_luminance.
+    std::vector<double> block_sums((size + LUMINANCE_BLOCK - 1)
+                                   / LUMINANCE_BLOCK);
+    pool.parallel_for(0, block_sums.size(), 1,
+                      [&] (std::size_t begin, std::size_t end) {
+                        hdr_image block{LUMINANCE_BLOCK, 1};
+                        for (std::size_t n = begin; n < end; ++n) {
+                          std::uint64_t const first = n * LUMINANCE_BLOCK;
+                          std::size_t const count =
+                            std::min<std::uint64_t>(LUMINANCE_BLOCK,
+                                                    size - first);
+                          if (count < block.size())
+                            block = hdr_image{count, 1};
+                          image.read(first, count, block.data());
+                          block_sums[n] = log_luminance_block(block, 0);
+                        }
+                      });
+
+    double sum = 0.0;
+    for (double s : block_sums)
+      sum += s;
+    return std::exp(sum / (double(image.width()) * double(image.height())));
+  });
+
+  // Bands of rows of about a luminance block each, read and developed one at
+  // a time by each worker.
+  develop_table const table = make_develop_table(curve);
+  ldr_image result{image.width(), image.height()};
+  std::size_t const width = image.width();
+  std::size_t const band_rows =
+    std::max<std::size_t>(1, LUMINANCE_BLOCK / width);
+  pool.parallel_for(0, image.height(), band_rows,
+                    [&] (std::size_t begin, std::size_t end) {
+                      hdr_image band{width, band_rows};
+                      ldr_image developed{width, band_rows};
+                      for (std::size_t y = begin; y < end; y += band_rows) {
+                        std::size_t const rows =
+                          std::min(band_rows, end - y);
+                        if (rows < band_rows) {
+                          band = hdr_image{width, rows};
+                          developed = ldr_image{width, rows};
+                        }
+                        image.read(y * width, band.size(), band.data());
+                        develop_pixels(band, 0, band.size(), table,
+                                       developed);
+                        std::copy(developed.begin(), developed.end(),
+                                  &result.pixel_at(0, y));
+                      }
+                    });
+  return result;
+}
+
+// A job along with the state of its rendering. Its tiles are rendered by a
+// render_pass of its one view, tile by tile as the service picks them. Members
+// below the promise are guarded by the service's mutex, except the atomic
+// one.
+struct detail::job_state {
+  render_job               job;
+  std::vector<render_view> views;
+  render_pass              pass;
+  std::promise<ldr_image>  promise;
+
+  std::size_t              next_tile   = 0;  // First one not yet started.
+  unsigned                 in_flight   = 0;  // Tiles being rendered.
+  std::uint64_t            last_served = 0;  // When a tile was last started.
+  std::exception_ptr       error;            // Set once the job has failed.
+  bool                     finished    = false;
+
+  std::atomic<bool>        cancelled{false};
+
+  job_state(render_job j, thread_pool& pool)
+    : job(std::move(j))
+    , views{{"", job.camera, {job.width, job.height}}}
+    , pass{pool, views, *job.scene, job.policy, job.sampler, job.seed,
+           tiling{job.tile_side, tile_order::hilbert, false}} { }
+
+  // Will no more tiles be started?
+  bool
+  exhausted() const { return error || next_tile == pass.tiles(); }
+};
+
+void
+render_handle::cancel() {
+  state_->cancelled = true;
+}
+
+double
+render_handle::progress() const {
+  return state_->pass.percent_complete();
+}
+
+// Fulfil the promise of a job no more tiles will be rendered for.
+static void
+finish(detail::job_state& state) {
+  if (state.error) {
+    state.promise.set_exception(state.error);
+    return;
+  }
+
+  try {
+    ldr_image result = develop(state.views.front().image, state.job.output);
+    if (!state.job.output.filename.empty())
+      save(result, state.job.output.filename);
+    state.promise.set_value(std::move(result));
+  } catch (...) {
+    state.promise.set_exception(std::current_exception());
+  }
+}
+
+render_service::render_service(thread_pool& pool)
+  : pool_(pool) { }
+
+render_service::~render_service() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    for (auto const& state : queue_)
+      state->cancelled = true;
+  }
+
+  // The drainers refer to this.
+  try {
+    pool_.wait(drainers_group_);
+  } catch (...) { }
+}
+
+render_handle
+render_service::submit(render_job job) {
+  if (!job.scene)
+    throw std::invalid_argument{"render_service::submit: No scene"};
+  if (job.width == 0 || job.height == 0)
+    throw std::invalid_argument{"render_service::submit: Empty image"};
+  if (job.tile_side == 0)
+    throw std::invalid_argument{"render_service::submit: Tile side is 0"};
+  make_sampler(job.sampler, job.seed);  // Throws if unknown.
+
+  auto state = std::make_shared<detail::job_state>(std::move(job), pool_);
+  std::shared_future<ldr_image> result = state->promise.get_future().share();
+
+  unsigned wanted;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    queue_.push_back(state);
+    wanted = pool_.size() - std::min(drainers_, pool_.size());
+    drainers_ += wanted;
+  }
+
+  std::vector<task> drainers;
+  for (unsigned i = 0; i < wanted; ++i)
+    drainers.push_back([this] (task_context& context) { drain(context); });
+  pool_.submit(drainers_group_, std::move(drainers));
+
+  return {std::move(state), std::move(result)};
+}
+
+void
+render_service::drain(task_context& context) {
+  using detail::job_state;
+
+  std::unique_lock<std::mutex> lock{mutex_};
+  std::vector<std::shared_ptr<job_state>> finished;
+
+  while (true) {
+    // Fail cancelled and late jobs, and drop the exhausted ones from the
+    // queue. Those with no tiles in flight are done.
+    render_job::clock::time_point const now = render_job::clock::now();
+    for (auto const& state : queue_) {
+      if (state->error)
+        continue;
+      if (state->cancelled)
+        state->error = std::make_exception_ptr(job_cancelled{});
+      else if (state->job.deadline && now > *state->job.deadline)
+        state->error = std::make_exception_ptr(deadline_exceeded{});
+    }
+
+    for (auto const& state : queue_)
+      if (state->exhausted() && state->in_flight == 0 && !state->finished) {
+        state->finished = true;
+        finished.push_back(state);
+      }
+    queue_.erase(std::remove_if(queue_.begin(), queue_.end(),
+                                [] (std::shared_ptr<job_state> const& s) {
+                                  return s->exhausted();
+                                }),
+                 queue_.end());
+
+    // The job of the highest priority served longest ago.
+    std::shared_ptr<job_state> best;
+    for (auto const& state : queue_)
+      if (!best || state->job.priority > best->job.priority
+          || (state->job.priority == best->job.priority
+              && state->last_served < best->last_served))
+        best = state;
+
+    if (!best && finished.empty())
+      break;
+
+    std::size_t index = 0;
+    if (best) {
+      index = best->next_tile++;
+      ++best->in_flight;
+      best->last_served = ++served_;
+    }
+    lock.unlock();
+
+    for (auto const& state : finished)
+      finish(*state);
+    finished.clear();
+
+    std::exception_ptr error;
+    if (best)
+      try {
+        best->pass.render_tile(context, index);
+      } catch (...) {
+        error = std::current_exception();
+      }
+
+    lock.lock();
+    if (best) {
+      --best->in_flight;
+      if (error && !best->error)
+        best->error = error;
+
+      // The job may have left the queue while this tile was being rendered.
+      if (best->exhausted() && best->in_flight == 0 && !best->finished) {
+        best->finished = true;
+        finished.push_back(best);
+      }
+    }
+  }
+
+  --drainers_;
+}
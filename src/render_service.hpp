@@ -0,0 +1,202 @@
+#ifndef OXATRACE_RENDER_SERVICE_HPP
+#define OXATRACE_RENDER_SERVICE_HPP
+
+#include "camera.hpp"
+#include "image.hpp"
+#include "renderer.hpp"
+#include "thread_pool.hpp"
+#include "tiles.hpp"
+
+#include <boost/optional.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace oxatrace {
+
+class mapped_pfm;
+class scene;
+class tiled_framebuffer;
+
+// How a traced image is turned into the final one.
+struct output_spec {
+  enum class tone_mapping {
+    none,
+    reinhard,
+    exposure
+  };
+
+  tone_mapping tone_map = tone_mapping::reinhard;
+  double       key      = 0.18;  // Of apply_reinhard.
+  double       exposure = 1.0;   // Of expose.
+  double       gamma    = 2.2;   // 0 or 1 disables gamma correction.
+
+  // If not empty, the result is also saved into this file.
+  std::string  filename;
+};
+
+// The curve spec develops every image by, when that doesn't depend on the
+// image, as is the case for all tone mapping but Reinhard's operator.
+//
+// Throws std::invalid_argument: spec uses Reinhard's operator.
+tone_curve
+fixed_tone_curve(output_spec const& spec);
+
+// Tone-map, gamma-correct and quantise image as given by spec. This doesn't
+// save the result.
+//
+// The image is read at most twice: once for its log-average luminance if it is
+// tone-mapped by Reinhard's operator, and once by develop_pixels for all the
+// rest, with no images in between.
+ldr_image
+develop(hdr_image const& image, output_spec const& spec);
+
+// Like the above, but with both passes split among the workers of pool. The
+// result is the same. This waits for its tasks on the pool, so it must not be
+// called from the pool's workers.
+ldr_image
+develop(hdr_image const& image, output_spec const& spec, thread_pool& pool);
+
+// Develop the image in framebuffer like the above, and save the result into
+// filename as a binary PPM. This goes a row of tiles at a time, so that only
+// one such band of the image is held in memory.
+//
+// The log-average luminance is summed tile by tile, and so may differ in its
+// last bits from that of the same image in memory.
+//
+// Throws std::ios_base::failure: I/O error.
+void
+develop(tiled_framebuffer const& framebuffer, output_spec const& spec,
+        std::string const& filename, thread_pool& pool);
+
+// Develop the image in a PFM file like develop(hdr_image const&, ..., pool),
+// reading a band of rows at a time rather than loading it whole. The result is
+// the same as that of the image loaded whole.
+ldr_image
+develop(mapped_pfm const& image, output_spec const& spec, thread_pool& pool);
+
+// One image to be rendered by a render_service.
+struct render_job {
+  using clock = std::chrono::steady_clock;
+
+  // Kept alive until the job is done. Scenes are read-only while rendering, so
+  // any number of jobs may share one.
+  std::shared_ptr<oxatrace::scene const> scene;
+  oxatrace::camera                       camera;
+  shading_policy                         policy;
+  std::size_t                            width;
+  std::size_t                            height;
+  output_spec                            output;
+
+  std::string                            sampler   = "sobol";
+  std::uint32_t                          seed      = 0;
+  std::size_t                            tile_side = 32;
+
+  // Jobs of a higher priority are always served first.
+  int                                    priority = 0;
+
+  // If the job isn't done by then, its remaining tiles are dropped and it
+  // fails with deadline_exceeded.
+  boost::optional<clock::time_point> deadline = boost::none;
+};
+
+// Why the future of a job may fail, besides errors while rendering or saving.
+class job_cancelled : public std::runtime_error {
+public:
+  job_cancelled() : std::runtime_error{"Render job cancelled"} { }
+};
+
+class deadline_exceeded : public std::runtime_error {
+public:
+  deadline_exceeded()
+    : std::runtime_error{"Render job missed its deadline"} { }
+};
+
+namespace detail { struct job_state; }
+
+// A job submitted to a render_service.
+class render_handle {
+public:
+  // Resolves to the developed image, or to the exception that ended the job.
+  std::shared_future<ldr_image>
+  result() const { return result_; }
+
+  // Drop the tiles of the job that haven't been started. Once those running
+  // are done, the job fails with job_cancelled. Does nothing if the job is
+  // already finished.
+  void
+  cancel();
+
+  // Fraction of the pixels rendered so far, in [0, 1].
+  double
+  progress() const;
+
+private:
+  friend class render_service;
+
+  render_handle(std::shared_ptr<detail::job_state> state,
+                std::shared_future<ldr_image> result)
+    : state_{std::move(state)}
+    , result_{std::move(result)} { }
+
+  std::shared_ptr<detail::job_state> state_;
+  std::shared_future<ldr_image>      result_;
+};
+
+// Renders any number of jobs concurrently on a shared thread pool.
+//
+// Jobs are cut into tiles, and the workers take the tiles one at a time: from
+// the job of the highest priority and, among jobs of equal priority, from the
+// one that was served longest ago. A thumbnail submitted while a large image is
+// being rendered thus gets every other tile and is done after a few of them,
+// rather than waiting for the large one to finish. Each tile is rendered by the
+// job's render_pass, like those of a render on the command line, and a job is
+// developed and saved by the worker finishing its last tile.
+//
+// The service takes workers from the pool only while it has tiles to render,
+// so the pool may be used for other work as well. All member functions are
+// thread-safe.
+class render_service {
+public:
+  explicit
+  render_service(thread_pool& pool);
+
+  render_service(render_service const&) = delete;
+  render_service& operator = (render_service const&) = delete;
+
+  // Cancels all jobs still queued, and waits until the workers are done with
+  // those running.
+  ~render_service();
+
+  // Queue a job.
+  //
+  // Throws std::invalid_argument: The job has no scene, an empty image, or
+  //                               its tile side is 0.
+  //        std::invalid_argument: Unknown sampler.
+  render_handle
+  submit(render_job job);
+
+private:
+  thread_pool&                                    pool_;
+  task_group                                      drainers_group_;
+  std::mutex                                      mutex_;
+  std::vector<std::shared_ptr<detail::job_state>> queue_;
+  unsigned                                        drainers_ = 0;
+  std::uint64_t                                   served_ = 0;
+
+  // Worker task rendering tiles until there are none left.
+  void
+  drain(task_context& context);
+};
+
+}  // namespace oxatrace
+
+#endif
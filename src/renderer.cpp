@@ -1,12 +1,16 @@
 #include "renderer.hpp"
 
 #include "camera.hpp"
+#include "isa.hpp"
 #include "math.hpp"
+#include "sampler.hpp"
 #include "scene.hpp"
 #include "solids.hpp"
 
 #include <array>
+#include <cassert>
 #include <numeric>
+#include <vector>
 
 using namespace oxatrace;
 
@@ -14,7 +18,7 @@ static hdr_color
 blend_light(
   material const& material,
   hdr_color const& base_color, unit3 const& normal,
-  hdr_color const& light_color, vector3 const& light_dir
+  hdr_color const& light_color, vector3 const& light_dir, math_mode mode
 ) {
   // We're using the Phong shading model here, which is an empiric one without
   // much basis in real physics. Aside from the ambient term (which is there
@@ -35,14 +39,15 @@ blend_light(
   //
   // XXX: This should take distance to the light source into account as well.
 
-  double const cos_alpha = cos_angle(normal, light_dir);
-
-  if (cos_alpha <= 0.0) return material.base_color();
+  real cos_alpha, highlight;
+  if (!kernels().phong(normal.get().data(), light_dir.data(),
+                       material.specular_exponent(), mode == math_mode::fast,
+                       &cos_alpha, &highlight))
+    return material.base_color();
 
   hdr_color const diffuse_color = light_color * material.diffuse() * cos_alpha;
   hdr_color const specular_color =
-    light_color * material.specular()
-    * std::pow(cos_alpha, material.specular_exponent());
+    light_color * material.specular() * highlight;
     
   return base_color + diffuse_color + specular_color;
 }
@@ -55,27 +60,97 @@ blend_reflection(material const& material, hdr_color const& base_color,
 }
 
 static bool
-should_continue(unsigned current_depth, double current_importance,
+should_continue(unsigned current_depth, real current_importance,
                 shading_policy const& policy) {
-  if (current_importance < 0.0 || current_importance > 1.0)
-    throw std::logic_error{"should_continue: importance outside [0, 1]"};
+  // Material reflectances are in [0, 1], so importance can only get smaller
+  // as we go deeper.
+  assert(current_importance >= 0.0 && current_importance <= 1.0);
 
   return current_depth <= policy.max_depth
     && current_importance >= policy.min_importance;
 }
 
+namespace {
+  // Running sum of the features of the first hits of a pixel's samples. The
+  // solid of the pixel is the one its first sample hits; only samples hitting
+  // that solid contribute to the other features.
+  class feature_sum {
+  public:
+    void
+    add(scene::intersection const& i, ray const& ray, hdr_color const& albedo);
+
+    void
+    add_miss() { ++samples_; }
+
+    pixel_features
+    average() const;
+
+  private:
+    pixel_features sum_;
+    unsigned       samples_ = 0;
+    unsigned       hits_    = 0;
+  };
+}
+
+void
+feature_sum::add(scene::intersection const& i, ray const& ray,
+                 hdr_color const& albedo) {
+  if (samples_++ == 0)
+    sum_.solid = int(i.solid_id());
+  if (int(i.solid_id()) != sum_.solid)
+    return;
+
+  sum_.normal += i.normal().get();
+  sum_.depth  += (i.position() - ray.origin()).norm();
+  sum_.albedo += albedo;
+  ++hits_;
+}
+
+pixel_features
+feature_sum::average() const {
+  pixel_features result = sum_;
+  if (hits_ > 0) {
+    result.normal.normalize();
+    result.depth  /= hits_;
+    result.albedo /= real(hits_);
+  }
+  return result;
+}
+
+namespace {
+  // The region a ray stands for, as a cone about it: width across at the ray's
+  // origin, growing by spread per unit of distance along it. Used to filter
+  // textures.
+  struct ray_cone {
+    real width;
+    real spread;
+
+    real
+    width_at(real distance) const { return width + spread * distance; }
+  };
+}
+
+// Shading is specialised for whether reflected rays are traced at all; see
+// has_reflections. features, if given, collects the first hit of a camera ray.
+template <bool Reflections>
 static hdr_color
-do_shade(scene const& scene, ray const& ray, shading_policy const& policy,
-         unsigned depth, double importance, sampler_prng_engine& prng)
+do_shade(scene const& scene, ray const& ray, ray_cone cone,
+         shading_policy const& policy, unsigned depth, real importance,
+         sampler& sampler, feature_sum* features)
 {
   if (!should_continue(depth, importance, policy))
     return policy.background;
 
   boost::optional<scene::intersection> i = scene.intersect_solid(ray);
-  if (!i)
+  if (!i) {
+    if (features) features->add_miss();
     return policy.background;
+  }
 
-  hdr_color result = i->texture();
+  real const footprint =
+    cone.width_at((i->position() - ray.origin()).norm());
+  hdr_color result = i->texture(policy.math, footprint);
+  if (features) features->add(*i, ray, result);
   for (light const& l : scene.lights()) {
     vector3 const light_dir{l.get_source() - i->position()};
 
@@ -85,31 +160,53 @@ do_shade(scene const& scene, ray const& ray, shading_policy const& policy,
         continue;  // Obstacle blocks direct path from light to solid
 
     result = blend_light(
-      i->solid().material(), result, i->normal(), l.color(), light_dir
+      i->solid().material(), result, i->normal(), l.color(), light_dir,
+      policy.math
     );
   }
 
+  vector2 const u = sampler.next_2d();
+
+  if (!Reflections) {
+    // The reflected ray would stop right away and see the background. Its
+    // sampler dimension has been consumed all the same, so that samplers
+    // stay in step with the general case.
+    return blend_reflection(i->solid().material(), result, policy.background);
+  }
+
   unit3 const perfect_reflection_dir = reflect(ray.direction(), i->normal());
   unit3 const reflection_dir = cos_lobe_perturb(
     perfect_reflection_dir,
     i->solid().material().specular_exponent(),
-    prng
+    u,
+    policy.math
   );
   oxatrace::ray const reflected{i->position(), reflection_dir};
-  double const reflection_importance = i->solid().material().reflectance();
-  hdr_color const reflection = do_shade(
-    scene, reflected, policy, depth + 1, reflection_importance * importance,
-    prng
+  real const reflection_importance = i->solid().material().reflectance();
+  // The reflected cone spreads as the incoming one does, as if off a flat
+  // mirror; the curvature of the surface is not taken into account.
+  hdr_color const reflection = do_shade<Reflections>(
+    scene, reflected, {footprint, cone.spread}, policy, depth + 1,
+    reflection_importance * importance, sampler, nullptr
   );
   result = blend_reflection(i->solid().material(), result, reflection);
 
   return result;
 }
 
+// Are reflected rays ever traced under given policy? The first bounce is at
+// depth 1.
+static bool
+has_reflections(shading_policy const& policy) {
+  return policy.max_depth >= 1;
+}
+
+template <bool Reflections>
 static hdr_color
-shade(scene const& scene, ray const& ray,
-      shading_policy const& policy, sampler_prng_engine& prng) {
-  return do_shade(scene, ray, policy, 0, 1.0, prng);
+shade(scene const& scene, ray const& ray, real spread,
+      shading_policy const& policy, sampler& sampler, feature_sum* features) {
+  return do_shade<Reflections>(scene, ray, {0, spread}, policy, 0, 1.0,
+                               sampler, features);
 }
 
 // A subpixel is subdivided into four further subpixels, like so:
@@ -134,42 +231,76 @@ shade(scene const& scene, ray const& ray,
 // any need to sample it again.
 
 namespace {
+  // Side of pixel_samples that is only known at run time.
+  constexpr unsigned DYNAMIC_SIDE = 0;
+
+  struct pixel_sample {
+    hdr_color value;
+    unsigned  weight;
+  };
+
+  // Storage for the side x side samples of a pixel. For sides known at compile
+  // time, this is an array, so that pixel_samples can live on the stack.
+  template <unsigned Side>
+  class sample_storage {
+  public:
+    void reset(unsigned side);
+
+    pixel_sample*       data()       { return samples_.data(); }
+    pixel_sample const* data() const { return samples_.data(); }
+    unsigned            side() const { return Side; }
+
+  private:
+    std::array<pixel_sample, Side * Side> samples_;
+  };
+
+  // Other sides use a vector, which is kept around in each thread so that it
+  // isn't reallocated for every pixel. Only one such storage may exist in a
+  // thread at a time.
+  template <>
+  class sample_storage<DYNAMIC_SIDE> {
+  public:
+    void reset(unsigned side);
+
+    pixel_sample*       data()       { return samples_.data(); }
+    pixel_sample const* data() const { return samples_.data(); }
+    unsigned            side() const { return side_; }
+
+  private:
+    static thread_local std::vector<pixel_sample> samples_;
+    unsigned side_ = 0;
+  };
+
+  template <unsigned Side>
   class subpixel_ref;
 
   // This is a container for pixel subsamples. The bulk of the job is handled
   // by subpixel.
+  template <unsigned Side>
   class pixel_samples {
   public:
-    struct sample {
-      hdr_color value;
-      unsigned  weight;
-    };
-    
-    using sample_list = std::vector<sample>;
-
-    pixel_samples();
-    pixel_samples(rectangle pixel, unsigned side);
+    using sample = pixel_sample;
 
     void reset(rectangle pixel, unsigned side);
     
-    sample_list::reference  at(unsigned x, unsigned y);
-    sample_list::value_type at(unsigned x, unsigned y) const;
+    sample& at(unsigned x, unsigned y);
+    sample  at(unsigned x, unsigned y) const;
     
-    sample_list::reference add(vector2 point, sample sample);
+    sample& add(vector2 point, sample sample);
 
-    sample_list::const_iterator begin() const { return samples_.begin(); }
-    sample_list::const_iterator end() const   { return samples_.end(); }
-    sample_list::size_type      size() const  { return samples_.size(); }
+    sample const* begin() const { return storage_.data(); }
+    sample const* end() const   { return storage_.data() + size(); }
+    unsigned      size() const  { return side() * side(); }
 
     rectangle region() const { return region_; }
-    unsigned  side() const   { return side_; }
+    unsigned  side() const   { return storage_.side(); }
 
   private:
-    sample_list samples_;
-    rectangle   region_;
-    unsigned    side_;
+    sample_storage<Side> storage_;
+    rectangle            region_;
   };
 
+  template <unsigned Side>
   class subpixel_ref {
   public:
     static unsigned constexpr top_left     = 0;
@@ -180,11 +311,11 @@ namespace {
       top_left, top_right, bottom_left, bottom_right
     }};
 
-    subpixel_ref(pixel_samples& samples);
-    subpixel_ref(pixel_samples& samples,
+    subpixel_ref(pixel_samples<Side>& samples);
+    subpixel_ref(pixel_samples<Side>& samples,
                  unsigned x, unsigned y, unsigned side);
 
-    boost::optional<pixel_samples::sample&>
+    boost::optional<pixel_sample&>
     get_any();
 
     unsigned total_weight() const;
@@ -195,67 +326,81 @@ namespace {
     subpixel_ref corner(unsigned corner) const;
 
   private:
-    pixel_samples& samples_;
-    unsigned       offset_x_, offset_y_;
-    unsigned       side_;
+    pixel_samples<Side>& samples_;
+    unsigned             offset_x_, offset_y_;
+    unsigned             side_;
   };
 }
 
-pixel_samples::pixel_samples()
-  : side_{0}
-{ }
+template <unsigned Side>
+void
+sample_storage<Side>::reset(unsigned side) {
+  assert(side == Side);
+  (void) side;
 
-pixel_samples::pixel_samples(rectangle pixel, unsigned supersampling)
-  : pixel_samples()
-{
-  reset(pixel, supersampling);
+  // Unsampled slots end up with weight 0 and are still summed up, so their
+  // values must be finite.
+  samples_.fill({{0.0, 0.0, 0.0}, 0});
+}
+
+thread_local std::vector<pixel_sample> sample_storage<DYNAMIC_SIDE>::samples_;
+
+void
+sample_storage<DYNAMIC_SIDE>::reset(unsigned side) {
+  samples_.assign(side * side, {{0.0, 0.0, 0.0}, 0});
+  side_ = side;
 }
 
+template <unsigned Side>
 void
-pixel_samples::reset(rectangle pixel, unsigned side) {
+pixel_samples<Side>::reset(rectangle pixel, unsigned side) {
   assert(is_power2(side));
   
-  samples_.clear();
-  samples_.resize(side * side);
+  storage_.reset(side);
   region_ = pixel;
-  side_ = side;
 }
 
+template <unsigned Side>
 auto
-pixel_samples::at(unsigned x, unsigned y) -> sample_list::reference {
-  return samples_[y * side_ + x];
+pixel_samples<Side>::at(unsigned x, unsigned y) -> sample& {
+  return storage_.data()[y * side() + x];
 }
 
+template <unsigned Side>
 auto
-pixel_samples::at(unsigned x, unsigned y) const -> sample_list::value_type {
-  return samples_[y * side_ + x];
+pixel_samples<Side>::at(unsigned x, unsigned y) const -> sample {
+  return storage_.data()[y * side() + x];
 }
 
+template <unsigned Side>
 auto
-pixel_samples::add(vector2 point, sample sample) -> sample_list::reference {
+pixel_samples<Side>::add(vector2 point, sample sample) -> pixel_sample& {
   vector2 const offset = point - region_.top_left();
   assert(offset.x() >= 0.0 && offset.x() < region_.width());
   assert(offset.y() >= 0.0 && offset.y() < region_.height());
 
-  unsigned const x = (unsigned) (offset.x() * side_ / region_.width());
-  unsigned const y = (unsigned) (offset.y() * side_ / region_.height());
+  unsigned const x = (unsigned) (offset.x() * side() / region_.width());
+  unsigned const y = (unsigned) (offset.y() * side() / region_.height());
 
-  assert(x < side_);
-  assert(y < side_);
+  assert(x < side());
+  assert(y < side());
   
-  assert(samples_[y * side_ + x].weight == 0);
-  samples_[y * side_ + x] = sample;
+  assert(at(x, y).weight == 0);
+  at(x, y) = sample;
 
-  return samples_[y * side_ + x];
+  return at(x, y);
 }
 
-decltype(subpixel_ref::corners) constexpr subpixel_ref::corners;
+template <unsigned Side>
+decltype(subpixel_ref<Side>::corners) constexpr subpixel_ref<Side>::corners;
 
-subpixel_ref::subpixel_ref(pixel_samples& samples)
+template <unsigned Side>
+subpixel_ref<Side>::subpixel_ref(pixel_samples<Side>& samples)
   : subpixel_ref(samples, 0, 0, samples.side()) { }
 
-subpixel_ref::subpixel_ref(pixel_samples& samples, unsigned x, unsigned y,
-                   unsigned side)
+template <unsigned Side>
+subpixel_ref<Side>::subpixel_ref(pixel_samples<Side>& samples,
+                                 unsigned x, unsigned y, unsigned side)
   : samples_{samples}
   , offset_x_{x}
   , offset_y_{y}
@@ -267,8 +412,9 @@ subpixel_ref::subpixel_ref(pixel_samples& samples, unsigned x, unsigned y,
   assert(within(region(), samples_.region()));
 }
 
-boost::optional<pixel_samples::sample&>
-subpixel_ref::get_any() {
+template <unsigned Side>
+boost::optional<pixel_sample&>
+subpixel_ref<Side>::get_any() {
   for (unsigned x = offset_x_; x < offset_x_ + side_; ++x)
     for (unsigned y = offset_y_; y < offset_y_ + side_; ++y) {
       auto& sample = samples_.at(x, y);
@@ -278,8 +424,9 @@ subpixel_ref::get_any() {
   return {};
 }
 
+template <unsigned Side>
 unsigned
-subpixel_ref::total_weight() const {
+subpixel_ref<Side>::total_weight() const {
   unsigned weight{};
   for (unsigned x = offset_x_; x < offset_x_ + side_; ++x)
     for (unsigned y = offset_y_; y < offset_y_ + side_; ++y)
@@ -287,19 +434,28 @@ subpixel_ref::total_weight() const {
   return weight;
 }
 
+// Region of the subpixel of given side at (x, y) of a pixel divided into
+// samples_side^2 samples.
+static rectangle
+subpixel_region(rectangle pixel, unsigned samples_side,
+                unsigned x, unsigned y, unsigned side) {
+  real const w = pixel.width() / samples_side;
+  real const h = pixel.height() / samples_side;
+  real const width = side * w;
+  real const height = side * h;
+  return {pixel.x() + x * w, pixel.y() + y * h, width, height};
+}
+
+template <unsigned Side>
 rectangle
-subpixel_ref::region() const {
-  double const w = samples_.region().width() / samples_.side();
-  double const h = samples_.region().height() / samples_.side();
-  double const width = side_ * w;
-  double const height = side_ * h;
-  double const x = samples_.region().x() + offset_x_ * w;
-  double const y = samples_.region().y() + offset_y_ * h;
-  return {x, y, width, height};
-}
-
-subpixel_ref
-subpixel_ref::corner(unsigned c) const {
+subpixel_ref<Side>::region() const {
+  return subpixel_region(samples_.region(), samples_.side(),
+                         offset_x_, offset_y_, side_);
+}
+
+template <unsigned Side>
+auto
+subpixel_ref<Side>::corner(unsigned c) const -> subpixel_ref {
   assert(c >= corners.front() && c <= corners.back());
   assert(side_ > 1);
 
@@ -309,56 +465,95 @@ subpixel_ref::corner(unsigned c) const {
 }
 
 namespace {
-  // Result of sampling a point in a pixel.
-  struct sample_result {
-    hdr_color color;
-    vector2   point;  // The point the sample was taken from, relative to the
-                      // pixel's top left corner.
+  // The camera rays of the pixel being sampled. The first count of them were
+  // generated ahead, together with those of the neighbouring pixels; see
+  // sample_row. Rays of later samples are made as they are needed.
+  struct pixel_rays {
+    std::uint64_t    pixel;      // Number of the pixel, as given to sampler.
+    ray_batch const& batch;
+    real const*      u;          // Film positions of the rays in batch.
+    real const*      v;
+    std::size_t      first;      // Index of the pixel's first ray in batch.
+    std::uint32_t    count;
+    real             spread;     // Of the cone of each ray; see ray_cone.
+    std::uint32_t    taken = 0;  // Samples taken from the pixel so far.
   };
 }
 
-// Take exactly one sample from the given pixel. Selects a point uniformly
-// randomly from within the pixel and traces a ray through it.
-static pixel_samples::sample&
-sample_one(scene const& scene, camera const& cam, rectangle pixel,
-           shading_policy const& policy, unsigned weight,
-           pixel_samples& samples,
-           sampler_prng_engine& prng)
-{
-  double const x_mu = pixel.width() / 2;
-  double const y_mu = pixel.height() / 2;
+// Point at which to sample the given region: within its central half, as
+// given by u, or its centre if not jittering.
+template <bool Jitter>
+static vector2
+film_point(rectangle region, vector2 u) {
+  real const x_mu = region.width() / 2;
+  real const y_mu = region.height() / 2;
 
-  double const x_w = pixel.width() / 4;
-  double const y_w = pixel.height() / 4;
-  
-  std::uniform_real_distribution<> x_jitter_distrib{-x_w, +x_w};
-  std::uniform_real_distribution<> y_jitter_distrib{-y_w, +y_w};
+  real const x_w = region.width() / 2;
+  real const y_w = region.height() / 2;
 
   vector2 const offset =
-    policy.jitter
-      ? vector2{x_mu + x_jitter_distrib(prng), y_mu + y_jitter_distrib(prng)}
+    Jitter
+      ? vector2{x_mu + (u.x() - 0.5) * x_w, y_mu + (u.y() - 0.5) * y_w}
       : vector2{x_mu, y_mu}
       ;
-  vector2 const point = pixel.top_left() + offset;
-  hdr_color const color = shade(scene, cam.make_ray(point), policy, prng);
+  return region.top_left() + offset;
+}
+
+// The functions below are instantiated for each combination of jittering,
+// reflections and supersampling level; see sample_functions.
+
+// Take exactly one sample from the given pixel. Selects a point from within the
+// central half of the pixel, as given by the sampler, and traces a ray through
+// it.
+template <bool Jitter, bool Reflections, unsigned Side>
+static pixel_sample&
+sample_one(scene const& scene, camera const& cam, rectangle pixel,
+           shading_policy const& policy, unsigned weight,
+           pixel_samples<Side>& samples,
+           sampler& sampler, pixel_rays& rays, feature_sum* features)
+{
+  sampler.start_sample();
+  std::uint32_t const index = rays.taken++;
+
+  if (index < rays.count) {
+    std::size_t const i = rays.first + index;
+    vector2 const point{rays.u[i], rays.v[i]};
+    assert(point.x() >= pixel.x() && point.x() < pixel.x() + pixel.width());
+    assert(point.y() >= pixel.y() && point.y() < pixel.y() + pixel.height());
+
+    hdr_color const color =
+      shade<Reflections>(scene, rays.batch[i], rays.spread, policy, sampler,
+                         features);
+    return samples.add(point, {color, weight});
+  }
+
+  vector2 const point =
+    film_point<Jitter>(pixel, Jitter ? sampler.film_2d(rays.pixel, index)
+                                     : vector2{});
+  hdr_color const color =
+    shade<Reflections>(scene, cam.make_ray(point), rays.spread, policy,
+                       sampler, features);
 
   return samples.add(point, {color, weight});
 }
-
 // Sample a rectangular sub-pixel, recursing as necessary.
+template <bool Jitter, bool Reflections, unsigned Side>
 static void
 subpixel_sample(scene const& scene, camera const& cam,
-                shading_policy const& policy, subpixel_ref pixel,
-                pixel_samples& samples, sampler_prng_engine& prng)
+                shading_policy const& policy, subpixel_ref<Side> pixel,
+                pixel_samples<Side>& samples, sampler& sampler,
+                pixel_rays& rays, feature_sum* features)
 {
   unsigned const weight = pixel.side() * pixel.side();
   unsigned const weight_4 = weight / 4;
 
   if (pixel.side() == 1) {
     // No further subdivision of this subpixel.
-    boost::optional<pixel_samples::sample&> sample = pixel.get_any();
+    boost::optional<pixel_sample&> sample = pixel.get_any();
     if (!sample)
-      sample_one(scene, cam, pixel.region(), policy, weight, samples, prng);
+      sample_one<Jitter, Reflections>(scene, cam, pixel.region(), policy,
+                                      weight, samples, sampler, rays,
+                                      features);
     else
       sample->weight = weight;
 
@@ -371,13 +566,15 @@ subpixel_sample(scene const& scene, camera const& cam,
   hdr_color min{max_channel, max_channel, max_channel};
   hdr_color max{min_channel, min_channel, min_channel};
 
-  for (auto corner_index : subpixel_ref::corners) {
-    subpixel_ref corner = pixel.corner(corner_index);
-    boost::optional<pixel_samples::sample&> sample = corner.get_any();
+  for (auto corner_index : subpixel_ref<Side>::corners) {
+    subpixel_ref<Side> corner = pixel.corner(corner_index);
+    boost::optional<pixel_sample&> sample = corner.get_any();
 
     if (!sample)
-      sample = sample_one(scene, cam, corner.region(), policy,
-                          weight_4, samples, prng);
+      sample = sample_one<Jitter, Reflections>(
+        scene, cam, corner.region(), policy, weight_4, samples, sampler,
+        rays, features
+      );
     else
       sample->weight = weight_4;
     
@@ -394,25 +591,35 @@ subpixel_sample(scene const& scene, camera const& cam,
 
   assert(pixel.total_weight() == weight);
 
-  double const max_distance = 0.2;
-  double const dist = distance(min, max);
+  real const max_distance = 0.2;
+  real const dist = distance(min, max);
 
   if (dist > max_distance) {
-    for (auto corner_index : subpixel_ref::corners)
-      subpixel_sample(scene, cam, policy, pixel.corner(corner_index),
-                      samples, prng);
+    for (auto corner_index : subpixel_ref<Side>::corners)
+      subpixel_sample<Jitter, Reflections>(
+        scene, cam, policy, pixel.corner(corner_index), samples, sampler,
+        rays, features
+      );
   } 
 }
 
-hdr_color
-oxatrace::sample(scene const& scene, camera const& cam, rectangle pixel,
-                 shading_policy const& policy, sampler_prng_engine& prng) {
-  static thread_local pixel_samples samples;
+template <bool Jitter, bool Reflections, unsigned Side>
+static hdr_color
+sample_pixel(scene const& scene, camera const& cam, rectangle pixel,
+             shading_policy const& policy, sampler& sampler, pixel_rays& rays,
+             pixel_features* features) {
+  pixel_samples<Side> samples;
   samples.reset(pixel, policy.supersampling);
-  subpixel_sample(scene, cam, policy, {samples}, samples, prng);
+
+  feature_sum sums;
+  subpixel_sample<Jitter, Reflections>(scene, cam, policy, {samples}, samples,
+                                       sampler, rays,
+                                       features ? &sums : nullptr);
+  if (features)
+    *features = sums.average();
 
   assert(std::accumulate(samples.begin(), samples.end(), 0u,
-                         [] (unsigned accum, pixel_samples::sample s) {
+                         [] (unsigned accum, pixel_sample s) {
                            return accum + s.weight;
                          }) == samples.size());
 
@@ -422,3 +629,147 @@ oxatrace::sample(scene const& scene, camera const& cam, rectangle pixel,
 
   return sum / samples.size();
 }
+
+// Regions of the samples every pixel starts with, in the order in which
+// subpixel_sample takes them: the whole pixel if there's no supersampling,
+// otherwise its four corners. Returns their number.
+static unsigned
+initial_regions(rectangle pixel, unsigned supersampling,
+                std::array<rectangle, 4>& regions) {
+  if (supersampling == 1) {
+    regions[0] = subpixel_region(pixel, 1, 0, 0, 1);
+    return 1;
+  }
+
+  unsigned const s = supersampling / 2;
+  for (unsigned c = 0; c < 4; ++c)
+    regions[c] = subpixel_region(pixel, supersampling, s * (c % 2), s * (c / 2),
+                                 s);
+  return 4;
+}
+
+// Sample one row of a tile. The camera rays of the samples each pixel starts
+// with are made all at once first, then the pixels are traced one by one.
+template <bool Jitter, bool Reflections, unsigned Side>
+static void
+sample_row(scene const& scene, camera const& cam, tile const& t,
+           std::size_t y, shading_policy const& policy, sampler& sampler,
+           std::uint64_t first_pixel, film_crop const& crop, hdr_image& image,
+           feature_image* features) {
+  // Kept between calls, so that they're only allocated once per thread.
+  static thread_local std::vector<real> u;
+  static thread_local std::vector<real> v;
+  static thread_local ray_batch rays;
+
+  // Pixels of the image on the film.
+  real const pixel_width  = 1.0 / crop.frame_width;
+  real const pixel_height = 1.0 / crop.frame_height;
+  auto pixel_at = [&] (std::size_t x) {
+    return rectangle{real(x + crop.x) / real(crop.frame_width),
+                     real(y + crop.y) / real(crop.frame_height),
+                     pixel_width, pixel_height};
+  };
+  auto pixel_number = [&] (std::size_t x) {
+    return first_pixel + (y + crop.y) * crop.frame_width + x + crop.x;
+  };
+
+  u.clear();
+  v.clear();
+  std::array<rectangle, 4> regions;
+  unsigned per_pixel = 0;
+  for (std::size_t x = t.x; x < t.x + t.width; ++x) {
+    per_pixel = initial_regions(pixel_at(x), policy.supersampling, regions);
+    for (unsigned i = 0; i < per_pixel; ++i) {
+      vector2 const point = film_point<Jitter>(
+        regions[i], Jitter ? sampler.film_2d(pixel_number(x), i) : vector2{}
+      );
+      u.push_back(point.x());
+      v.push_back(point.y());
+    }
+  }
+
+  cam.make_rays(u.size(), u.data(), v.data(), rays);
+
+  // With supersampling, a pixel is covered by at least its four corners'
+  // samples, each standing for a quarter of it.
+  real const spread = cam.pixel_spread(crop.frame_height)
+    / (policy.supersampling > 1 ? 2 : 1);
+
+  for (std::size_t x = t.x; x < t.x + t.width; ++x) {
+    pixel_rays pixel{pixel_number(x), rays, u.data(), v.data(),
+                     (x - t.x) * per_pixel, per_pixel, spread};
+    sampler.start_pixel(pixel.pixel);
+    image.pixel_at(x, y) = sample_pixel<Jitter, Reflections, Side>(
+      scene, cam, pixel_at(x), policy, sampler, pixel,
+      features ? &features->pixel_at(x, y) : nullptr
+    );
+  }
+}
+
+template <bool Jitter, bool Reflections, unsigned Side>
+static void
+sample_tile(scene const& scene, camera const& cam, tile const& t,
+            shading_policy const& policy, sampler& sampler,
+            std::uint64_t first_pixel, film_crop const& crop, hdr_image& image,
+            feature_image* features) {
+  for (std::size_t y = t.y; y < t.y + t.height; ++y)
+    sample_row<Jitter, Reflections, Side>(scene, cam, t, y, policy, sampler,
+                                          first_pixel, crop, image, features);
+}
+
+namespace {
+  using sample_function = void (*)(scene const&, camera const&, tile const&,
+                                   shading_policy const&, sampler&,
+                                   std::uint64_t, film_crop const&, hdr_image&,
+                                   feature_image*);
+
+  // Supersampling levels with a specialisation of their own are 1, 2, 4, ...,
+  // 2^(SPECIALISED_SIDES - 1). All others share a general one.
+  constexpr unsigned SPECIALISED_SIDES = 4;
+
+  using side_table = std::array<sample_function, SPECIALISED_SIDES + 1>;
+
+  template <bool Jitter, bool Reflections>
+  constexpr side_table
+  sample_functions() {
+    return {{
+      sample_tile<Jitter, Reflections, 1>,
+      sample_tile<Jitter, Reflections, 2>,
+      sample_tile<Jitter, Reflections, 4>,
+      sample_tile<Jitter, Reflections, 8>,
+      sample_tile<Jitter, Reflections, DYNAMIC_SIDE>
+    }};
+  }
+
+  // Indexed by [jitter][reflections][side], where side is the binary
+  // logarithm of the supersampling level, or SPECIALISED_SIDES for the
+  // general case.
+  std::array<std::array<side_table, 2>, 2> const dispatch_table{{
+    {{sample_functions<false, false>(), sample_functions<false, true>()}},
+    {{sample_functions<true, false>(),  sample_functions<true, true>()}}
+  }};
+}
+
+static unsigned
+side_index(unsigned supersampling) {
+  for (unsigned i = 0; i < SPECIALISED_SIDES; ++i)
+    if (supersampling == 1u << i)
+      return i;
+  return SPECIALISED_SIDES;
+}
+
+void
+oxatrace::sample_tile(scene const& scene, camera const& cam, tile const& t,
+                      shading_policy const& policy, sampler& sampler,
+                      std::uint64_t first_pixel, film_crop const& crop,
+                      hdr_image& image, feature_image* features) {
+  assert(t.x + t.width <= image.width());
+  assert(t.y + t.height <= image.height());
+  assert(!features || (features->width() == image.width()
+                       && features->height() == image.height()));
+
+  sample_function const f =
+    dispatch_table[policy.jitter][has_reflections(policy)]
+                  [side_index(policy.supersampling)];
+  f(scene, cam, t, policy, sampler, first_pixel, crop, image, features);
+}
@@ -2,9 +2,13 @@
 #define OXATRACE_SHADER_HPP
 
 #include "color.hpp"
+#include "features.hpp"
+#include "image.hpp"
 #include "math.hpp"
+#include "tiles.hpp"
 
-#include <random>
+#include <cstddef>
+#include <cstdint>
 
 namespace oxatrace {
 
@@ -19,19 +23,52 @@ namespace oxatrace {
 struct shading_policy {
   hdr_color background     = {0.0, 0.0, 0.0};
   unsigned  max_depth      = 16;
-  double    min_importance = EPSILON;
+  real      min_importance = EPSILON;
   bool      jitter         = true;
   unsigned  supersampling  = 2;
+  math_mode math           = math_mode::exact;
 };
 
 class scene;
 class camera;
-using sampler_prng_engine = random_eng;
+class sampler;
 
-// Sample a pixel of the image.
-hdr_color
-sample(scene const& scene, camera const& cam, rectangle pixel,
-       shading_policy const& policy, sampler_prng_engine& prng);
+// Which part of the camera's film an image holds: The film is divided into
+// frame_width x frame_height pixels, and pixel (x, y) of the image is pixel
+// (x + this->x, y + this->y) of the film. Rendering a frame in crops gives the
+// same pixels as rendering it whole.
+struct film_crop {
+  std::size_t frame_width;
+  std::size_t frame_height;
+  std::size_t x = 0;
+  std::size_t y = 0;
+};
+
+// Sample the pixels of a tile of image, which holds the given crop of the
+// film.
+//
+// Pixel (x, y) of the film is known to the sampler as pixel number
+// first_pixel + y * crop.frame_width + x. If features is given, the features
+// of each pixel are stored there as well; they are taken from the first hits
+// of the camera rays, so that they come at no extra cost.
+//
+// The first camera rays of all pixels of a row of the tile are generated
+// together, through camera::make_rays.
+void
+sample_tile(scene const& scene, camera const& cam, tile const& t,
+            shading_policy const& policy, sampler& sampler,
+            std::uint64_t first_pixel, film_crop const& crop, hdr_image& image,
+            feature_image* features = nullptr);
+
+// Sample the pixels of a tile of image, which holds the whole film.
+inline void
+sample_tile(scene const& scene, camera const& cam, tile const& t,
+            shading_policy const& policy, sampler& sampler,
+            std::uint64_t first_pixel, hdr_image& image,
+            feature_image* features = nullptr) {
+  sample_tile(scene, cam, t, policy, sampler, first_pixel,
+              {image.width(), image.height()}, image, features);
+}
 
 }
 
@@ -0,0 +1,159 @@
+#include "sampler.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+using namespace oxatrace;
+
+// The following helpers follow Burley's paper closely; see the paper for the
+// reasoning behind the magic constants.
+
+static std::uint32_t
+reverse_bits(std::uint32_t x) {
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+  x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+// Hash-based permutation in which each bit only depends on the bits below it.
+static std::uint32_t
+laine_karras_permutation(std::uint32_t x, std::uint32_t seed) {
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+// Owen scrambling: each bit only depends on the bits above it.
+static std::uint32_t
+nested_uniform_scramble(std::uint32_t x, std::uint32_t seed) {
+  return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+static std::uint32_t
+hash_combine(std::uint32_t seed, std::uint32_t v) {
+  return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+// Integer hash with good avalanche; from Chris Wellons' hash prospector.
+static std::uint32_t
+hash(std::uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x21f0aaadu;
+  x ^= x >> 15;
+  x *= 0x735a2d97u;
+  x ^= x >> 15;
+  return x;
+}
+
+static std::uint32_t
+pixel_hash(std::uint32_t seed, std::uint64_t pixel) {
+  return hash(hash_combine(hash_combine(seed, std::uint32_t(pixel)),
+                           std::uint32_t(pixel >> 32)));
+}
+
+// First two dimensions of the Sobol sequence. The first one is the van der
+// Corput sequence; the second one is generated by the direction numbers
+// v_0 = 2^31, v_i = v_{i-1} ^ (v_{i-1} >> 1).
+static std::uint32_t
+sobol_0(std::uint32_t index) {
+  return reverse_bits(index);
+}
+
+static std::uint32_t
+sobol_1(std::uint32_t index) {
+  std::uint32_t result = 0;
+  for (std::uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+    if (index & 1)
+      result ^= v;
+  return result;
+}
+
+// Convert to real in [0, 1). Rounding could otherwise give 1 in single
+// precision.
+static real
+to_unit(double x) {
+  real const below_one = 1 - std::numeric_limits<real>::epsilon() / 2;
+  return std::min(real(x), below_one);
+}
+
+static real
+to_unit(std::uint32_t x) {
+  return to_unit(x * (1.0 / 4294967296.0));
+}
+
+random_sampler::random_sampler(std::uint32_t seed)
+  : seed_{seed} { }
+
+void
+random_sampler::start_pixel(std::uint64_t pixel) {
+  prng_.seed(pixel_hash(seed_, pixel));
+}
+
+vector2
+random_sampler::next_2d() {
+  std::uniform_real_distribution<> distrib;
+  real const u = to_unit(distrib(prng_));
+  real const v = to_unit(distrib(prng_));
+  return {u, v};
+}
+
+vector2
+random_sampler::film_2d(std::uint64_t pixel, std::uint32_t sample) const {
+  std::uint32_t const u = hash(hash_combine(pixel_hash(seed_, pixel), sample));
+  return {to_unit(u), to_unit(hash(u))};
+}
+
+sobol_sampler::sobol_sampler(std::uint32_t seed)
+  : seed_{hash(seed)} { }
+
+void
+sobol_sampler::start_pixel(std::uint64_t pixel) {
+  pixel_seed_ = pixel_hash(seed_, pixel);
+  next_sample_ = 0;
+}
+
+void
+sobol_sampler::start_sample() {
+  sample_index_ = next_sample_++;
+  dimension_ = 1;  // Dimension 0 is the film one.
+}
+
+// Given dimension of given sample of the pixel whose hash is pixel_seed.
+static vector2
+sobol_2d(std::uint32_t pixel_seed, std::uint32_t sample,
+         std::uint32_t dimension) {
+  std::uint32_t const seed = hash(hash_combine(pixel_seed, dimension));
+  std::uint32_t const index = nested_uniform_scramble(sample, seed);
+
+  std::uint32_t const x =
+    nested_uniform_scramble(sobol_0(index), hash_combine(seed, 0));
+  std::uint32_t const y =
+    nested_uniform_scramble(sobol_1(index), hash_combine(seed, 1));
+  return {to_unit(x), to_unit(y)};
+}
+
+vector2
+sobol_sampler::next_2d() {
+  return sobol_2d(pixel_seed_, sample_index_, dimension_++);
+}
+
+vector2
+sobol_sampler::film_2d(std::uint64_t pixel, std::uint32_t sample) const {
+  return sobol_2d(pixel_hash(seed_, pixel), sample, 0);
+}
+
+std::unique_ptr<sampler>
+oxatrace::make_sampler(std::string const& name, std::uint32_t seed) {
+  if (name == "random")
+    return std::make_unique<random_sampler>(seed);
+  else if (name == "sobol")
+    return std::make_unique<sobol_sampler>(seed);
+  else
+    throw std::invalid_argument{"make_sampler: Unknown sampler " + name};
+}
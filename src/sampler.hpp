@@ -0,0 +1,124 @@
+#ifndef OXATRACE_SAMPLER_HPP
+#define OXATRACE_SAMPLER_HPP
+
+#include "math.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace oxatrace {
+
+// Source of sample points for the renderer.
+//
+// A sampler hands out points in the unit square [0, 1)^2. Sampling is
+// organised in pixels, each pixel consists of samples (one sample is one camera
+// ray along with all of its secondary rays), and each sample consumes a
+// sequence of 2D dimensions: The first one is used for jittering the film
+// position, each bounce then takes one for perturbing the reflected ray.
+//
+// The film dimension is given by film_2d for any pixel and sample directly, so
+// that camera rays can be generated ahead of tracing them; the remaining ones
+// are handed out in order by next_2d.
+//
+// Sampler objects are stateful and are not thread-safe; every rendering thread
+// is expected to own its own sampler.
+class sampler {
+public:
+  virtual ~sampler() { }
+
+  // Begin sampling a new pixel. pixel is any number uniquely identifying the
+  // pixel within the image.
+  virtual void
+  start_pixel(std::uint64_t pixel) = 0;
+
+  // Begin the next sample of the current pixel.
+  virtual void
+  start_sample() = 0;
+
+  // Get the next two dimensions of the current sample, starting with the one
+  // after the film dimension.
+  virtual vector2
+  next_2d() = 0;
+
+  // Get the film dimension of the given sample of the given pixel, samples
+  // being numbered from 0 in the order they are started. This doesn't depend
+  // on, or change, the current pixel or sample.
+  virtual vector2
+  film_2d(std::uint64_t pixel, std::uint32_t sample) const = 0;
+};
+
+// Independent uniformly distributed random numbers.
+//
+// This converges at the plain Monte Carlo rate and is mostly useful as a
+// reference for other samplers. The generator is reseeded for each pixel, so
+// the result doesn't depend on which thread renders which pixel. The film
+// dimension, which must not depend on the generator's state, is a hash of the
+// pixel and the sample instead.
+class random_sampler final : public sampler {
+public:
+  explicit
+  random_sampler(std::uint32_t seed);
+
+  virtual void
+  start_pixel(std::uint64_t pixel) override;
+
+  virtual void
+  start_sample() override { }
+
+  virtual vector2
+  next_2d() override;
+
+  virtual vector2
+  film_2d(std::uint64_t pixel, std::uint32_t sample) const override;
+
+private:
+  std::uint32_t seed_;
+  random_eng    prng_;
+};
+
+// Owen-scrambled Sobol sequence.
+//
+// This is the padded 2D construction from Burley's "Practical Hash-based Owen
+// Scrambling" (2020): The first two Sobol dimensions are used for every 2D
+// dimension of a sample, and the sample index as well as both coordinates are
+// scrambled by a hash of the pixel, the dimension and the seed. This keeps
+// points well stratified within every dimension while decorrelating the
+// dimensions from each other.
+//
+// Different seeds give independent, equally well distributed sequences.
+class sobol_sampler final : public sampler {
+public:
+  explicit
+  sobol_sampler(std::uint32_t seed = 0);
+
+  virtual void
+  start_pixel(std::uint64_t pixel) override;
+
+  virtual void
+  start_sample() override;
+
+  virtual vector2
+  next_2d() override;
+
+  virtual vector2
+  film_2d(std::uint64_t pixel, std::uint32_t sample) const override;
+
+private:
+  std::uint32_t seed_;
+  std::uint32_t pixel_seed_ = 0;
+  std::uint32_t next_sample_ = 0;
+  std::uint32_t sample_index_ = 0;
+  std::uint32_t dimension_ = 0;
+};
+
+// Create a sampler given its name, as used on the command line: "random" or
+// "sobol".
+//
+// Throws std::invalid_argument: Unknown sampler name.
+std::unique_ptr<sampler>
+make_sampler(std::string const& name, std::uint32_t seed);
+
+}  // namespace oxatrace
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef OXATRACE_SCALAR_HPP
+#define OXATRACE_SCALAR_HPP
+
+#include <cstdint>
+#include <cstring>
+
+namespace oxatrace {
+
+// Scalar type of geometry and colours.
+//
+// The renderer is built in double precision by default. Defining
+// OXATRACE_SINGLE_PRECISION (make precision=single) switches it to single
+// precision, which halves the size of vectors, colours and images.
+#ifdef OXATRACE_SINGLE_PRECISION
+using real = float;
+#else
+using real = double;
+#endif
+
+// Signed integer as large as real. Non-negative reals, infinity included, are
+// in the same order as their bits taken as one.
+#ifdef OXATRACE_SINGLE_PRECISION
+using real_bits = std::int32_t;
+#else
+using real_bits = std::int64_t;
+#endif
+
+// The bits of from as a To of the same size.
+//
+// These have internal linkage, unlike our other inline functions, so that
+// kernels.cpp may use them: each compilation keeps its own copy, and none
+// compiled for AVX can stand in for the rest of the program's; see
+// kernels.hpp.
+template <typename To, typename From>
+static inline To
+bit_cast(From from) noexcept {
+  static_assert(sizeof(To) == sizeof(From), "bit_cast: Sizes differ");
+  To result;
+  std::memcpy(&result, &from, sizeof(result));
+  return result;
+}
+
+static inline real_bits
+bits_of(real x) noexcept { return bit_cast<real_bits>(x); }
+
+static inline real
+real_of(real_bits bits) noexcept { return bit_cast<real>(bits); }
+
+}  // namespace oxatrace
+
+#endif
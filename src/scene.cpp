@@ -36,9 +36,11 @@ scene_definition::lights_end() const noexcept -> light_iterator {
   return lights_.end();
 }
 
-scene::intersection::intersection(ray_point const& rp, oxatrace::solid const& s)
+scene::intersection::intersection(ray_point const& rp, oxatrace::solid const& s,
+                                  std::size_t solid_id)
   : ray_point_{rp}
   , solid_{s}
+  , solid_id_{solid_id}
 { }
 
 vector3
@@ -54,8 +56,8 @@ scene::intersection::normal() const {
 }
 
 hdr_color
-scene::intersection::texture() const {
-  return solid_.texture_at(ray_point_);
+scene::intersection::texture(math_mode mode, real footprint) const {
+  return solid_.texture_at(ray_point_, mode, footprint);
 }
 
 std::unique_ptr<simple_scene>
@@ -66,10 +68,11 @@ simple_scene::make(scene_definition def) {
 boost::optional<simple_scene::intersection>
 simple_scene::intersect_solid(ray const& ray) const {
   boost::optional<intersection> result;
-  double min_param{std::numeric_limits<double>::max()};
+  real min_param{std::numeric_limits<real>::max()};
 
+  std::size_t id = 0;
   for (auto iter = definition_.solids_begin(), end = definition_.solids_end();
-       iter != end; ++iter) {
+       iter != end; ++iter, ++id) {
     solid const& solid = *iter;
     shape::intersection_list const intersections{solid.intersect(ray)};
 
@@ -79,11 +82,11 @@ simple_scene::intersect_solid(ray const& ray) const {
     // intersection.
 
     assert(std::is_sorted(intersections.begin(), intersections.end()));
-    double const param = intersections.front();
+    real const param = intersections.front();
 
     if (param < min_param) {
       min_param = param;
-      result = scene::intersection({ray, param}, solid);
+      result = scene::intersection({ray, param}, solid, id);
     }
   }
 
@@ -8,6 +8,7 @@
 #include <boost/iterator/indirect_iterator.hpp>
 #include <boost/optional.hpp>
 
+#include <cstddef>
 #include <memory>
 #include <vector>
 
@@ -78,16 +79,22 @@ public:
   // intersection itself, and the solid intersected by the ray.
   class intersection {
   public:
-    intersection(ray_point const& rp, oxatrace::solid const& s);
+    // solid_id is the index of s in the order the solids were added to the
+    // scene_definition.
+    intersection(ray_point const& rp, oxatrace::solid const& s,
+                 std::size_t solid_id);
 
     vector3 position() const;
     oxatrace::solid const& solid() const { return solid_; }
+    std::size_t solid_id() const { return solid_id_; }
     unit<vector3> normal() const;
-    hdr_color texture() const;
+    hdr_color texture(math_mode mode = math_mode::exact,
+                      real footprint = 0) const;
 
   private:
     ray_point       ray_point_;
     oxatrace::solid solid_;
+    std::size_t     solid_id_;
     mutable boost::optional<unit<vector3>> normal_;
   };
 
@@ -0,0 +1,109 @@
+#include "scenes.hpp"
+
+#include "lights.hpp"
+#include "solids.hpp"
+
+#include <memory>
+#include <stdexcept>
+
+using namespace oxatrace;
+
+static scene_definition
+two_balls(std::shared_ptr<texture> const& texture) {
+  scene_definition def;
+  auto sphere_shape = std::make_shared<oxatrace::sphere>();
+  auto plane_shape = std::make_shared<oxatrace::plane>();
+
+  std::shared_ptr<oxatrace::texture> plane_checker = texture;
+  if (!plane_checker)
+    plane_checker = std::make_shared<oxatrace::checkerboard>(
+      hdr_color{0.7, 0.7, 0.7}, hdr_color{0.8, 0.1, 0.1}
+    );
+  
+  hdr_color const sphere_color{0.4, 0.4, 0.6};
+  material const sphere_material{sphere_color, 0.4, 0.9, 200, 0.4};
+
+  auto sphere1 = std::make_unique<solid>(sphere_shape, sphere_material);
+  (*sphere1)
+    .scale(3.0)
+    .translate({0, 3, -15})
+    ;
+  def.add_solid(std::move(sphere1));
+
+  auto sphere2 = std::make_unique<solid>(sphere_shape, sphere_material);
+  (*sphere2)
+    .scale(3.0)
+    .translate({-8, 3, -15})
+    ;
+  def.add_solid(std::move(sphere2));
+
+  material const plane_material{hdr_color{0.5, 0.5, 0.5}, 0.5, 0.5, 1000, 0.2};
+  auto plane =
+    std::make_unique<solid>(plane_shape, plane_material, plane_checker);
+  (*plane)
+    .scale(3.0)
+    .rotate(angle_axis{PI / 2., vector3::UnitX()})
+    ;
+  
+  def.add_solid(std::move(plane));
+
+  def.add_light(
+    std::make_unique<point_light>(vector3{-6.0, 10.0, 8.0},
+                                  hdr_color{1.0, 1.0, 1.0})
+  );
+
+  return def;
+}
+
+static scene_definition
+textured_ball(std::shared_ptr<texture> const& texture) {
+  scene_definition def;
+  auto sphere_shape = std::make_shared<sphere>();
+  std::shared_ptr<oxatrace::texture> checker = texture;
+  if (!checker)
+    checker = std::make_shared<checkerboard>(
+      hdr_color{0.9, 0.9, 0.9}, hdr_color{0.1, 0.1, 0.9}, 8
+    );
+  material const sphere_mat{{0.0, 0.0, 0.0}, 0.6, 0.2, 20, 0.05};
+
+  auto sphere = std::make_unique<solid>(sphere_shape, sphere_mat, checker);
+  (*sphere)
+    .scale(3.0)
+    .translate({0, 3, -15})
+    ;
+
+  def.add_solid(std::move(sphere));
+
+  def.add_light(
+    std::make_unique<point_light>(
+      vector3{-6.0, 10.0, 8.0},
+      hdr_color{1.0, 1.0, 1.0}
+    )
+  );
+
+  return def;
+}
+
+std::vector<std::string>
+oxatrace::scene_names() {
+  return {"two_balls", "textured_ball"};
+}
+
+scene_definition
+oxatrace::make_scene_definition(std::string const& name,
+                                std::shared_ptr<texture> const& texture) {
+  if (name == "two_balls")
+    return two_balls(texture);
+  else if (name == "textured_ball")
+    return textured_ball(texture);
+  else
+    throw std::invalid_argument{"make_scene_definition: Unknown scene " + name};
+}
+
+shading_policy
+oxatrace::default_shading_policy() {
+  shading_policy result;
+  result.background = {0.05, 0.05, 0.2};
+  result.min_importance = 0.01;
+  return result;
+}
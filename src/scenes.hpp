@@ -0,0 +1,33 @@
+#ifndef OXATRACE_SCENES_HPP
+#define OXATRACE_SCENES_HPP
+
+#include "renderer.hpp"
+#include "scene.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace oxatrace {
+
+// Names of the built-in scenes.
+std::vector<std::string>
+scene_names();
+
+// Set up the built-in scene of given name. If texture is given, it replaces
+// the scene's own texture: the checkerboard of two_balls' plane or of
+// textured_ball's ball.
+//
+// Throws std::invalid_argument: Unknown scene.
+scene_definition
+make_scene_definition(std::string const& name,
+                      std::shared_ptr<texture> const& texture = {});
+
+// Shading policy the built-in scenes are meant to be rendered with: their
+// background colour and a sensible importance cut-off.
+shading_policy
+default_shading_policy();
+
+}  // namespace oxatrace
+
+#endif
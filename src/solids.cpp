@@ -1,6 +1,8 @@
 #include "solids.hpp"
 
 #include "color.hpp"
+#include "fast_math.hpp"
+#include "isa.hpp"
 #include "lights.hpp"
 
 #include <Eigen/Geometry>
@@ -54,29 +56,23 @@ auto sphere::intersect(ray const& ray) const -> intersection_list {
   // All real and nonnegative t's are then the sought parameters of intersection
   // for the ray formula.
 
-  double const od   = ray.origin().dot(ray.direction());
-  double const od_2 = od * od;
-  double const d_2  = ray.direction().squaredNorm();
-  double const o_2  = ray.origin().squaredNorm();
-  double const D    = od_2 - d_2 * (o_2 - 1);
+  // The equation is solved by the intersect_sphere kernel, which also drops
+  // intersections that are too close to zero. The origin itself isn't to be
+  // considered a part of the ray, and values close to it may result as a
+  // consequence of floating-point arithmetic.
 
-  if (D < 0.0) return {};
+  real t[2];
+  unsigned const count = kernels().intersect_sphere(
+    ray.origin4().data(), ray.direction4().data(), EPSILON, t
+  );
 
-  double const sqrt_D = std::sqrt(D);
-  double const t_1    = (-od - sqrt_D) / d_2;
-  double const t_2    = (-od + sqrt_D) / d_2;
+  assert(count < 2 || t[0] <= t[1]);
+  assert(count < 1 || double_eq(point_at(ray, t[0]).norm(), 1.0));
+  assert(count < 2 || double_eq(point_at(ray, t[1]).norm(), 1.0));
 
-  assert(t_1 <= t_2);
-  assert(t_1 <= EPSILON || double_eq(point_at(ray, t_1).norm(), 1.0));
-  assert(t_2 <= EPSILON || double_eq(point_at(ray, t_2).norm(), 1.0));
-
-  // Ignore intersections that are too close to zero. The origin itself isn't
-  // to be considered a part of the ray, and values close to it may result
-  // as a consequence of floating-point arithmetic.
-
-  if (t_1 > EPSILON)      return {t_1, t_2};
-  else if (t_2 > EPSILON) return {t_2};
-  else                    return {};
+  if (count == 2)      return {t[0], t[1]};
+  else if (count == 1) return {t[0]};
+  else                 return {};
 }
 
 unit3
@@ -85,7 +81,7 @@ sphere::normal_at(ray_point const& rp) const {
 }
 
 vector2
-sphere::texture_at(ray_point const& rp) const {
+sphere::texture_at(ray_point const& rp, math_mode mode) const {
   // We'll use the equations suggested at
   // http://en.wikipedia.org/wiki/UV_mapping :
   //
@@ -98,8 +94,13 @@ sphere::texture_at(ray_point const& rp) const {
   //                pi
   
   vector3 const d = -normal_at(rp).get();
-  double const u = 0.5 + atan2(d.z(), d.x()) / (2 * PI);
-  double const v = 0.5 - asin(d.y()) / PI;
+  real const theta =
+    mode == math_mode::fast ? fast_atan2(d.z(), d.x()) : atan2(d.z(), d.x());
+  real const phi =
+    mode == math_mode::fast ? fast_asin(d.y()) : asin(d.y());
+
+  real const u = std::min(std::max(0.5 + theta / (2 * PI), 0.0), 1.0);
+  real const v = std::min(std::max(0.5 - phi / PI, 0.0), 1.0);
 
   assert(0.0 <= u && u <= 1.0);
   assert(0.0 <= v && v <= 1.0);
@@ -118,7 +119,7 @@ auto plane::intersect(ray const& ray) const -> intersection_list {
 
   if (double_eq(ray.direction().z(), 0.0)) return {};
 
-  double const t = -ray.origin().z() / ray.direction().z();
+  real const t = -ray.origin().z() / ray.direction().z();
   if (t > EPSILON) return {t};
   else             return {};
 }
@@ -136,17 +137,17 @@ plane::normal_at(ray_point const& rp) const {
 }
 
 vector2
-plane::texture_at(ray_point const& rp) const {
+plane::texture_at(ray_point const& rp, math_mode) const {
   // Planes are infinite, so we'll just pretend we're texturing a square, and
   // let the texture repeat across the entire plane.
   //
   // So get the point coordinates into [0, 1]^2 by taking just the fractional
   // part of the point coordinates, and simply return that.
 
-  double dummy;
+  real dummy;
 
-  double u = std::modf(rp.point().x(), &dummy);
-  double v = std::modf(rp.point().y(), &dummy);
+  real u = std::modf(rp.point().x(), &dummy);
+  real v = std::modf(rp.point().y(), &dummy);
 
   if (u < 0.0) u += 1.0;  // Not abs, to prevent weird things as we cross 0.
   if (v < 0.0) v += 1.0;
@@ -160,18 +161,18 @@ plane::texture_at(ray_point const& rp) const {
 checkerboard::checkerboard(hdr_color a, hdr_color b, unsigned num)
   : color_a{a}
   , color_b{b}
-  , divisor_{1.0 / num}
+  , divisor_{real(1) / num}
 { }
 
 hdr_color
-checkerboard::get(double u, double v) const {
+checkerboard::get(real u, real v) const {
   bool const a = (unsigned) (u / divisor_) % 2;
   bool const b = (unsigned) (v / divisor_) % 2;
   return a != b ? color_b : color_a;
 }
 
-material::material(hdr_color const& ambient, double diffuse, double specular,
-                   unsigned specular_exponent, double reflectance)
+material::material(hdr_color const& ambient, real diffuse, real specular,
+                   unsigned specular_exponent, real reflectance)
   : ambient_{ambient}
   , diffuse_{diffuse}
   , specular_{specular} 
@@ -191,8 +192,8 @@ solid::solid(std::shared_ptr<oxatrace::shape> const& s, oxatrace::material mat,
   : shape_{s}
   , texture_{texture}
   , material_{mat}
-  , world_to_object_{Eigen::Affine3d::Identity()}
-  , object_to_world_{Eigen::Affine3d::Identity()} { }
+  , world_to_object_{affine3::Identity()}
+  , object_to_world_{affine3::Identity()} { }
 
 material const&
 solid::material() const noexcept {
@@ -211,11 +212,48 @@ solid::normal_at(ray_point const& rp) const {
   return object_to_world_.linear().transpose() * local_normal;
 }
 
+// Size in texture coordinates of a region of given radius around point local
+// on the surface of s, both in object space: the larger of the distances to
+// uv of the points radius away along two tangents. Texture coordinates wrap
+// around, so a distance is never more than a half.
+static real
+uv_footprint(shape const& s, ray_point const& local, vector2 const& uv,
+             real radius, math_mode mode) {
+  vector3 const n = s.normal_at(local).get();
+  vector3 const axis =
+    std::abs(n.x()) < 0.5 ? vector3::UnitX() : vector3::UnitY();
+  vector3 const t1 = n.cross(axis).normalized();
+  vector3 const t2 = n.cross(t1);
+
+  real result = 0;
+  for (vector3 const& t : {t1, t2}) {
+    ray const moved{local.ray().origin() + radius * t, local.ray().direction()};
+    vector2 const other = s.texture_at({moved, local.param()}, mode);
+    real du = std::abs(other[0] - uv[0]);
+    real dv = std::abs(other[1] - uv[1]);
+    du = std::min(du, 1 - du);
+    dv = std::min(dv, 1 - dv);
+    result = std::max(result, std::sqrt(du * du + dv * dv));
+  }
+  return result;
+}
+
 hdr_color
-solid::texture_at(ray_point const& rp) const {
+solid::texture_at(ray_point const& rp, math_mode mode, real footprint) const {
   if (texture_) {
-    vector2 const uv = shape_->texture_at(local_ray_point(rp));
-    return texture_->get(uv[0], uv[1]);
+    ray_point const local = local_ray_point(rp);
+    vector2 const uv = shape_->texture_at(local, mode);
+    if (footprint <= 0 || !texture_->filtered())
+      return texture_->get(uv[0], uv[1]);
+
+    // Lengths shrink into object space by the cube root of the volume the
+    // transformation scales by, exactly so if it scales all axes alike.
+    real const scale =
+      std::cbrt(std::abs(world_to_object_.linear().determinant()));
+    real const radius = footprint * scale / 2;
+    return texture_->get_filtered(
+      uv[0], uv[1], 2 * uv_footprint(*shape_, local, uv, radius, mode)
+    );
   } else {
     return material_.base_color();
   }
@@ -234,7 +272,7 @@ solid::translate(vector3 const& tr) {
 }
 
 solid&
-solid::scale(double coef) {
+solid::scale(real coef) {
   if (coef < EPSILON)
     throw std::invalid_argument{"solid::scale: coef <= 0"};
 
@@ -244,12 +282,12 @@ solid::scale(double coef) {
 }
 
 solid&
-solid::scale(double x, double y, double z) {
+solid::scale(real x, real y, real z) {
   if (x < EPSILON || y < EPSILON || z < EPSILON)
     throw std::invalid_argument{"solid::scale: x, y, or z <= 0.0"};
   
   vector3 const scale_vec{x, y, z};
-  vector3 const scale_vec_rec{1. / x, 1. / y, 1. / z};
+  vector3 const scale_vec_rec{1 / x, 1 / y, 1 / z};
 
   object_to_world_.prescale(scale_vec);
   world_to_object_.scale(scale_vec_rec);
@@ -258,15 +296,15 @@ solid::scale(double x, double y, double z) {
 }
 
 solid&
-solid::rotate(Eigen::AngleAxisd const& rot) {
+solid::rotate(angle_axis const& rot) {
   object_to_world_.prerotate(rot);
   world_to_object_.rotate(rot.inverse());
   return *this;
 }
 
 solid&
-solid::transform(Eigen::Affine3d const& tr, Eigen::Affine3d const& inverse) {
-  assert((tr * inverse).isApprox(Eigen::Affine3d::Identity()));
+solid::transform(affine3 const& tr, affine3 const& inverse) {
+  assert((tr * inverse).isApprox(affine3::Identity()));
 
   object_to_world_ = tr * object_to_world_;
   world_to_object_ = world_to_object_ * inverse;
@@ -275,8 +313,8 @@ solid::transform(Eigen::Affine3d const& tr, Eigen::Affine3d const& inverse) {
 }
 
 solid&
-solid::transform(Eigen::Affine3d const& tr) {
-  Eigen::Affine3d inverse = tr.inverse();
+solid::transform(affine3 const& tr) {
+  affine3 inverse = tr.inverse();
   return transform(tr, inverse);
 }
 
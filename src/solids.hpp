@@ -26,7 +26,7 @@ class light;
 // that accessing a shared shape is thread-safe.
 class shape {
 public:
-  using intersection_list = std::vector<double>;
+  using intersection_list = std::vector<real>;
 
   virtual
   ~shape() noexcept { }
@@ -45,7 +45,7 @@ public:
 
   // Get texture coordinates for a point on this shape.
   virtual vector2
-  texture_at(ray_point const& point) const = 0;
+  texture_at(ray_point const& point, math_mode mode) const = 0;
 };
 
 // Unit sphere centered around the origin.
@@ -58,7 +58,7 @@ public:
   normal_at(ray_point const&) const override;
 
   virtual vector2
-  texture_at(ray_point const&) const override;
+  texture_at(ray_point const&, math_mode) const override;
 };
 
 // The xy plane.
@@ -71,7 +71,7 @@ public:
   normal_at(ray_point const&) const override;
 
   virtual vector2
-  texture_at(ray_point const&) const override;
+  texture_at(ray_point const&, math_mode) const override;
 };
 
 // Texture is a map of surface colours of a solid. We support two kinds of
@@ -85,7 +85,17 @@ public:
   // Get a pixel that corresponds to coordinates (u, v). (u, v) must be in
   // [0, 1]^2; the behaviour is undefined otherwise.
   virtual hdr_color
-  get(double u, double v) const = 0;
+  get(real u, real v) const = 0;
+
+  // Get the colour of a region around (u, v) about footprint across, in the
+  // same units as u and v. Textures that aren't filtered() just get(u, v).
+  virtual hdr_color
+  get_filtered(real u, real v, real /*footprint*/) const { return get(u, v); }
+
+  // Whether get_filtered makes use of the footprint, which is otherwise not
+  // worth working out.
+  virtual bool
+  filtered() const { return false; }
 };
 
 // Checkerboard pattern computed texture.
@@ -112,11 +122,11 @@ public:
   checkerboard(hdr_color a, hdr_color b, unsigned num = 2);
 
   virtual hdr_color
-  get(double u, double v) const override;
+  get(real u, real v) const override;
 
 private:
   hdr_color color_a, color_b;
-  double divisor_;
+  real divisor_;
 };
 
 // Material defines the various visual qualities of a solid. It is responsible
@@ -129,9 +139,9 @@ public:
   // Create a Phong material.
   // Throws std::invalid_argument: diffuse, specular, or reflectance are 
   //                               outside the range [0, 1].
-  material(hdr_color const& ambient, double diffuse, double specular,
+  material(hdr_color const& ambient, real diffuse, real specular,
            unsigned specular_exponent,
-           double reflectance = 0.0);
+           real reflectance = 0.0);
 
   // Get the base colour of the material. 
   //
@@ -139,17 +149,17 @@ public:
   // light source. In other words, the ambient colour.
   hdr_color base_color() const { return ambient_; }
 
-  double reflectance() const { return reflectance_; }
-  double diffuse() const { return diffuse_; }
-  double specular() const { return specular_; }
+  real reflectance() const { return reflectance_; }
+  real diffuse() const { return diffuse_; }
+  real specular() const { return specular_; }
   unsigned specular_exponent() const { return specular_exponent_; }
 
 private:
   hdr_color ambient_;
-  double    diffuse_;
-  double    specular_;
+  real    diffuse_;
+  real    specular_;
   unsigned  specular_exponent_;
-  double    reflectance_;
+  real    reflectance_;
 };
 
 // Renderable entity.
@@ -171,8 +181,12 @@ public:
   unit3
   normal_at(ray_point const& rp) const;
 
+  // Colour of the solid at rp. footprint is the width, in world space, of the
+  // region the ray stands for there, by which filtered textures are filtered;
+  // 0 takes a single point.
   hdr_color
-  texture_at(ray_point const& rp) const;
+  texture_at(ray_point const& rp, math_mode mode = math_mode::exact,
+             real footprint = 0) const;
 
   void
   set_texture(std::shared_ptr<texture> const& new_texture);
@@ -186,29 +200,29 @@ public:
   //
   // Throws std::invalid_argument: coef <= 0.0 or any of x, y, z <= 0.0.
   solid&
-  scale(double coef);
+  scale(real coef);
   solid&
-  scale(double x, double y, double z);
+  scale(real x, real y, real z);
 
   // Rotate this solid around an axis.
   solid&
-  rotate(Eigen::AngleAxisd const& rot);
+  rotate(angle_axis const& rot);
 
   // Apply a generic transformation to this solid. If an inverse transformation
   // is provided, it needs to be correct, otherwise undefined results will
   // occur. If it isn't provided, one will be calculated by inverting the given
   // matrix.
   solid&
-  transform(Eigen::Affine3d const& tr, Eigen::Affine3d const& inverse);
+  transform(affine3 const& tr, affine3 const& inverse);
   solid&
-  transform(Eigen::Affine3d const& tr);
+  transform(affine3 const& tr);
 
 private:
   std::shared_ptr<oxatrace::shape> shape_;
   std::shared_ptr<texture>         texture_;
   oxatrace::material               material_;
-  Eigen::Affine3d                  world_to_object_;
-  Eigen::Affine3d                  object_to_world_;
+  affine3                  world_to_object_;
+  affine3                  object_to_world_;
 
   ray_point
   local_ray_point(ray_point const& global) const;
@@ -10,8 +10,8 @@ using namespace oxatrace;
 void
 progress_monitor::change_phase(std::string const& new_phase) {
   if (progressbar_active_)
-    std::cout << '\n';
-  std::cout << new_phase << '\n';
+    *out_ << '\n';
+  *out_ << new_phase << '\n';
   progressbar_active_ = false;
   last_progress_ = boost::none;
 }
@@ -28,15 +28,15 @@ progress_monitor::update_progress(double progress) {
   if (!last_progress_ ||
       std::abs(progress - *last_progress_) >= LEAST_INCREMENT ||
       double_eq(progress, 1.0)) {
-    std::cout << '\r'
-              << std::fixed << std::setprecision(PRECISION)
-              << std::setw(DIGITS) << std::setfill(' ')
-              << progress * 100 << "% [";
+    *out_ << '\r'
+          << std::fixed << std::setprecision(PRECISION)
+          << std::setw(DIGITS) << std::setfill(' ')
+          << progress * 100 << "% [";
 
     unsigned const prog = round<unsigned>(progress * WIDTH);
-    for (unsigned i = 0; i < prog; ++i) std::cout << '#';
-    for (unsigned i = prog; i < WIDTH; ++i) std::cout << ' ';
-    std::cout << ']' << std::flush;
+    for (unsigned i = 0; i < prog; ++i) *out_ << '#';
+    for (unsigned i = prog; i < WIDTH; ++i) *out_ << ' ';
+    *out_ << ']' << std::flush;
 
     last_progress_ = progress;
     progressbar_active_ = true;
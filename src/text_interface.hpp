@@ -1,6 +1,7 @@
 #ifndef OXATRACE_TEXT_INTERFACE_HPP
 #define OXATRACE_TEXT_INTERFACE_HPP
 
+#include <iostream>
 #include <string>
 
 #include <boost/optional.hpp>
@@ -14,6 +15,11 @@ namespace oxatrace {
 // change resets progress back to zero.
 class progress_monitor {
 public:
+  // Report to out.
+  explicit
+  progress_monitor(std::ostream& out = std::cout)
+    : out_{&out} { }
+
   void
   change_phase(std::string const& new_phase);
 
@@ -24,6 +30,7 @@ private:
   static constexpr unsigned WIDTH = 40;
   static constexpr unsigned PRECISION = 2;
 
+  std::ostream*             out_;
   bool                      progressbar_active_ = false;
   boost::optional<double>   last_progress_;
 };
@@ -0,0 +1,298 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+
+using namespace oxatrace;
+
+bool
+task_context::idle_workers() const noexcept {
+  return pool_.idle_ > 0 && pool_.queued_ == 0;
+}
+
+thread_pool::thread_pool(unsigned threads,
+                         std::vector<numa_node> const& nodes, bool pin)
+  : nodes_(nodes)
+{
+  if (threads == 0)
+    throw std::out_of_range{"thread_pool: Can't do 0 threads"};
+  if (nodes_.empty())
+    nodes_.push_back({0, {}});
+  pin = pin && nodes.size() > 0;
+
+  for (unsigned i = 0; i < threads; ++i) {
+    deques_.push_back(std::make_unique<worker_deque>());
+    worker_node_.push_back(std::uint64_t(i) * nodes_.size() / threads);
+  }
+
+  // Neighbours on the same node first, then everyone else, each in the order
+  // following the thief.
+  for (unsigned i = 0; i < threads; ++i) {
+    std::vector<unsigned> victims;
+    for (bool same_node : {true, false})
+      for (unsigned j = 1; j < threads; ++j) {
+        unsigned const victim = (i + j) % threads;
+        if ((worker_node_[victim] == worker_node_[i]) == same_node)
+          victims.push_back(victim);
+      }
+    victims_.push_back(std::move(victims));
+  }
+
+  idle_ = threads;
+  for (unsigned i = 0; i < threads; ++i)
+    workers_.emplace_back([this, i, pin] {
+      // Pinning is best-effort: Without it, the worker merely runs wherever
+      // the scheduler puts it.
+      if (pin)
+        pin_current_thread(nodes_[worker_node_[i]].cpus);
+      work(i);
+    });
+}
+
+thread_pool::~thread_pool() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    stopping_ = true;
+  }
+  work_ready_.notify_all();
+
+  for (std::thread& worker : workers_)
+    worker.join();
+}
+
+void
+thread_pool::submit(task_group& group, std::vector<task> tasks,
+                    dealing deal) {
+  std::vector<std::size_t> all(tasks.size());
+  std::iota(all.begin(), all.end(), 0);
+  std::vector<unsigned> workers(size());
+  std::iota(workers.begin(), workers.end(), 0);
+
+  group.pending_ += tasks.size();
+  deal_out(tasks, all, workers, deal, group);
+  wake_all();
+}
+
+void
+thread_pool::submit(task_group& group, std::vector<task> tasks,
+                    std::vector<unsigned> const& placement, dealing deal) {
+  if (placement.size() != tasks.size())
+    throw std::invalid_argument{"thread_pool::submit: Placement size differs"};
+
+  std::vector<std::vector<std::size_t>> which(nodes());
+  for (std::size_t i = 0; i < tasks.size(); ++i) {
+    if (placement[i] >= nodes())
+      throw std::out_of_range{"thread_pool::submit: No such node"};
+    which[placement[i]].push_back(i);
+  }
+
+  std::vector<std::vector<unsigned>> workers(nodes());
+  for (unsigned w = 0; w < size(); ++w)
+    workers[worker_node_[w]].push_back(w);
+
+  group.pending_ += tasks.size();
+  for (unsigned n = 0; n < nodes(); ++n)
+    // More nodes than workers leaves some without any; their tasks then go to
+    // everyone.
+    if (!workers[n].empty())
+      deal_out(tasks, which[n], workers[n], deal, group);
+    else {
+      std::vector<unsigned> all(size());
+      std::iota(all.begin(), all.end(), 0);
+      deal_out(tasks, which[n], all, deal, group);
+    }
+  wake_all();
+}
+
+void
+thread_pool::wait(task_group& group) {
+  {
+    std::unique_lock<std::mutex> lock{mutex_};
+    all_done_.wait(lock, [&group] { return group.pending_ == 0; });
+  }
+  rethrow(group);
+}
+
+bool
+thread_pool::wait_for(task_group& group, std::chrono::milliseconds timeout) {
+  {
+    std::unique_lock<std::mutex> lock{mutex_};
+    if (!all_done_.wait_for(lock, timeout,
+                            [&group] { return group.pending_ == 0; }))
+      return false;
+  }
+  rethrow(group);
+  return true;
+}
+
+void
+thread_pool::parallel_for(
+  std::size_t begin, std::size_t end, std::size_t grain,
+  std::function<void(std::size_t, std::size_t)> const& f
+) {
+  grain = std::max<std::size_t>(grain, 1);
+
+  // Runs [b, e) grain by grain, giving away the back half of what's left
+  // whenever someone is idle.
+  struct range_task {
+    std::function<void(std::size_t, std::size_t)> const& f;
+    std::size_t b, e, grain;
+
+    void
+    operator () (task_context& context) {
+      while (b < e) {
+        if (e - b > 2 * grain && context.idle_workers()) {
+          std::size_t const middle = b + (e - b) / 2;
+          context.spawn(range_task{f, middle, e, grain});
+          e = middle;
+        }
+
+        std::size_t const next = std::min(b + grain, e);
+        f(b, next);
+        b = next;
+      }
+    }
+  };
+
+  std::vector<task> tasks;
+  std::size_t const n = end > begin ? end - begin : 0;
+  std::size_t const parts =
+    std::min<std::size_t>(size(), (n + grain - 1) / grain);
+  for (std::size_t i = 0; i < parts; ++i)
+    tasks.push_back(range_task{f, begin + n * i / parts,
+                               begin + n * (i + 1) / parts, grain});
+
+  task_group group;
+  submit(group, std::move(tasks));
+  wait(group);
+}
+
+void
+thread_pool::deal_out(std::vector<task>& tasks,
+                      std::vector<std::size_t> const& which,
+                      std::vector<unsigned> const& workers, dealing deal,
+                      task_group& group) {
+  // The w-th worker gets the w-th run of tasks, or every k-th task starting
+  // with the w-th one, k being the number of workers. Its deque is run from the
+  // back, so tasks are pushed in reverse.
+  std::size_t const n = which.size();
+  std::size_t const k = workers.size();
+  for (std::size_t w = 0; w < k; ++w) {
+    std::vector<std::size_t> mine;
+    if (deal == dealing::runs)
+      for (std::size_t i = n * w / k; i < n * (w + 1) / k; ++i)
+        mine.push_back(which[i]);
+    else
+      for (std::size_t i = w; i < n; i += k)
+        mine.push_back(which[i]);
+
+    worker_deque& deque = *deques_[workers[w]];
+    std::lock_guard<std::mutex> lock{deque.mutex};
+    for (auto i = mine.rbegin(); i != mine.rend(); ++i)
+      deque.tasks.push_back({std::move(tasks[*i]), &group});
+    queued_ += mine.size();
+  }
+}
+
+void
+thread_pool::wake_all() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+  }
+  work_ready_.notify_all();
+}
+
+void
+thread_pool::push(unsigned worker, task t, task_group& group) {
+  ++group.pending_;
+  {
+    std::lock_guard<std::mutex> lock{deques_[worker]->mutex};
+    deques_[worker]->tasks.push_back({std::move(t), &group});
+    ++queued_;
+  }
+
+  // Taking the mutex orders this with a worker about to go to sleep, so that
+  // the notification can't fall between its check and its wait.
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+  }
+  work_ready_.notify_one();
+}
+
+bool
+thread_pool::take(unsigned worker, queued_task& t) {
+  if (queued_ == 0)
+    return false;
+
+  {
+    worker_deque& own = *deques_[worker];
+    std::lock_guard<std::mutex> lock{own.mutex};
+    if (!own.tasks.empty()) {
+      t = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      --queued_;
+      return true;
+    }
+  }
+
+  for (unsigned v : victims_[worker]) {
+    worker_deque& victim = *deques_[v];
+    std::lock_guard<std::mutex> lock{victim.mutex};
+    if (!victim.tasks.empty()) {
+      t = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      --queued_;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void
+thread_pool::work(unsigned worker) {
+  task_context context{*this, worker};
+
+  while (true) {
+    queued_task t;
+    if (take(worker, t)) {
+      --idle_;
+      task_group& group = *t.group;
+      context.group_ = &group;
+      try {
+        t.t(context);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (!group.error_)
+          group.error_ = std::current_exception();
+      }
+      t.t = nullptr;  // Release whatever the task holds before reporting.
+      ++idle_;
+
+      // The group may be gone as soon as its last task is reported done.
+      if (--group.pending_ == 0) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        all_done_.notify_all();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock{mutex_};
+    work_ready_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+    if (stopping_ && queued_ == 0)
+      return;
+  }
+}
+
+void
+thread_pool::rethrow(task_group& group) {
+  std::exception_ptr error;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    std::swap(error, group.error_);
+  }
+  if (error)
+    std::rethrow_exception(error);
+}
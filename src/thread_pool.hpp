@@ -0,0 +1,225 @@
+#ifndef OXATRACE_THREAD_POOL_HPP
+#define OXATRACE_THREAD_POOL_HPP
+
+#include "topology.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace oxatrace {
+
+class thread_pool;
+
+// Tasks submitted to a thread_pool to be waited for together, apart from
+// whatever else runs on the pool. Tasks spawned by a task belong to its group.
+//
+// A group must outlive its tasks, so it should be waited for before it is
+// destroyed.
+class task_group {
+public:
+  task_group() = default;
+
+  task_group(task_group const&) = delete;
+  task_group& operator = (task_group const&) = delete;
+
+private:
+  friend class thread_pool;
+
+  std::atomic<std::size_t> pending_{0};  // Tasks queued or running.
+  std::exception_ptr       error_;       // Guarded by the pool's mutex.
+};
+
+// What a running task knows about the worker running it.
+class task_context {
+public:
+  // Index of the worker, in [0, thread_pool::size()). Tasks may use it to
+  // find per-worker state.
+  unsigned worker() const noexcept { return worker_; }
+
+  // Are there workers with nothing to do, and no queued tasks left for them?
+  // A long task should then split off part of its remaining work through
+  // spawn, so that they can take it.
+  bool idle_workers() const noexcept;
+
+  // Queue another task in the current task's group, on this worker's deque.
+  template <typename Task>
+  void spawn(Task&& t);
+
+private:
+  friend class thread_pool;
+
+  task_context(thread_pool& pool, unsigned worker)
+    : pool_(pool)
+    , worker_{worker} { }
+
+  thread_pool& pool_;
+  unsigned     worker_;
+  task_group*  group_ = nullptr;  // Of the task being run.
+};
+
+using task = std::function<void(task_context&)>;
+
+// A fixed set of worker threads, kept for the lifetime of the pool, so that
+// running work on them involves no thread creation.
+//
+// Every worker owns a deque of tasks. It runs tasks from the back of its own
+// deque and, once that is empty, steals from the front of the others'. Tasks
+// given to submit are by default dealt out in contiguous runs, so that each
+// worker starts with neighbouring tasks, and a thief takes the task farthest
+// away from what its victim is working on. Tasks sorted by decreasing cost
+// should rather be dealt round-robin, so that every worker starts with an
+// expensive one. Workers with nothing to steal sleep until more tasks are
+// queued.
+//
+// Tasks should be coarse and split themselves when task_context says workers
+// are idle; see parallel_for for an example.
+//
+// On a machine with several NUMA nodes, the pool may be given the nodes to run
+// on. Its workers are then split among them in contiguous groups, optionally
+// pinned to their node's CPUs, and prefer stealing from workers of their own
+// node. Tasks may be submitted with the node each should run on, so that they
+// run close to the memory they write.
+//
+// Tasks may be submitted from any thread, also while others are running. Each
+// is submitted in a task_group, and waiting is for a group's tasks only, so
+// that users sharing a pool, such as a render_service and a render_pass, don't
+// wait for each other.
+class thread_pool {
+public:
+  // Start threads workers on the given nodes, or without regard for NUMA if
+  // nodes is empty. If pin is set, each worker is kept on the CPUs of its node;
+  // otherwise, the scheduler is free to move it elsewhere.
+  //
+  // Throws std::out_of_range: threads is 0.
+  explicit
+  thread_pool(unsigned threads, std::vector<numa_node> const& nodes = {},
+              bool pin = false);
+
+  thread_pool(thread_pool const&) = delete;
+  thread_pool& operator = (thread_pool const&) = delete;
+
+  ~thread_pool();
+
+  unsigned
+  size() const noexcept { return workers_.size(); }
+
+  // Nodes the workers are spread over, numbered from 0 in the order given to
+  // the constructor. A pool started without nodes has one.
+  unsigned
+  nodes() const noexcept { return nodes_.size(); }
+
+  numa_node const&
+  node(unsigned index) const { return nodes_.at(index); }
+
+  // Index of the node given worker runs on.
+  unsigned
+  node_of(unsigned worker) const { return worker_node_.at(worker); }
+
+  // How submit deals tasks out to the workers: in contiguous runs, the first
+  // run going to the first worker and so on, or one by one in turn. Each
+  // worker takes its tasks in the order they were given.
+  enum class dealing {
+    runs,
+    round_robin
+  };
+
+  // Start running tasks as part of group.
+  void
+  submit(task_group& group, std::vector<task> tasks,
+         dealing deal = dealing::runs);
+
+  // Start running tasks as part of group, dealing each one to the workers of
+  // node placement[i]. Other nodes' workers may still steal it once they run
+  // out of work.
+  //
+  // Throws std::invalid_argument: placement and tasks differ in size.
+  //        std::out_of_range: A node index is not below nodes().
+  void
+  submit(task_group& group, std::vector<task> tasks,
+         std::vector<unsigned> const& placement, dealing deal = dealing::runs);
+
+  // Wait until the tasks of group, and all tasks they spawned, are done. If
+  // any of them threw, the first exception is rethrown here.
+  void
+  wait(task_group& group);
+
+  // Like wait, but give up after timeout. Returns whether all tasks of group
+  // are done.
+  bool
+  wait_for(task_group& group, std::chrono::milliseconds timeout);
+
+  // Call f(b, e) over consecutive subranges [b, e) of [begin, end), at most
+  // grain long, in parallel, and wait until done. Whenever workers are idle,
+  // the remaining range of a task is halved and one half given to them. Only
+  // these tasks are waited for, not others running on the pool.
+  void
+  parallel_for(std::size_t begin, std::size_t end, std::size_t grain,
+               std::function<void(std::size_t, std::size_t)> const& f);
+
+private:
+  friend class task_context;
+
+  // A task along with the group it belongs to.
+  struct queued_task {
+    oxatrace::task t;
+    task_group*    group;
+  };
+
+  struct worker_deque {
+    std::mutex              mutex;
+    std::deque<queued_task> tasks;
+  };
+
+  std::vector<std::unique_ptr<worker_deque>> deques_;
+  std::vector<std::thread>                   workers_;
+  std::vector<numa_node>                     nodes_;
+  std::vector<unsigned>                      worker_node_;
+  std::vector<std::vector<unsigned>>         victims_;  // In stealing order.
+
+  std::mutex               mutex_;       // Guards sleeping and waking up.
+  std::condition_variable  work_ready_;
+  std::condition_variable  all_done_;
+  std::atomic<std::size_t> queued_{0};   // Tasks in the deques.
+  std::atomic<unsigned>    idle_{0};     // Workers looking for tasks.
+  bool                     stopping_ = false;
+
+  void
+  push(unsigned worker, task t, task_group& group);
+
+  // Deal tasks[i] for i in which to the given workers, as part of group.
+  void
+  deal_out(std::vector<task>& tasks, std::vector<std::size_t> const& which,
+           std::vector<unsigned> const& workers, dealing deal,
+           task_group& group);
+
+  void
+  wake_all();
+
+  bool
+  take(unsigned worker, queued_task& t);
+
+  void
+  work(unsigned worker);
+
+  void
+  rethrow(task_group& group);
+};
+
+template <typename Task>
+void
+task_context::spawn(Task&& t) {
+  pool_.push(worker_, task(std::forward<Task>(t)), *group_);
+}
+
+}  // namespace oxatrace
+
+#endif
@@ -0,0 +1,243 @@
+#include "tile_stream.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+using namespace oxatrace;
+
+namespace {
+
+constexpr std::uint32_t VERSION = 1;
+
+enum frame_kind : std::uint32_t {
+  TILE = 1,
+  END  = 2
+};
+
+// Builds the bytes of a frame or of the header.
+class frame {
+public:
+  void
+  put(std::uint32_t x) {
+    for (unsigned i = 0; i < 4; ++i)
+      bytes_.push_back((x >> (8 * i)) & 0xff);
+  }
+
+  void
+  put(float f) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    put(bits);
+  }
+
+  void
+  put(std::string const& s) {
+    bytes_.insert(bytes_.end(), s.begin(), s.end());
+  }
+
+  void
+  put_byte(std::uint8_t b) { bytes_.push_back(b); }
+
+  void
+  clear() { bytes_.clear(); }
+
+  unsigned char const*
+  data() const { return bytes_.data(); }
+
+  std::size_t
+  size() const { return bytes_.size(); }
+
+private:
+  std::vector<unsigned char> bytes_;
+};
+
+}  // anonymous namespace
+
+std::string
+oxatrace::stream_pixels_name(stream_pixels pixels) {
+  switch (pixels) {
+  case stream_pixels::hdr: return "hdr";
+  case stream_pixels::ldr: return "ldr";
+  }
+
+  return "unknown";
+}
+
+stream_pixels
+oxatrace::parse_stream_pixels(std::string const& name) {
+  for (stream_pixels p : {stream_pixels::hdr, stream_pixels::ldr})
+    if (name == stream_pixels_name(p))
+      return p;
+
+  throw std::invalid_argument{"parse_stream_pixels: Unknown pixels " + name};
+}
+
+tile_stream::tile_stream(std::string const& filename,
+                         std::vector<stream_image> images, std::size_t tiles,
+                         stream_pixels pixels, tone_curve const& curve)
+  : images_(std::move(images))
+  , pixels_{pixels}
+  , fd_{STDOUT_FILENO}
+  , close_{false}
+  , slots_{new slot[tiles]}
+  , capacity_{tiles}
+{
+  if (pixels == stream_pixels::ldr)
+    table_ = make_develop_table(curve);
+
+  if (sem_init(&available_, 0, 0) != 0)
+    throw std::system_error{errno, std::generic_category(),
+                            "tile_stream: sem_init"};
+
+  if (filename != "-") {
+    fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+               0666);
+    if (fd_ < 0) {
+      int const error = errno;
+      sem_destroy(&available_);
+      throw std::system_error{error, std::generic_category(),
+                              "tile_stream: Can't open " + filename};
+    }
+    close_ = true;
+  }
+
+  writer_ = std::thread{[this] { write_all(); }};
+}
+
+tile_stream::~tile_stream() {
+  if (writer_.joinable())
+    end();
+  sem_destroy(&available_);
+  if (close_)
+    close(fd_);
+}
+
+void
+tile_stream::push(std::size_t image, tile const& t) {
+  std::size_t const i = taken_++;
+  if (i >= capacity_)
+    throw std::logic_error{"tile_stream::push: More tiles than the stream "
+                           "was made for"};
+  assert(image < images_.size());
+
+  slots_[i].image = image;
+  slots_[i].tile = t;
+  slots_[i].ready.store(true, std::memory_order_release);
+  sem_post(&available_);
+}
+
+void
+tile_stream::finish() {
+  complete_ = true;
+  end();
+
+  if (error_ != 0)
+    throw std::system_error{error_, std::generic_category(),
+                            "tile_stream: Can't write the tiles"};
+}
+
+void
+tile_stream::end() {
+  // Slots past the capacity were refused by push, and have no post.
+  end_ = std::min(taken_.load(), capacity_);
+  sem_post(&available_);
+  writer_.join();
+}
+
+void
+tile_stream::write_all() {
+  // A consumer gone away should fail the writes with EPIPE rather than kill
+  // the process. The signal is sent to the thread that wrote, so it is only
+  // blocked here.
+  sigset_t pipe;
+  sigemptyset(&pipe);
+  sigaddset(&pipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe, nullptr);
+
+  frame f;
+  f.put(std::string{"OXTS"});
+  f.put(VERSION);
+  f.put(std::uint32_t(pixels_));
+  f.put(std::uint32_t(images_.size()));
+  for (stream_image const& i : images_) {
+    f.put(std::uint32_t(i.image->width()));
+    f.put(std::uint32_t(i.image->height()));
+    f.put(std::uint32_t(i.name.size()));
+    f.put(i.name);
+  }
+  write(f.data(), f.size());
+
+  hdr_image pixels{1, 1};  // Copy of the tile being written.
+  ldr_image developed{1, 1};
+  for (std::size_t next = 0; ; ++next) {
+    while (sem_wait(&available_) != 0)
+      assert(errno == EINTR);
+    if (next == end_.load()) {
+      if (complete_) {
+        f.clear();
+        f.put(std::uint32_t(END));
+        write(f.data(), f.size());
+      }
+      break;
+    }
+
+    // The push that took this slot may still be filling it in, having been
+    // overtaken by a later one.
+    slot& s = slots_[next];
+    while (!s.ready.load(std::memory_order_acquire))
+      std::this_thread::yield();
+    if (error_ != 0)
+      continue;
+
+    tile const& t = s.tile;
+    hdr_image const& image = *images_[s.image].image;
+    f.clear();
+    f.put(std::uint32_t(TILE));
+    for (std::size_t x : {s.image, t.x, t.y, t.width, t.height})
+      f.put(std::uint32_t(x));
+
+    if (pixels.width() != t.width || pixels.height() != t.height) {
+      pixels = hdr_image{t.width, t.height};
+      developed = ldr_image{t.width, t.height};
+    }
+    for (std::size_t y = 0; y < t.height; ++y)
+      std::copy(&image.pixel_at(t.x, t.y + y),
+                &image.pixel_at(t.x, t.y + y) + t.width,
+                &pixels.pixel_at(0, y));
+
+    if (pixels_ == stream_pixels::hdr)
+      for (hdr_color const& p : pixels)
+        for (std::size_t c = 0; c < 3; ++c)
+          f.put(float(p[c]));
+    else {
+      develop_pixels(pixels, 0, pixels.size(), table_, developed);
+      for (ldr_color const& p : developed)
+        for (std::size_t c = 0; c < 3; ++c)
+          f.put_byte(p[c]);
+    }
+    write(f.data(), f.size());
+  }
+}
+
+void
+tile_stream::write(unsigned char const* data, std::size_t size) {
+  while (size > 0 && error_ == 0) {
+    ssize_t const written = ::write(fd_, data, size);
+    if (written < 0) {
+      if (errno != EINTR)
+        error_ = errno;
+      continue;
+    }
+    data += written;
+    size -= written;
+  }
+}
@@ -0,0 +1,137 @@
+#ifndef OXATRACE_TILE_STREAM_HPP
+#define OXATRACE_TILE_STREAM_HPP
+
+#include "image.hpp"
+#include "tiles.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <semaphore.h>
+
+namespace oxatrace {
+
+// Pixels sent by a tile_stream.
+enum class stream_pixels {
+  hdr,  // As traced: three floats per pixel.
+  ldr   // Developed by a tone_curve: three bytes per pixel.
+};
+
+// Name of a kind of pixels as used on the command line: "hdr" or "ldr".
+std::string
+stream_pixels_name(stream_pixels pixels);
+
+// Get the kind of pixels of given name.
+//
+// Throws std::invalid_argument: Unknown name.
+stream_pixels
+parse_stream_pixels(std::string const& name);
+
+// An image whose tiles are streamed.
+struct stream_image {
+  std::string      name;
+  hdr_image const* image;
+};
+
+// Writes the tiles of images to a file or pipe as each is rendered, so that a
+// consumer can start on them long before the whole images are done.
+//
+// The stream is a header followed by frames. All numbers are 32-bit unsigned
+// integers or IEEE single-precision floats, little-endian. The header is
+//
+//   "OXTS", version (1), pixels (0 for hdr, 1 for ldr), images,
+//
+// then for each image its width, height, the length of its name and the name's
+// bytes. Each frame starts with its kind: 1 is a tile,
+//
+//   1, image, x, y, width, height,
+//
+// followed by the tile's pixels row by row, each as red, green and blue floats
+// or bytes; 2 ends the stream, and nothing follows it. A stream cut short
+// without it means the renderer failed. Tiles come in the order they were
+// finished, which needn't be that they were rendered in.
+//
+// Tiles are pushed by the workers that rendered them, and written by a thread
+// of the stream's own. Pushing takes a slot of an array with room for every
+// tile by an atomic increment, and wakes the writer through a semaphore, so
+// workers never wait on a lock or on output, however slow the consumer. The
+// pixels are read from the image by the writer, so pushed tiles must not be
+// changed.
+class tile_stream {
+public:
+  // Start writing to filename, or to standard output if it is "-", which is
+  // left open. At most tiles tiles of images will be pushed. ldr pixels are
+  // developed by curve.
+  //
+  // Throws std::system_error: Can't open filename, or set up the semaphore.
+  tile_stream(std::string const& filename, std::vector<stream_image> images,
+              std::size_t tiles, stream_pixels pixels,
+              tone_curve const& curve = {});
+
+  tile_stream(tile_stream const&) = delete;
+  tile_stream& operator = (tile_stream const&) = delete;
+
+  // Writes what was pushed, but not the end frame.
+  ~tile_stream();
+
+  // Queue tile t of images[image], whose pixels are final. Thread-safe and
+  // lock-free.
+  //
+  // Throws std::logic_error: All the tiles the stream was made for were
+  //                          pushed already.
+  void
+  push(std::size_t image, tile const& t);
+
+  // Write the end frame after all that was pushed, and wait until it is
+  // written. No tiles may be pushed meanwhile or after.
+  //
+  // Throws std::system_error: Writing failed, for example because the
+  // consumer closed its end of a pipe.
+  void
+  finish();
+
+private:
+  struct slot {
+    std::atomic<bool> ready{false};
+    std::size_t       image;
+    oxatrace::tile    tile;
+  };
+
+  // No more slots will be taken than end_, once it is set.
+  static constexpr std::size_t OPEN = std::size_t(-1);
+
+  std::vector<stream_image> images_;
+  stream_pixels             pixels_;
+  develop_table             table_;
+  int                       fd_;
+  bool                      close_;      // Whether fd_ is ours.
+  std::unique_ptr<slot[]>   slots_;
+  std::size_t               capacity_;
+  std::atomic<std::size_t>  taken_{0};   // Slots taken by push.
+  std::atomic<std::size_t>  end_{OPEN};
+  bool                      complete_ = false;  // Set by finish.
+  sem_t                     available_;  // Posted once per push, and by end.
+  int                       error_ = 0;  // errno of failed writing.
+  std::thread               writer_;
+
+  // Stop the writer once it has written all that was pushed, and the end
+  // frame if complete_ is set.
+  void
+  end();
+
+  void
+  write_all();
+
+  // Write size bytes of data, unless writing failed before.
+  void
+  write(unsigned char const* data, std::size_t size);
+};
+
+}  // namespace oxatrace
+
+#endif
@@ -0,0 +1,121 @@
+#include "tiles.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+using namespace oxatrace;
+
+// Interleave the bits of x and y, x taking the even ones.
+static std::uint64_t
+morton_index(std::uint32_t x, std::uint32_t y) {
+  auto spread = [] (std::uint64_t v) {
+    v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+    v = (v | (v << 8))  & 0x00FF00FF00FF00FFull;
+    v = (v | (v << 4))  & 0x0F0F0F0F0F0F0F0Full;
+    v = (v | (v << 2))  & 0x3333333333333333ull;
+    v = (v | (v << 1))  & 0x5555555555555555ull;
+    return v;
+  };
+  return spread(x) | (spread(y) << 1);
+}
+
+// Distance of (x, y) along the Hilbert curve filling a side x side square,
+// side being a power of two.
+static std::uint64_t
+hilbert_index(std::uint32_t x, std::uint32_t y, std::uint32_t side) {
+  std::uint64_t d = 0;
+  for (std::uint32_t s = side / 2; s > 0; s /= 2) {
+    std::uint32_t const rx = (x & s) ? 1 : 0;
+    std::uint32_t const ry = (y & s) ? 1 : 0;
+    d += std::uint64_t(s) * s * ((3 * rx) ^ ry);
+
+    // Rotate the quadrant so that the curve within it starts and ends where
+    // the next level expects it to.
+    if (ry == 0) {
+      if (rx == 1) {
+        x = side - 1 - x;
+        y = side - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
+std::string
+oxatrace::tile_order_name(tile_order order) {
+  switch (order) {
+  case tile_order::rows:    return "rows";
+  case tile_order::morton:  return "morton";
+  case tile_order::hilbert: return "hilbert";
+  }
+
+  return "unknown";
+}
+
+tile_order
+oxatrace::parse_tile_order(std::string const& name) {
+  for (tile_order o : {tile_order::rows, tile_order::morton,
+                       tile_order::hilbert})
+    if (name == tile_order_name(o))
+      return o;
+
+  throw std::invalid_argument{"parse_tile_order: Unknown tile order " + name};
+}
+
+std::vector<tile>
+oxatrace::make_tiles(std::size_t width, std::size_t height, std::size_t side,
+                     tile_order order) {
+  if (side == 0)
+    throw std::invalid_argument{"make_tiles: Tile side must be positive"};
+
+  std::size_t const columns = (width + side - 1) / side;
+  std::size_t const rows = (height + side - 1) / side;
+
+  // The curves are laid over the smallest power-of-two square covering all
+  // tiles; tiles are then sorted by their position along the curve.
+  std::uint32_t square = 1;
+  while (square < columns || square < rows)
+    square *= 2;
+
+  struct keyed_tile {
+    std::uint64_t key;
+    oxatrace::tile tile;
+  };
+  std::vector<keyed_tile> keyed;
+  keyed.reserve(columns * rows);
+
+  for (std::size_t row = 0; row < rows; ++row)
+    for (std::size_t column = 0; column < columns; ++column) {
+      std::size_t const x = column * side;
+      std::size_t const y = row * side;
+      oxatrace::tile const t{x, y, std::min(side, width - x),
+                             std::min(side, height - y)};
+
+      std::uint64_t key = 0;
+      switch (order) {
+      case tile_order::rows:
+        key = row * columns + column;
+        break;
+      case tile_order::morton:
+        key = morton_index(column, row);
+        break;
+      case tile_order::hilbert:
+        key = hilbert_index(column, row, square);
+        break;
+      }
+      keyed.push_back({key, t});
+    }
+
+  std::sort(keyed.begin(), keyed.end(),
+            [] (keyed_tile const& a, keyed_tile const& b) {
+              return a.key < b.key;
+            });
+
+  std::vector<tile> result;
+  result.reserve(keyed.size());
+  for (keyed_tile const& k : keyed)
+    result.push_back(k.tile);
+  return result;
+}
@@ -0,0 +1,68 @@
+#ifndef OXATRACE_TILES_HPP
+#define OXATRACE_TILES_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace oxatrace {
+
+// A rectangular block of pixels of an image.
+struct tile {
+  std::size_t x, y;            // The top-left pixel.
+  std::size_t width, height;
+};
+
+// Order in which the tiles of an image are rendered.
+//
+// Tiles rendered one after another by a thread, or at the same time by
+// different threads, should see the same parts of the scene, so that they
+// share as much of the cache as possible. The space-filling curves keep
+// consecutive tiles close together in both directions; going by rows jumps
+// back across the whole image at the end of each row.
+enum class tile_order {
+  rows,     // Row by row, left to right.
+  morton,   // Z-order curve.
+  hilbert   // Hilbert curve.
+};
+
+// How images are cut into tiles for rendering, and in which order these are
+// rendered.
+//
+// If longest_first is set, the renderer estimates the cost of each tile by a
+// quick pass at a lower resolution, and renders the most expensive tiles
+// first; order then only breaks ties. Otherwise, tiles go in order.
+struct tiling {
+  std::size_t side          = 32;
+  tile_order  order         = tile_order::hilbert;
+  bool        longest_first = true;
+};
+
+// Name of an order as used on the command line: "rows", "morton" or
+// "hilbert".
+std::string
+tile_order_name(tile_order order);
+
+// Get the order of given name.
+//
+// Throws std::invalid_argument: Unknown name.
+tile_order
+parse_tile_order(std::string const& name);
+
+// Cut an image of given dimensions into tiles of side x side pixels, and list
+// them in given order. Tiles at the right and bottom edges are cut to fit the
+// image.
+//
+// Throws std::invalid_argument: side is 0.
+std::vector<tile>
+make_tiles(std::size_t width, std::size_t height, std::size_t side,
+           tile_order order);
+
+inline std::vector<tile>
+make_tiles(std::size_t width, std::size_t height, tiling const& t) {
+  return make_tiles(width, height, t.side, t.order);
+}
+
+}  // namespace oxatrace
+
+#endif
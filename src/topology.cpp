@@ -0,0 +1,143 @@
+#include "topology.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace oxatrace;
+
+// CPUs the process may run on.
+static std::vector<unsigned>
+allowed_cpus() {
+  std::vector<unsigned> result;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof set, &set) == 0) {
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      if (CPU_ISSET(cpu, &set))
+        result.push_back(cpu);
+  } else {
+    for (unsigned cpu = 0; cpu < std::thread::hardware_concurrency(); ++cpu)
+      result.push_back(cpu);
+  }
+  return result;
+}
+
+std::vector<unsigned>
+oxatrace::parse_cpu_list(std::string const& list) {
+  std::vector<unsigned> result;
+  std::istringstream in{list};
+  std::string range;
+
+  while (std::getline(in, range, ',')) {
+    range.erase(std::remove_if(range.begin(), range.end(),
+                               [] (char c) { return std::isspace(c); }),
+                range.end());
+    if (range.empty())
+      continue;
+
+    std::size_t const dash = range.find('-');
+    try {
+      std::size_t end_first;
+      unsigned const first = std::stoul(range.substr(0, dash), &end_first);
+      unsigned last = first;
+      if (dash != std::string::npos) {
+        std::size_t end_last;
+        last = std::stoul(range.substr(dash + 1), &end_last);
+        if (end_last != range.size() - dash - 1)
+          throw std::invalid_argument{range};
+      } else if (end_first != range.size())
+        throw std::invalid_argument{range};
+
+      if (last < first)
+        throw std::invalid_argument{range};
+      for (unsigned cpu = first; cpu <= last; ++cpu)
+        result.push_back(cpu);
+    } catch (std::logic_error const&) {
+      throw std::invalid_argument{"parse_cpu_list: Malformed list " + list};
+    }
+  }
+
+  return result;
+}
+
+std::vector<numa_node>
+oxatrace::detect_numa_nodes() {
+  std::vector<unsigned> const allowed = allowed_cpus();
+  std::vector<numa_node> result;
+
+  char const* const root = "/sys/devices/system/node";
+  if (DIR* dir = opendir(root)) {
+    while (dirent const* entry = readdir(dir)) {
+      std::string const name = entry->d_name;
+      if (name.compare(0, 4, "node") != 0 || name.size() == 4
+          || !std::all_of(name.begin() + 4, name.end(), ::isdigit))
+        continue;
+
+      std::ifstream in{std::string{root} + "/" + name + "/cpulist"};
+      std::string list;
+      if (!std::getline(in, list))
+        continue;
+
+      numa_node node{unsigned(std::stoul(name.substr(4))), {}};
+      for (unsigned cpu : parse_cpu_list(list))
+        if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+          node.cpus.push_back(cpu);
+      if (!node.cpus.empty())
+        result.push_back(std::move(node));
+    }
+    closedir(dir);
+  }
+
+  if (result.empty())
+    result.push_back({0, allowed});
+
+  std::sort(result.begin(), result.end(),
+            [] (numa_node const& a, numa_node const& b) {
+              return a.id < b.id;
+            });
+  return result;
+}
+
+bool
+oxatrace::pin_current_thread(std::vector<unsigned> const& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (unsigned cpu : cpus)
+    if (cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+
+  return pthread_setaffinity_np(pthread_self(), sizeof set, &set) == 0;
+}
+
+bool
+oxatrace::bind_to_node(void const* begin, std::size_t bytes, unsigned node) {
+  std::uintptr_t const page = sysconf(_SC_PAGESIZE);
+  std::uintptr_t const first =
+    (reinterpret_cast<std::uintptr_t>(begin) + page - 1) / page * page;
+  std::uintptr_t const last =
+    (reinterpret_cast<std::uintptr_t>(begin) + bytes) / page * page;
+  if (last <= first)
+    return true;
+
+  constexpr std::size_t MASK_BITS = 8 * sizeof(unsigned long);
+  if (node >= MASK_BITS)
+    return false;
+  unsigned long const mask = 1ul << node;
+
+  // There's no glibc wrapper for this one either, and libnuma would be a
+  // dependency for just this call.
+  return syscall(SYS_mbind, first, last - first, MPOL_BIND, &mask, MASK_BITS,
+                 MPOL_MF_MOVE) == 0;
+}
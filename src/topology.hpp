@@ -0,0 +1,42 @@
+#ifndef OXATRACE_TOPOLOGY_HPP
+#define OXATRACE_TOPOLOGY_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace oxatrace {
+
+// A NUMA node: a set of CPUs sharing the memory closest to them.
+struct numa_node {
+  unsigned              id;    // As numbered by the kernel.
+  std::vector<unsigned> cpus;  // Those this process may run on.
+};
+
+// Read the NUMA nodes of this machine from /sys/devices/system/node. Only CPUs
+// this process is allowed to run on are listed, and nodes without any of them
+// are left out. If the kernel doesn't report any nodes, all CPUs are put in a
+// single node 0.
+std::vector<numa_node>
+detect_numa_nodes();
+
+// Parse a list of CPUs in the kernel's format, such as "0-3,8,10-11".
+//
+// Throws std::invalid_argument: Malformed list.
+std::vector<unsigned>
+parse_cpu_list(std::string const& list);
+
+// Restrict the calling thread to run on the given CPUs only. Returns whether
+// the kernel complied.
+bool
+pin_current_thread(std::vector<unsigned> const& cpus);
+
+// Move the pages lying entirely within [begin, begin + bytes) to given node,
+// and keep them there. Returns whether the kernel complied; if it didn't, the
+// memory simply stays where it was.
+bool
+bind_to_node(void const* begin, std::size_t bytes, unsigned node);
+
+}  // namespace oxatrace
+
+#endif